@@ -5,9 +5,12 @@
 #include "cmd-handler.h"
 
 #include <algorithm>
+#include <cctype>
 #include <cinttypes>
 #include <string>
+#include <vector>
 
+#include "debugger-utils/agent-expression.h"
 #include "debugger-utils/util.h"
 
 #include "inferior-control/registers.h"
@@ -27,30 +30,61 @@ namespace debugserver {
 namespace {
 
 const char kSupportedFeatures[] =
+    "BreakpointCommands+;"
+    "ConditionalBreakpoints+;"
+    "ConditionalTracepoints+;"
+    "QListThreadsInStopReply+;"
     "QNonStop+;"
+    "QStartNoAckMode+;"
+    "QTBuffer:size+;"
+    "binary-upload+;"
 #if 0  // TODO(dje)
   "QThreadEvents+;"
 #endif
 #if 0  // TODO(dje)
   "swbreak+;"
 #endif
-    "qXfer:auxv:read+";
+    "qXfer:auxv:read+;"
+    "qXfer:libraries-svr4:read+;"
+    "qXfer:threads:read+;"
+    "tracenz+;"
+    "vContSupported+";
 
 const char kAttached[] = "Attached";
 const char kCurrentThreadId[] = "C";
 const char kFirstThreadInfo[] = "fThreadInfo";
+const char kListThreadsInStopReply[] = "ListThreadsInStopReply";
 const char kNonStop[] = "NonStop";
 const char kRcmd[] = "Rcmd,";
+const char kStartNoAckMode[] = "StartNoAckMode";
 const char kSubsequentThreadInfo[] = "sThreadInfo";
 const char kSupported[] = "Supported";
 const char kXfer[] = "Xfer";
 
+// Tracepoint q/Q commands
+const char kTraceBuffer[] = "TBuffer";
+const char kTraceFrame[] = "TFrame";
+const char kTraceInit[] = "Tinit";
+const char kTraceReadOnly[] = "Tro";
+const char kTraceStart[] = "TStart";
+const char kTraceStatus[] = "TStatus";
+const char kTraceStop[] = "TStop";
+const char kTracepoint[] = "TDP";
+const char kTracepointStatus[] = "TP";
+
+// j Commands
+const char kThreadsInfo[] = "ThreadsInfo";
+
 // v Commands
 const char kAttach[] = "Attach;";
 const char kCont[] = "Cont;";
+const char kContQuery[] = "Cont?";
 const char kKill[] = "Kill;";
 const char kRun[] = "Run;";
 
+// Z options
+const char kCommands[] = "cmds:";
+
 // qRcmd commands
 const char kExit[] = "exit";
 const char kHelp[] = "help";
@@ -79,6 +113,144 @@ bool StartsWith(const ftl::StringView& str, const ftl::StringView& prefix) {
   return str.substr(0, prefix.size()) == prefix;
 }
 
+// Parses the hex number at the start of |*text| into |*out_value| and removes
+// it from |*text|. Returns false if there isn't one.
+bool ConsumeHexNumber(ftl::StringView* text, uint64_t* out_value) {
+  size_t length = 0;
+  while (length < text->size() && isxdigit((*text)[length]))
+    ++length;
+  if (!length ||
+      !ftl::StringToNumberWithError<uint64_t>(text->substr(0, length),
+                                              out_value, ftl::Base::k16))
+    return false;
+  text->remove_prefix(length);
+  return true;
+}
+
+// Removes |c| from the start of |*text|. Returns false if it isn't there.
+bool ConsumeChar(ftl::StringView* text, char c) {
+  if (text->empty() || (*text)[0] != c)
+    return false;
+  text->remove_prefix(1);
+  return true;
+}
+
+// Parses the actions of a QTDP packet ("R mask", "M basereg,offset,length"
+// and "X len,expr", back to back) into |tracepoint|.
+bool ParseTracepointActions(ftl::StringView actions,
+                            TracepointSet::Tracepoint* tracepoint) {
+  while (!actions.empty()) {
+    char action = actions[0];
+    actions.remove_prefix(1);
+    switch (action) {
+      case 'R': {
+        // We collect all the general registers, whatever the mask says.
+        uint64_t mask;
+        if (!ConsumeHexNumber(&actions, &mask))
+          return false;
+        tracepoint->collect_registers = true;
+        break;
+      }
+      case 'M': {
+        // A negative base register (-1, or 0xffffffff from older gdbs) means
+        // the offset is an address.
+        bool negative = ConsumeChar(&actions, '-');
+        uint64_t base_regno;
+        TracepointSet::MemoryRange range;
+        if (!ConsumeHexNumber(&actions, &base_regno) ||
+            !ConsumeChar(&actions, ',') ||
+            !ConsumeHexNumber(&actions, &range.offset) ||
+            !ConsumeChar(&actions, ',') ||
+            !ConsumeHexNumber(&actions, &range.length))
+          return false;
+        range.base_regno = static_cast<int>(base_regno);
+        if (negative)
+          range.base_regno = -range.base_regno;
+        tracepoint->memory.push_back(range);
+        break;
+      }
+      case 'X': {
+        size_t size;
+        std::unique_ptr<util::AgentExpression> expression =
+            util::AgentExpression::Decode(actions, &size);
+        if (!expression)
+          return false;
+        tracepoint->expressions.push_back(std::move(expression));
+        actions.remove_prefix(size);
+        break;
+      }
+      default:
+        // This includes while-stepping actions ('S').
+        FTL_LOG(ERROR) << "Unsupported tracepoint action: " << action;
+        return false;
+    }
+  }
+  return true;
+}
+
+// Returns register |regno| of trace frame |frame| in the form of a 'p'
+// packet reply. Registers that weren't collected are unavailable, except for
+// the pc which is known from the tracepoint.
+std::string GetTraceFrameRegisterAsString(const util::TraceFrame& frame,
+                                          int regno) {
+  size_t offset = 0;
+  for (int i = 0; i < regno; ++i)
+    offset += arch::GetTargetRegisterSize(i) * 2;
+  size_t size = arch::GetTargetRegisterSize(regno);
+  if (frame.registers.size() >= offset + size * 2)
+    return frame.registers.substr(offset, size * 2);
+  if (regno == arch::GetPCRegisterNumber() && size <= sizeof(frame.address)) {
+    return util::EncodeByteArrayString(
+        reinterpret_cast<const uint8_t*>(&frame.address), size);
+  }
+  return std::string(size * 2, 'x');
+}
+
+// Trims |reply|, which ends with binary data escaped with
+// util::EscapeBinaryData(), to at most |max_size| bytes, taking care not to
+// split an escape sequence. Returns true if anything was removed.
+bool TrimEscapedReply(size_t max_size, std::string* reply) {
+  if (reply->size() <= max_size)
+    return false;
+
+  // Escaped characters never include the escape character itself, so any
+  // escape character is the first of a pair.
+  size_t size = max_size;
+  if ((*reply)[size - 1] == util::kEscapeChar)
+    --size;
+  reply->resize(size);
+  return true;
+}
+
+// Replies to a qXfer read request for |length| bytes at |offset| of the
+// object whose contents are |data|. The reply is limited to |max_size| bytes,
+// and is prefixed with 'l' if it includes the end of the data, or 'm' if the
+// client should ask for more.
+bool ReplyWithXferData(const ftl::StringView& data,
+                       size_t offset,
+                       size_t length,
+                       size_t max_size,
+                       const CommandHandler::ResponseCallback& callback) {
+  // We allow the size of the data as the offset, which results in reading 0
+  // bytes.
+  if (offset > data.size()) {
+    FTL_LOG(ERROR) << "qXfer: invalid offset: " << offset;
+    return ReplyWithError(util::ErrorCode::INVAL, callback);
+  }
+
+  size_t available = data.size() - offset;
+  size_t count = std::min(std::min(length, available), max_size - 1);
+
+  std::string reply("l");
+  util::EscapeBinaryData(reinterpret_cast<const uint8_t*>(data.data()) + offset,
+                         count, &reply);
+  if (TrimEscapedReply(max_size, &reply) || count < available)
+    reply[0] = 'm';
+
+  callback(reply);
+  return true;
+}
+
 std::vector<std::string> BuildArgvFor_vRun(const ftl::StringView& packet) {
   std::vector<std::string> argv;
   size_t len = packet.size();
@@ -103,6 +275,20 @@ std::vector<std::string> BuildArgvFor_vRun(const ftl::StringView& packet) {
   return argv;
 }
 
+// Returns the jThreadsInfo "state" of a thread in |state|, or nullptr if the
+// thread is in none that the client knows.
+const char* GetJsonThreadState(Thread::State state) {
+  switch (state) {
+    case Thread::State::kStopped:
+      return "stopped";
+    case Thread::State::kRunning:
+    case Thread::State::kStepping:
+      return "running";
+    default:
+      return nullptr;
+  }
+}
+
 }  // namespace
 
 CommandHandler::CommandHandler(RspServer* server)
@@ -140,10 +326,16 @@ bool CommandHandler::HandleCommand(const ftl::StringView& packet,
       return Handle_G(packet.substr(1), callback);
     case 'H':  // Set a thread for subsequent operations
       return Handle_H(packet.substr(1), callback);
+    case 'j':  // JSON packets (an LLDB extension)
+      return Handle_j(packet.substr(1), callback);
     case 'm':  // Read memory
       return Handle_m(packet.substr(1), callback);
     case 'M':  // Write memory
       return Handle_M(packet.substr(1), callback);
+    case 'p':  // Read a single register
+      return Handle_p(packet.substr(1), callback);
+    case 'P':  // Write a single register
+      return Handle_P(packet.substr(1), callback);
     case 'q':  // General query packet
     case 'Q':  // General set packet
     {
@@ -161,6 +353,10 @@ bool CommandHandler::HandleCommand(const ftl::StringView& packet,
       return Handle_T(packet.substr(1), callback);
     case 'v':  // v-packets
       return Handle_v(packet.substr(1), callback);
+    case 'x':  // Read memory, binary
+      return Handle_x(packet.substr(1), callback);
+    case 'X':  // Write memory, binary
+      return Handle_X(packet.substr(1), callback);
     case 'z':  // Remove software breakpoint
     case 'Z':  // Insert software breakpoint
       return Handle_zZ(packet[0] == 'Z', packet.substr(1), callback);
@@ -380,6 +576,21 @@ bool CommandHandler::Handle_D(const ftl::StringView& packet,
 }
 
 bool CommandHandler::Handle_g(const ResponseCallback& callback) {
+  // While the client looks at a trace frame it sees the registers that were
+  // collected.
+  const util::TraceFrame* trace_frame = GetSelectedTraceFrame();
+  if (trace_frame) {
+    if (!trace_frame->registers.empty()) {
+      callback(trace_frame->registers);
+      return true;
+    }
+    std::string result;
+    for (int regno = 0; regno < arch::GetNumGeneralRegisters(); ++regno)
+      result += GetTraceFrameRegisterAsString(*trace_frame, regno);
+    callback(result);
+    return true;
+  }
+
   // If there is no current process or if the current process isn't attached,
   // then report an error.
   Process* current_process = server_->current_process();
@@ -399,7 +610,10 @@ bool CommandHandler::Handle_g(const ResponseCallback& callback) {
   } else {
     arch::Registers* regs = server_->current_thread()->registers();
     FTL_DCHECK(regs);
-    result = regs->GetGeneralRegistersAsString();
+    // This doesn't make a syscall if the registers have already been read
+    // since the thread stopped.
+    if (regs->RefreshGeneralRegisters())
+      result = regs->GetGeneralRegistersAsString();
   }
 
   if (result.empty()) {
@@ -537,12 +751,22 @@ bool CommandHandler::Handle_H(const ftl::StringView& packet,
   return false;
 }
 
+bool CommandHandler::Handle_j(const ftl::StringView& packet,
+                              const ResponseCallback& callback) {
+  if (packet == kThreadsInfo)
+    return Handle_jThreadsInfo(callback);
+
+  return false;
+}
+
 bool CommandHandler::Handle_m(const ftl::StringView& packet,
                               const ResponseCallback& callback) {
   // If there is no current process or if the current process isn't attached,
-  // then report an error.
+  // then report an error, unless the client is looking at a trace frame.
   Process* current_process = server_->current_process();
-  if (!current_process || !current_process->IsAttached()) {
+  const util::TraceFrame* trace_frame = GetSelectedTraceFrame();
+  if (!trace_frame &&
+      (!current_process || !current_process->IsAttached())) {
     FTL_LOG(ERROR) << "m: No inferior";
     return ReplyWithError(util::ErrorCode::NOENT, callback);
   }
@@ -566,10 +790,28 @@ bool CommandHandler::Handle_m(const ftl::StringView& packet,
     return ReplyWithError(util::ErrorCode::NOENT, callback);
   }
 
+  // Each byte is sent as two hex characters. If the reply wouldn't fit in one
+  // packet then send what does: the client will ask for the rest.
+  size_t max_length = server_->max_packet_size() / 2;
+  if (length > max_length) {
+    FTL_VLOG(1) << "m: Truncating read of " << length << " bytes to "
+                << max_length;
+    length = max_length;
+  }
+
   std::unique_ptr<uint8_t[]> buffer(new uint8_t[length]);
-  if (!current_process->ReadMemory(addr, buffer.get(), length)) {
-    FTL_LOG(ERROR) << "m: Failed to read memory";
-    return ReplyWithError(util::ErrorCode::PERM, callback);
+  if (trace_frame) {
+    if (!ReadTraceFrameMemory(*trace_frame, addr, buffer.get(), length)) {
+      FTL_VLOG(1) << "m: Memory not collected in trace frame";
+      return ReplyWithError(util::ErrorCode::PERM, callback);
+    }
+  } else {
+    if (!current_process->ReadMemory(addr, buffer.get(), length)) {
+      FTL_LOG(ERROR) << "m: Failed to read memory";
+      return ReplyWithError(util::ErrorCode::PERM, callback);
+    }
+    current_process->breakpoints()->HideInternalBreakpoints(
+        addr, buffer.get(), length);
   }
 
   std::string result = util::EncodeByteArrayString(buffer.get(), length);
@@ -644,6 +886,118 @@ bool CommandHandler::Handle_M(const ftl::StringView& packet,
   return ReplyOK(callback);
 }
 
+bool CommandHandler::Handle_p(const ftl::StringView& packet,
+                              const ResponseCallback& callback) {
+  // If there is no current process or if the current process isn't attached,
+  // then report an error.
+  Process* current_process = server_->current_process();
+  if (!current_process || !current_process->IsAttached()) {
+    FTL_LOG(ERROR) << "p: No inferior";
+    return ReplyWithError(util::ErrorCode::NOENT, callback);
+  }
+
+  // If there is no current thread report an error.
+  Thread* current_thread = server_->current_thread();
+  if (!current_thread) {
+    FTL_LOG(ERROR) << "p: No current thread";
+    return ReplyWithError(util::ErrorCode::NOENT, callback);
+  }
+
+  int regno;
+  if (!ftl::StringToNumberWithError<int>(packet, &regno, ftl::Base::k16)) {
+    FTL_LOG(ERROR) << "p: Malformed register number: " << packet;
+    return ReplyWithError(util::ErrorCode::INVAL, callback);
+  }
+
+  size_t size = arch::GetTargetRegisterSize(regno);
+  if (size == 0) {
+    FTL_LOG(ERROR) << "p: Invalid register number: " << regno;
+    return ReplyWithError(util::ErrorCode::INVAL, callback);
+  }
+
+  // Registers that are in the target description but that we can't access
+  // are reported as unavailable.
+  if (regno >= arch::GetNumGeneralRegisters()) {
+    callback(std::string(size * 2, 'x'));
+    return true;
+  }
+
+  // This doesn't make a syscall if the registers have already been read since
+  // the thread stopped.
+  arch::Registers* regs = current_thread->registers();
+  if (!regs->RefreshGeneralRegisters()) {
+    FTL_LOG(ERROR) << "p: Failed to read register values";
+    return ReplyWithError(util::ErrorCode::PERM, callback);
+  }
+
+  std::string result = regs->GetRegisterAsString(regno);
+  if (result.empty()) {
+    FTL_LOG(ERROR) << "p: Failed to read register " << regno;
+    return ReplyWithError(util::ErrorCode::PERM, callback);
+  }
+
+  callback(result);
+  return true;
+}
+
+bool CommandHandler::Handle_P(const ftl::StringView& packet,
+                              const ResponseCallback& callback) {
+  // If there is no current process or if the current process isn't attached,
+  // then report an error.
+  Process* current_process = server_->current_process();
+  if (!current_process || !current_process->IsAttached()) {
+    FTL_LOG(ERROR) << "P: No inferior";
+    return ReplyWithError(util::ErrorCode::NOENT, callback);
+  }
+
+  // If there is no current thread report an error.
+  Thread* current_thread = server_->current_thread();
+  if (!current_thread) {
+    FTL_LOG(ERROR) << "P: No current thread";
+    return ReplyWithError(util::ErrorCode::NOENT, callback);
+  }
+
+  // The packet is of the form: regno=value
+  size_t eq = packet.find('=');
+  if (eq == ftl::StringView::npos) {
+    FTL_LOG(ERROR) << "P: Malformed packet: " << packet;
+    return ReplyWithError(util::ErrorCode::INVAL, callback);
+  }
+
+  int regno;
+  if (!ftl::StringToNumberWithError<int>(packet.substr(0, eq), &regno,
+                                         ftl::Base::k16)) {
+    FTL_LOG(ERROR) << "P: Malformed register number: " << packet;
+    return ReplyWithError(util::ErrorCode::INVAL, callback);
+  }
+
+  size_t size = arch::GetTargetRegisterSize(regno);
+  if (size == 0 || regno >= arch::GetNumGeneralRegisters()) {
+    FTL_LOG(ERROR) << "P: Invalid register number: " << regno;
+    return ReplyWithError(util::ErrorCode::INVAL, callback);
+  }
+
+  ftl::StringView value_string = packet.substr(eq + 1);
+  std::vector<uint8_t> value = util::DecodeByteArrayString(value_string);
+  if (value_string.size() != size * 2 || value.size() != size) {
+    FTL_LOG(ERROR) << "P: Malformed value for register " << regno << ": "
+                   << value_string;
+    return ReplyWithError(util::ErrorCode::INVAL, callback);
+  }
+
+  // Refresh first: the rest of the regset is written back along with the new
+  // value. The write itself is deferred until the thread is resumed.
+  arch::Registers* regs = current_thread->registers();
+  if (!regs->RefreshGeneralRegisters() ||
+      !regs->SetRegister(regno, value.data(), value.size()) ||
+      !regs->WriteGeneralRegisters()) {
+    FTL_LOG(ERROR) << "P: Failed to write register " << regno;
+    return ReplyWithError(util::ErrorCode::PERM, callback);
+  }
+
+  return ReplyOK(callback);
+}
+
 bool CommandHandler::Handle_q(const ftl::StringView& prefix,
                               const ftl::StringView& params,
                               const ResponseCallback& callback) {
@@ -666,9 +1020,16 @@ bool CommandHandler::Handle_q(const ftl::StringView& prefix,
   if (prefix == kSupported)
     return HandleQuerySupported(params, callback);
 
+
   if (prefix == kXfer)
     return HandleQueryXfer(params, callback);
 
+  if (prefix == kTraceStatus)
+    return HandleQueryTraceStatus(callback);
+
+  if (prefix == kTracepointStatus)
+    return HandleQueryTracepointStatus(params, callback);
+
   // TODO(dje): TO-195
   // - QDisableRandomization:VALUE ?
   // - qGetTLSAddr:THREAD-ID,OFFSET,LM
@@ -680,9 +1041,40 @@ bool CommandHandler::Handle_q(const ftl::StringView& prefix,
 bool CommandHandler::Handle_Q(const ftl::StringView& prefix,
                               const ftl::StringView& params,
                               const ResponseCallback& callback) {
+  if (prefix == kListThreadsInStopReply) {
+    if (!params.empty())
+      return ReplyWithError(util::ErrorCode::INVAL, callback);
+    server_->set_list_threads_in_stop_reply(true);
+    return ReplyOK(callback);
+  }
+
   if (prefix == kNonStop)
     return HandleSetNonStop(params, callback);
 
+  if (prefix == kStartNoAckMode)
+    return HandleStartNoAckMode(params, callback);
+
+  if (prefix == kTraceBuffer)
+    return HandleSetTraceBuffer(params, callback);
+
+  if (prefix == kTraceFrame)
+    return HandleSetTraceFrame(params, callback);
+
+  if (prefix == kTraceInit)
+    return HandleSetTraceInit(callback);
+
+  if (prefix == kTraceReadOnly)
+    return HandleSetTraceReadOnly(params, callback);
+
+  if (prefix == kTraceStart)
+    return HandleSetTraceStart(callback);
+
+  if (prefix == kTraceStop)
+    return HandleSetTraceStop(callback);
+
+  if (prefix == kTracepoint)
+    return HandleSetTracepoint(params, callback);
+
   return false;
 }
 
@@ -722,6 +1114,11 @@ bool CommandHandler::Handle_v(const ftl::StringView& packet,
     return Handle_vAttach(packet.substr(std::strlen(kAttach)), callback);
   if (StartsWith(packet, kCont))
     return Handle_vCont(packet.substr(std::strlen(kCont)), callback);
+  if (packet == kContQuery) {
+    // The actions Handle_vCont supports.
+    callback("vCont;c;C;s;S;r");
+    return true;
+  }
   if (StartsWith(packet, kKill))
     return Handle_vKill(packet.substr(std::strlen(kKill)), callback);
   if (StartsWith(packet, kRun))
@@ -730,12 +1127,138 @@ bool CommandHandler::Handle_v(const ftl::StringView& packet,
   return false;
 }
 
+bool CommandHandler::Handle_x(const ftl::StringView& packet,
+                              const ResponseCallback& callback) {
+  // If there is no current process or if the current process isn't attached,
+  // then report an error, unless the client is looking at a trace frame.
+  Process* current_process = server_->current_process();
+  const util::TraceFrame* trace_frame = GetSelectedTraceFrame();
+  if (!trace_frame &&
+      (!current_process || !current_process->IsAttached())) {
+    FTL_LOG(ERROR) << "x: No inferior";
+    return ReplyWithError(util::ErrorCode::NOENT, callback);
+  }
+
+  // The "x" packet has the same arguments as "m": addr,length.
+  auto params = ftl::SplitString(packet, ",", ftl::kKeepWhitespace,
+                                 ftl::kSplitWantNonEmpty);
+  if (params.size() != 2) {
+    FTL_LOG(ERROR) << "x: Malformed packet: " << packet;
+    return ReplyWithError(util::ErrorCode::INVAL, callback);
+  }
+
+  uintptr_t addr;
+  size_t length;
+  if (!ftl::StringToNumberWithError<uintptr_t>(params[0], &addr,
+                                               ftl::Base::k16) ||
+      !ftl::StringToNumberWithError<size_t>(params[1], &length,
+                                            ftl::Base::k16)) {
+    FTL_LOG(ERROR) << "x: Malformed params: " << packet;
+    return ReplyWithError(util::ErrorCode::INVAL, callback);
+  }
+
+  // LLDB probes for support of this packet with "x0,0" and expects "OK".
+  if (length == 0)
+    return ReplyOK(callback);
+
+  // If the reply wouldn't fit in one packet then send what does: the client
+  // will ask for the rest. Escaping can increase the size, this is handled
+  // below.
+  size_t max_size = server_->max_packet_size();
+  if (length > max_size - 1)
+    length = max_size - 1;
+
+  std::unique_ptr<uint8_t[]> buffer(new uint8_t[length]);
+  if (trace_frame) {
+    if (!ReadTraceFrameMemory(*trace_frame, addr, buffer.get(), length)) {
+      FTL_VLOG(1) << "x: Memory not collected in trace frame";
+      return ReplyWithError(util::ErrorCode::PERM, callback);
+    }
+  } else {
+    if (!current_process->ReadMemory(addr, buffer.get(), length)) {
+      FTL_LOG(ERROR) << "x: Failed to read memory";
+      return ReplyWithError(util::ErrorCode::PERM, callback);
+    }
+    current_process->breakpoints()->HideInternalBreakpoints(
+        addr, buffer.get(), length);
+  }
+
+  // The reply is the data prefixed with 'b'.
+  std::string result("b");
+  util::EscapeBinaryData(buffer.get(), length, &result);
+
+  TrimEscapedReply(max_size, &result);
+
+  callback(result);
+  return true;
+}
+
+bool CommandHandler::Handle_X(const ftl::StringView& packet,
+                              const ResponseCallback& callback) {
+  // If there is no current process or if the current process isn't attached,
+  // then report an error.
+  Process* current_process = server_->current_process();
+  if (!current_process || !current_process->IsAttached()) {
+    FTL_LOG(ERROR) << "X: No inferior";
+    return ReplyWithError(util::ErrorCode::NOENT, callback);
+  }
+
+  // The "X" packet parameters look like this: "addr,length:XX...", where the
+  // data is binary and thus may itself contain ':' and ',' characters.
+  size_t colon = packet.find(':');
+  if (colon == ftl::StringView::npos) {
+    FTL_LOG(ERROR) << "X: Malformed packet: " << packet;
+    return ReplyWithError(util::ErrorCode::INVAL, callback);
+  }
+
+  auto params = ftl::SplitString(packet.substr(0, colon), ",",
+                                 ftl::kKeepWhitespace, ftl::kSplitWantNonEmpty);
+  if (params.size() != 2) {
+    FTL_LOG(ERROR) << "X: Malformed packet: " << packet;
+    return ReplyWithError(util::ErrorCode::INVAL, callback);
+  }
+
+  uintptr_t addr;
+  size_t length;
+  if (!ftl::StringToNumberWithError<uintptr_t>(params[0], &addr,
+                                               ftl::Base::k16) ||
+      !ftl::StringToNumberWithError<size_t>(params[1], &length,
+                                            ftl::Base::k16)) {
+    FTL_LOG(ERROR) << "X: Malformed params: " << packet;
+    return ReplyWithError(util::ErrorCode::INVAL, callback);
+  }
+
+  FTL_VLOG(1) << ftl::StringPrintf("X: addr=0x%" PRIxPTR ", len=%lu", addr,
+                                   length);
+
+  std::vector<uint8_t> data_bytes;
+  if (!util::UnescapeBinaryData(packet.substr(colon + 1), &data_bytes)) {
+    FTL_LOG(ERROR) << "X: Malformed payload";
+    return ReplyWithError(util::ErrorCode::INVAL, callback);
+  }
+  if (data_bytes.size() != length) {
+    FTL_LOG(ERROR) << "X: payload length doesn't match length argument - "
+                   << "payload size: " << data_bytes.size()
+                   << ", length requested: " << length;
+    return ReplyWithError(util::ErrorCode::INVAL, callback);
+  }
+
+  // GDB probes for support of this packet with a zero length write.
+  if (length &&
+      !current_process->WriteMemory(addr, data_bytes.data(), length)) {
+    FTL_LOG(ERROR) << "X: Failed to write memory";
+    return ReplyWithError(util::ErrorCode::PERM, callback);
+  }
+
+  return ReplyOK(callback);
+}
+
 bool CommandHandler::Handle_zZ(bool insert,
                                const ftl::StringView& packet,
                                const ResponseCallback& callback) {
-// Z0 needs more work. Disabled until ready.
-// One issue is we need to support the swbreak feature.
-#if 0
+  // We don't support the swbreak feature: on architectures where a breakpoint
+  // leaves the pc past the breakpoint instruction the debugger backs it up.
+
   // A Z packet contains the "type,addr,kind" parameters before all other
   // optional parameters, which follow an optional ';' character. Check to see
   // if there are any optional parameters:
@@ -779,13 +1302,24 @@ bool CommandHandler::Handle_zZ(bool insert,
       if (insert)
         return InsertSoftwareBreakpoint(addr, kind, optional_params, callback);
       return RemoveSoftwareBreakpoint(addr, kind, callback);
+    case 2:
+      // Write watchpoints have no optional parameters we support.
+      if (!optional_params.empty()) {
+        FTL_LOG(ERROR) << "zZ: Conditions are only supported for type 0";
+        return ReplyWithError(util::ErrorCode::INVAL, callback);
+      }
+      if (insert)
+        return InsertWatchpoint(addr, kind, callback);
+      return RemoveWatchpoint(addr, kind, callback);
     default:
       break;
   }
 
+  // There are no debug registers to use for hardware breakpoints or for read
+  // and access watchpoints. The empty reply makes the client fall back to
+  // software breakpoints, respectively single-stepping.
   FTL_LOG(WARNING) << "Breakpoints of type " << type
                    << " currently not supported";
-#endif
   return false;
 }
 
@@ -866,7 +1400,22 @@ bool CommandHandler::HandleQueryRcmd(const ftl::StringView& command,
       "show <parameter>\n"
       "\n"
       "Parameters:\n"
-      "  verbosity - useful range is -2 to 3 (-2 is most verbose)\n";
+      "  verbosity - useful range is -2 to 3 (-2 is most verbose)\n"
+      "  rle - run-length encode outgoing packets: 0 or 1 (default 1)\n"
+      "  memcache - cache inferior memory while all threads are stopped: 0 or 1\n"
+      "    (default 1)\n"
+      "  memcache-stats - memory cache counters (show only)\n"
+      "  library-events - stop when dsos are loaded or unloaded: 0 or 1\n"
+      "    (default 0)\n"
+      "  expedite-registers - registers sent with stop replies: N,N,...\n"
+      "    or \"default\" (FP, SP and PC)\n"
+      "  expedite-stack - bytes of stack sent with stop replies, up to 1024\n"
+      "    (default 0)\n"
+      "  expedite-frames - frame pointer chain entries sent with stop\n"
+      "    replies, up to 32 (default 0)\n"
+      "\n"
+      "In non-stop mode the output of agent dprintfs is held until the next\n"
+      "monitor command.\n";
     callback(util::EncodeString(kHelpText));
   } else if (cmd == kSet) {
     if (argv.size() != 3)
@@ -899,7 +1448,23 @@ bool CommandHandler::HandleQuerySupported(const ftl::StringView& params,
                                           const ResponseCallback& callback) {
   // We ignore the parameters for qSupported. Respond with the supported
   // features.
-  callback(kSupportedFeatures);
+  std::string features = ftl::StringPrintf(
+      "PacketSize=%zx;%s", server_->max_packet_size(), kSupportedFeatures);
+  if (!arch::GetTargetDescription().empty())
+    features += ";qXfer:features:read+";
+  callback(features);
+  return true;
+}
+
+bool CommandHandler::HandleStartNoAckMode(const ftl::StringView& params,
+                                          const ResponseCallback& callback) {
+  if (!params.empty())
+    return ReplyWithError(util::ErrorCode::INVAL, callback);
+
+  // The switch happens after our reply: the remote end still acknowledges
+  // the "OK" (any such ack is ignored by the packet parser).
+  ReplyOK(callback);
+  server_->EnterNoAckMode();
   return true;
 }
 
@@ -911,8 +1476,10 @@ bool CommandHandler::HandleSetNonStop(const ftl::StringView& params,
 
   // We currently only support non-stop mode.
   char value = params[0];
-  if (value == '1')
+  if (value == '1') {
+    server_->set_non_stop(true);
     return ReplyOK(callback);
+  }
 
   if (value == '0')
     return ReplyWithError(util::ErrorCode::PERM, callback);
@@ -931,88 +1498,106 @@ bool CommandHandler::HandleQueryThreadInfo(bool is_first,
     return ReplyWithError(util::ErrorCode::PERM, callback);
   }
 
-  // For the "first" thread info query we reply with the complete list of
-  // threads and always report "end of list" for subsequent queries. The GDB
-  // Remote Protocol does not seem to define a MTU, however, we could be running
-  // on a platform with resource constraints that may require us to break up the
-  // sequence into multiple packets. For now we do not worry about this.
+  // For the "first" thread info query we take a snapshot of the list of
+  // threads, and then reply with as many as fit in one packet. Subsequent
+  // queries continue from where the previous one left off, until we report
+  // "end of list".
+
+  if (is_first) {
+    // This is the first query. Check the sequence state for sanity.
+    if (in_thread_info_sequence_) {
+      FTL_LOG(ERROR) << "qfThreadInfo received while already in an active "
+                     << "sequence";
+      return ReplyWithError(util::ErrorCode::PERM, callback);
+    }
+
+    current_process->EnsureThreadMapFresh();
 
-  if (!is_first) {
+    thread_info_ids_.clear();
+    thread_info_index_ = 0;
+    current_process->ForEachLiveThread([this](Thread* thread) {
+      thread_info_ids_.push_back(thread->id());
+    });
+    in_thread_info_sequence_ = true;
+  } else {
     // This is a subsequent query. Check that a thread info query sequence was
-    // started (just for sanity) and report end of list.
+    // started (just for sanity).
     if (!in_thread_info_sequence_) {
       FTL_LOG(ERROR) << "qsThreadInfo received without first receiving "
                      << "qfThreadInfo";
       return ReplyWithError(util::ErrorCode::PERM, callback);
     }
+  }
 
+  if (thread_info_index_ == thread_info_ids_.size()) {
+    // No more ids to report. End of sequence.
     in_thread_info_sequence_ = false;
+    thread_info_ids_.clear();
     callback("l");
     return true;
   }
 
-  // This is the first query. Check the sequence state for sanity.
-  if (in_thread_info_sequence_) {
-    FTL_LOG(ERROR) << "qfThreadInfo received while already in an active "
-                   << "sequence";
-    return ReplyWithError(util::ErrorCode::PERM, callback);
-  }
-
-  current_process->EnsureThreadMapFresh();
-
-  std::deque<std::string> thread_ids;
-  size_t buf_size = 0;
-  current_process->ForEachLiveThread([&thread_ids, &buf_size](Thread* thread) {
-    std::string thread_id =
-        ftl::NumberToString<mx_koid_t>(thread->id(), ftl::Base::k16);
-    buf_size += thread_id.length();
-    thread_ids.push_back(thread_id);
-  });
-
-  if (thread_ids.empty()) {
-    // No ids to report. End of sequence.
-    callback("l");
-    return true;
+  // Always report at least one id, regardless of size.
+  size_t max_size = server_->max_packet_size();
+  std::string reply("m");
+  while (thread_info_index_ < thread_info_ids_.size()) {
+    std::string thread_id = ftl::NumberToString<mx_koid_t>(
+        thread_info_ids_[thread_info_index_], ftl::Base::k16);
+    bool first_in_reply = reply.size() == 1;
+    if (!first_in_reply && reply.size() + 1 + thread_id.size() > max_size)
+      break;
+    if (!first_in_reply)
+      reply.push_back(',');
+    reply.append(thread_id);
+    ++thread_info_index_;
   }
 
-  in_thread_info_sequence_ = true;
-
-  // Add the number of commas (|thread_ids.size() - 1|) plus the prefix "m")
-  buf_size += thread_ids.size();
-
-  std::unique_ptr<char[]> buffer(new char[buf_size]);
-  buffer.get()[0] = 'm';
-  util::JoinStrings(thread_ids, ',', buffer.get() + 1, buf_size - 1);
-
-  callback(ftl::StringView(buffer.get(), buf_size));
-
+  callback(reply);
   return true;
 }
 
 bool CommandHandler::HandleQueryXfer(const ftl::StringView& params,
                                      const ResponseCallback& callback) {
-  // We only support qXfer:auxv:read::
+  // We support qXfer:auxv:read::, qXfer:features:read:ANNEX,
+  // qXfer:libraries-svr4:read:: and qXfer:threads:read::.
   // TODO(dje): TO-195
   // - qXfer::osdata::read::OFFSET,LENGTH
   // - qXfer:memory-map:read::OFFSET,LENGTH ?
-  // - qXfer:libraries-svr4:read:ANNEX:OFFSET,LENGTH ?
-  // - qXfer:features:read:ANNEX:OFFSET,LENGTH ?
-  ftl::StringView auxv_read("auxv:read::");
-  if (!StartsWith(params, auxv_read))
+
+  // The params are of the form: OBJECT:read:ANNEX:OFFSET,LENGTH
+  auto parts = ftl::SplitString(params, ":", ftl::kKeepWhitespace,
+                                ftl::kSplitWantAll);
+  if (parts.size() != 4 || parts[1] != "read")
     return false;
 
-  // Parse offset,length
-  auto args = ftl::SplitString(params.substr(auxv_read.size()), ",",
-                               ftl::kKeepWhitespace, ftl::kSplitWantNonEmpty);
-  if (args.size() != 2) {
-    FTL_LOG(ERROR) << "qXfer:auxv:read:: Malformed params: " << params;
+  auto args = ftl::SplitString(parts[3], ",", ftl::kKeepWhitespace,
+                               ftl::kSplitWantNonEmpty);
+  size_t offset, length;
+  if (args.size() != 2 ||
+      !ftl::StringToNumberWithError<size_t>(args[0], &offset, ftl::Base::k16) ||
+      !ftl::StringToNumberWithError<size_t>(args[1], &length, ftl::Base::k16)) {
+    FTL_LOG(ERROR) << "qXfer: Malformed params: " << params;
     return ReplyWithError(util::ErrorCode::INVAL, callback);
   }
 
-  size_t offset, length;
-  if (!ftl::StringToNumberWithError<size_t>(args[0], &offset, ftl::Base::k16) ||
-      !ftl::StringToNumberWithError<size_t>(args[1], &length, ftl::Base::k16)) {
-    FTL_LOG(ERROR) << "qXfer:auxv:read:: Malformed params: " << params;
+  if (parts[0] == "auxv")
+    return HandleQueryXferAuxv(parts[2], offset, length, callback);
+  if (parts[0] == "features")
+    return HandleQueryXferFeatures(parts[2], offset, length, callback);
+  if (parts[0] == "libraries-svr4")
+    return HandleQueryXferLibrariesSvr4(parts[2], offset, length, callback);
+  if (parts[0] == "threads")
+    return HandleQueryXferThreads(parts[2], offset, length, callback);
+
+  return false;
+}
+
+bool CommandHandler::HandleQueryXferAuxv(const ftl::StringView& annex,
+                                         size_t offset,
+                                         size_t length,
+                                         const ResponseCallback& callback) {
+  if (!annex.empty()) {
+    FTL_LOG(ERROR) << "qXfer:auxv:read: Invalid annex: " << annex;
     return ReplyWithError(util::ErrorCode::INVAL, callback);
   }
 
@@ -1048,7 +1633,7 @@ bool CommandHandler::HandleQueryXfer(const ftl::StringView& params,
   size_t n = 0;
   ADD_AUXV(AT_BASE, current_process->base_address());
   if (current_process->DsosLoaded()) {
-    const util::dsoinfo_t* exec = current_process->GetExecDso();
+    const util::DsoInfo* exec = current_process->GetExecDso();
     if (exec) {
       ADD_AUXV(AT_ENTRY, exec->entry);
       ADD_AUXV(AT_PHDR, exec->phdr);
@@ -1061,21 +1646,160 @@ bool CommandHandler::HandleQueryXfer(const ftl::StringView& params,
 
 #undef ADD_AUXV
 
-  // We allow setting sizeof(auxv) as the offset, which would effectively result
-  // in reading 0 bytes.
-  if (offset > sizeof(auxv)) {
-    FTL_LOG(ERROR) << "qXfer:auxv:read: invalid offset";
+  return ReplyWithXferData(
+      ftl::StringView(reinterpret_cast<const char*>(auxv),
+                      n * sizeof(auxv[0])),
+      offset, length, server_->max_packet_size(), callback);
+}
+
+bool CommandHandler::HandleQueryXferFeatures(const ftl::StringView& annex,
+                                             size_t offset,
+                                             size_t length,
+                                             const ResponseCallback& callback) {
+  const std::string& target_description = arch::GetTargetDescription();
+  if (annex != "target.xml" || target_description.empty()) {
+    FTL_LOG(ERROR) << "qXfer:features:read: Invalid annex: " << annex;
+    return ReplyWithError(util::ErrorCode::INVAL, callback);
+  }
+
+  return ReplyWithXferData(target_description, offset, length,
+                           server_->max_packet_size(), callback);
+}
+
+bool CommandHandler::HandleQueryXferLibrariesSvr4(
+    const ftl::StringView& annex,
+    size_t offset,
+    size_t length,
+    const ResponseCallback& callback) {
+  if (!annex.empty()) {
+    FTL_LOG(ERROR) << "qXfer:libraries-svr4:read: Invalid annex: " << annex;
+    return ReplyWithError(util::ErrorCode::INVAL, callback);
+  }
+
+  Process* current_process = server_->current_process();
+  if (!current_process) {
+    FTL_LOG(ERROR) << "qXfer:libraries-svr4:read: No current process";
+    return ReplyWithError(util::ErrorCode::PERM, callback);
+  }
+
+  // This is the list the client would otherwise build itself by walking the
+  // dynamic linker's link_map chain, so it's in the same order and has the
+  // same names. The main executable is identified by main-lm rather than
+  // listed. If the list isn't available yet then the reply is an empty list.
+  const util::DsoList* dsos = current_process->GetDsos();
+  const util::DsoInfo* exec = current_process->GetExecDso();
+  std::string xml("<library-list-svr4 version=\"1.0\"");
+  if (exec)
+    xml += ftl::StringPrintf(" main-lm=\"0x%" PRIxPTR "\"", exec->lmap);
+  xml += ">";
+  if (dsos) {
+    for (const util::DsoInfo* dso : dsos->GetLinkMapOrder()) {
+      if (dso->is_main_exec)
+        continue;
+      xml += "<library name=\"";
+      util::EscapeXmlAttribute(dso->lmap_name, &xml);
+      xml += ftl::StringPrintf("\" lm=\"0x%" PRIxPTR "\" l_addr=\"0x%" PRIxPTR
+                               "\" l_ld=\"0x%" PRIxPTR "\"/>",
+                               dso->lmap, dso->base, dso->dynamic);
+    }
+  }
+  xml += "</library-list-svr4>";
+
+  return ReplyWithXferData(xml, offset, length, server_->max_packet_size(),
+                           callback);
+}
+
+bool CommandHandler::HandleQueryXferThreads(const ftl::StringView& annex,
+                                            size_t offset,
+                                            size_t length,
+                                            const ResponseCallback& callback) {
+  if (!annex.empty()) {
+    FTL_LOG(ERROR) << "qXfer:threads:read: Invalid annex: " << annex;
     return ReplyWithError(util::ErrorCode::INVAL, callback);
   }
 
-  size_t end = n * sizeof(auxv[0]);
-  size_t rsp_len = std::min(end - offset, length);
-  char rsp[1 + rsp_len];
+  Process* current_process = server_->current_process();
+  if (!current_process) {
+    FTL_LOG(ERROR) << "qXfer:threads:read: No current process";
+    return ReplyWithError(util::ErrorCode::PERM, callback);
+  }
+
+  // Take a snapshot of the list when the client starts reading it, so that
+  // all the pieces are consistent.
+  if (offset == 0) {
+    current_process->EnsureThreadMapFresh();
+    xfer_threads_xml_ = "<threads>";
+    current_process->ForEachLiveThread([this, current_process](Thread* thread) {
+      xfer_threads_xml_ += "<thread id=\"";
+      xfer_threads_xml_ +=
+          util::EncodeThreadId(current_process->id(), thread->id());
+      xfer_threads_xml_ += "\"/>";
+    });
+    xfer_threads_xml_ += "</threads>";
+  }
+
+  return ReplyWithXferData(xfer_threads_xml_, offset, length,
+                           server_->max_packet_size(), callback);
+}
+
+bool CommandHandler::Handle_jThreadsInfo(const ResponseCallback& callback) {
+  Process* current_process = server_->current_process();
+  if (!current_process || !current_process->IsAttached()) {
+    FTL_LOG(ERROR) << "jThreadsInfo: No inferior";
+    return ReplyWithError(util::ErrorCode::PERM, callback);
+  }
+
+  // Describe every live thread in one reply: what the client would otherwise
+  // get with an Hg and a g for each thread. Registers are only available for
+  // stopped threads.
+  const std::vector<int>& regnos = server_->expedited_registers();
+  std::string json("[");
+  current_process->EnsureThreadMapFresh();
+  current_process->ForEachLiveThread([&](Thread* thread) {
+    if (json.size() > 1)
+      json.push_back(',');
+    json += ftl::StringPrintf("{\"tid\":%" PRIu64, thread->id());
+    const char* state = GetJsonThreadState(thread->state());
+    if (state)
+      json += ftl::StringPrintf(",\"state\":\"%s\"", state);
+
+    if (thread->state() == Thread::State::kStopped) {
+      const mx_exception_context_t* context = thread->exception_context();
+      arch::GdbSignal signal = thread->GetGdbSignal();
+      if (context && signal != arch::GdbSignal::kUnsupported) {
+        const char* reason;
+        if (signal != arch::GdbSignal::kTrap)
+          reason = "exception";
+        else if (arch::IsSingleStepException(*context))
+          reason = "trace";
+        else
+          reason = "breakpoint";
+        json += ftl::StringPrintf(",\"reason\":\"%s\",\"signal\":%d",
+                                  reason, static_cast<int>(signal));
+      }
+
+      if (thread->registers()->RefreshGeneralRegisters()) {
+        json += ",\"registers\":{";
+        for (size_t i = 0; i < regnos.size(); ++i) {
+          if (i > 0)
+            json.push_back(',');
+          json += ftl::StringPrintf(
+              "\"%d\":\"%s\"", regnos[i],
+              thread->registers()->GetRegisterAsString(regnos[i]).c_str());
+        }
+        json += "}";
+      }
+    }
 
-  rsp[0] = 'l';
-  memcpy(rsp + 1, auxv + offset, rsp_len);
+    json += "}";
+  });
+  json += "]";
 
-  callback(ftl::StringView(rsp, sizeof(rsp)));
+  // JSON is full of '}', which is the escape character.
+  std::string reply;
+  util::EscapeBinaryData(reinterpret_cast<const uint8_t*>(json.data()),
+                         json.size(), &reply);
+  callback(reply);
   return true;
 }
 
@@ -1168,9 +1892,10 @@ bool CommandHandler::Handle_vCont(const ftl::StringView& packet,
         ThreadActionList::Action action = actions.GetAction(pid, tid);
         switch (action) {
           case ThreadActionList::Action::kStep:
+          case ThreadActionList::Action::kRangeStep:
             switch (thread->state()) {
               case Thread::State::kNew:
-                FTL_LOG(ERROR) << "vCont;s: can't step thread in kNew state";
+                FTL_LOG(ERROR) << "vCont: can't step thread in kNew state";
                 *ok_ptr = false;
                 return;
               default:
@@ -1179,6 +1904,25 @@ bool CommandHandler::Handle_vCont(const ftl::StringView& packet,
           default:
             break;
         }
+
+        // As with "C", a signal can only be the one the thread stopped with.
+        int signo = actions.GetSignal(pid, tid);
+        if (signo < 0)
+          return;
+        arch::GdbSignal thread_signo = thread->GetGdbSignal();
+        if (thread_signo == arch::GdbSignal::kUnsupported) {
+          FTL_LOG(ERROR) << "vCont: Thread " << thread->GetDebugName()
+                         << " has received no signal";
+          *ok_ptr = false;
+          return;
+        }
+        if (static_cast<int>(thread_signo) != signo) {
+          FTL_LOG(ERROR) << "vCont: Signal numbers don't match for thread "
+                         << thread->GetDebugName() << " - actual: "
+                         << static_cast<int>(thread_signo)
+                         << ", received: " << signo;
+          *ok_ptr = false;
+        }
       });
   if (!action_list_ok)
     return ReplyWithError(util::ErrorCode::INVAL, callback);
@@ -1200,6 +1944,7 @@ bool CommandHandler::Handle_vCont(const ftl::StringView& packet,
           default:
             break;
         }
+        break;
       case ThreadActionList::Action::kStep:
         switch (thread->state()) {
           case Thread::State::kStopped:
@@ -1208,6 +1953,16 @@ bool CommandHandler::Handle_vCont(const ftl::StringView& packet,
           default:
             break;
         }
+        break;
+      case ThreadActionList::Action::kRangeStep:
+        // The thread is stepped here until it leaves the range, saving the
+        // client a round trip per instruction.
+        if (thread->state() == Thread::State::kStopped) {
+          uint64_t start, end;
+          actions.GetStepRange(pid, tid, &start, &end);
+          thread->RangeStep(start, end);
+        }
+        break;
       default:
         break;
     }
@@ -1329,9 +2084,47 @@ bool CommandHandler::InsertSoftwareBreakpoint(
     return ReplyWithError(util::ErrorCode::PERM, callback);
   }
 
-  // TODO(armansito): Handle |optional_params|.
+  // The options are conditions, "X len,expr" each, followed by commands:
+  // "cmds:persist,X len,expr...". gdb sends the expressions of each list
+  // back to back: ";Xlen,exprXlen,expr;cmds:0,Xlen,expr".
+  // We don't outlive the connection so "persist" is moot.
+  arch::ProcessBreakpointSet::ExpressionList conditions;
+  arch::ProcessBreakpointSet::ExpressionList commands;
+  arch::ProcessBreakpointSet::ExpressionList* list = &conditions;
+  ftl::StringView options = optional_params;
+  while (!options.empty()) {
+    if (options[0] == ';') {
+      options.remove_prefix(1);
+      list = &conditions;
+      continue;
+    }
+    if (StartsWith(options, kCommands)) {
+      // Skip the persist flag.
+      size_t comma = options.find(',');
+      if (comma == ftl::StringView::npos) {
+        FTL_LOG(ERROR) << "Malformed breakpoint commands: " << options;
+        return ReplyWithError(util::ErrorCode::INVAL, callback);
+      }
+      options.remove_prefix(comma + 1);
+      list = &commands;
+      continue;
+    }
+    if (options[0] != 'X') {
+      FTL_LOG(ERROR) << "Unsupported breakpoint option: " << options;
+      return ReplyWithError(util::ErrorCode::INVAL, callback);
+    }
+    options.remove_prefix(1);
+    size_t size;
+    std::unique_ptr<util::AgentExpression> expression =
+        util::AgentExpression::Decode(options, &size);
+    if (!expression)
+      return ReplyWithError(util::ErrorCode::INVAL, callback);
+    list->push_back(std::move(expression));
+    options.remove_prefix(size);
+  }
 
-  if (!current_process->breakpoints()->InsertSoftwareBreakpoint(addr, kind)) {
+  if (!current_process->breakpoints()->InsertSoftwareBreakpoint(
+          addr, kind, std::move(conditions), std::move(commands))) {
     FTL_LOG(ERROR) << "Failed to insert software breakpoint";
     return ReplyWithError(util::ErrorCode::PERM, callback);
   }
@@ -1360,4 +2153,411 @@ bool CommandHandler::RemoveSoftwareBreakpoint(
   return ReplyOK(callback);
 }
 
+bool CommandHandler::InsertWatchpoint(uintptr_t addr,
+                                      size_t kind,
+                                      const ResponseCallback& callback) {
+  FTL_VLOG(1) << ftl::StringPrintf(
+      "Insert watchpoint at %" PRIxPTR ", kind: %zu", addr, kind);
+
+  Process* current_process = server_->current_process();
+  if (!current_process) {
+    FTL_LOG(ERROR) << "No current process exists";
+    return ReplyWithError(util::ErrorCode::PERM, callback);
+  }
+
+  if (!current_process->page_watchpoints()->Insert(addr, kind)) {
+    FTL_LOG(ERROR) << "Failed to insert watchpoint";
+    return ReplyWithError(util::ErrorCode::PERM, callback);
+  }
+
+  return ReplyOK(callback);
+}
+
+bool CommandHandler::RemoveWatchpoint(uintptr_t addr,
+                                      size_t kind,
+                                      const ResponseCallback& callback) {
+  FTL_VLOG(1) << ftl::StringPrintf("Remove watchpoint at %" PRIxPTR, addr);
+
+  Process* current_process = server_->current_process();
+  if (!current_process) {
+    FTL_LOG(ERROR) << "No current process exists";
+    return ReplyWithError(util::ErrorCode::PERM, callback);
+  }
+
+  if (!current_process->page_watchpoints()->Remove(addr, kind)) {
+    FTL_LOG(ERROR) << "Failed to remove watchpoint";
+    return ReplyWithError(util::ErrorCode::PERM, callback);
+  }
+
+  return ReplyOK(callback);
+}
+
+const util::TraceFrame* CommandHandler::GetSelectedTraceFrame() const {
+  if (trace_frame_ < 0)
+    return nullptr;
+  Process* current_process = server_->current_process();
+  if (!current_process)
+    return nullptr;
+  const util::TraceBuffer& buffer =
+      *current_process->tracepoints()->buffer();
+  if (static_cast<size_t>(trace_frame_) >= buffer.num_frames())
+    return nullptr;
+  return &buffer.frame(trace_frame_);
+}
+
+bool CommandHandler::ReadTraceFrameMemory(const util::TraceFrame& frame,
+                                          uintptr_t addr,
+                                          void* out_buffer,
+                                          size_t length) {
+  if (frame.ReadMemory(addr, out_buffer, length))
+    return true;
+
+  // Read-only memory is the same now as when the frame was collected.
+  Process* current_process = server_->current_process();
+  if (!current_process || !current_process->IsAttached())
+    return false;
+  for (const auto& region : trace_readonly_regions_) {
+    if (addr >= region.first && addr < region.second &&
+        length <= region.second - addr) {
+      if (!current_process->ReadMemory(addr, out_buffer, length))
+        return false;
+      current_process->breakpoints()->HideInternalBreakpoints(addr, out_buffer,
+                                                              length);
+      return true;
+    }
+  }
+  return false;
+}
+
+bool CommandHandler::HandleQueryTraceStatus(const ResponseCallback& callback) {
+  Process* current_process = server_->current_process();
+  if (!current_process) {
+    callback("T0;tnotrun:0");
+    return true;
+  }
+
+  TracepointSet* tracepoints = current_process->tracepoints();
+  std::string reply;
+  if (tracepoints->running()) {
+    reply = "T1";
+  } else {
+    reply = "T0;";
+    switch (tracepoints->stop_reason()) {
+      case TracepointSet::StopReason::kNotRun:
+        reply += "tnotrun:0";
+        break;
+      case TracepointSet::StopReason::kStopped:
+        reply += "tstop:0";
+        break;
+      case TracepointSet::StopReason::kBufferFull:
+        reply += "tfull:0";
+        break;
+      case TracepointSet::StopReason::kPassCount:
+        reply += ftl::StringPrintf("tpasscount:%x",
+                                   tracepoints->stop_tracepoint());
+        break;
+      case TracepointSet::StopReason::kProcessExited:
+        reply += "terror:" + util::EncodeString("process exited") + ":0";
+        break;
+    }
+  }
+
+  const util::TraceBuffer& buffer = *tracepoints->buffer();
+  reply += ftl::StringPrintf(
+      ";tframes:%zx;tcreated:%" PRIx64 ";tfree:%zx;tsize:%zx;circular:%d"
+      ";disconn:0",
+      buffer.num_frames(), buffer.frames_created(),
+      buffer.size() - buffer.bytes_used(), buffer.size(),
+      buffer.circular() ? 1 : 0);
+  callback(reply);
+  return true;
+}
+
+bool CommandHandler::HandleQueryTracepointStatus(
+    const ftl::StringView& params,
+    const ResponseCallback& callback) {
+  Process* current_process = server_->current_process();
+  if (!current_process) {
+    FTL_LOG(ERROR) << "qTP: No current process exists";
+    return ReplyWithError(util::ErrorCode::NOENT, callback);
+  }
+
+  // qTP:number:addr
+  auto fields = ftl::SplitString(params, ":", ftl::kKeepWhitespace,
+                                 ftl::kSplitWantNonEmpty);
+  uint32_t number;
+  uintptr_t addr;
+  if (fields.size() != 2 ||
+      !ftl::StringToNumberWithError<uint32_t>(fields[0], &number,
+                                              ftl::Base::k16) ||
+      !ftl::StringToNumberWithError<uintptr_t>(fields[1], &addr,
+                                               ftl::Base::k16)) {
+    FTL_LOG(ERROR) << "qTP: Malformed packet: " << params;
+    return ReplyWithError(util::ErrorCode::INVAL, callback);
+  }
+
+  TracepointSet* tracepoints = current_process->tracepoints();
+  const TracepointSet::Tracepoint* tracepoint =
+      tracepoints->Find(number, addr);
+  if (!tracepoint) {
+    FTL_LOG(ERROR) << "qTP: No such tracepoint: " << params;
+    return ReplyWithError(util::ErrorCode::NOENT, callback);
+  }
+
+  // The reply is the number of hits and the bytes their frames take up.
+  const util::TraceBuffer& buffer = *tracepoints->buffer();
+  size_t usage = 0;
+  for (size_t i = 0; i < buffer.num_frames(); ++i) {
+    const util::TraceFrame& frame = buffer.frame(i);
+    if (frame.tracepoint == number && frame.address == addr)
+      usage += frame.Size();
+  }
+  callback(
+      ftl::StringPrintf("V%" PRIx64 ":%zx", tracepoint->hit_count, usage));
+  return true;
+}
+
+bool CommandHandler::HandleSetTraceBuffer(const ftl::StringView& params,
+                                          const ResponseCallback& callback) {
+  Process* current_process = server_->current_process();
+  if (!current_process) {
+    FTL_LOG(ERROR) << "QTBuffer: No current process exists";
+    return ReplyWithError(util::ErrorCode::NOENT, callback);
+  }
+  util::TraceBuffer* buffer = current_process->tracepoints()->buffer();
+
+  // QTBuffer:circular:0|1 and QTBuffer:size:N, where -1 is the default.
+  ftl::StringView prefix, value;
+  util::ExtractParameters(params, &prefix, &value);
+  if (prefix == "circular" && (value == "0" || value == "1")) {
+    buffer->set_circular(value == "1");
+    return ReplyOK(callback);
+  }
+  if (prefix == "size") {
+    if (value == "-1") {
+      buffer->set_size(util::TraceBuffer::kDefaultSize);
+      return ReplyOK(callback);
+    }
+    size_t size;
+    if (ftl::StringToNumberWithError<size_t>(value, &size, ftl::Base::k16)) {
+      buffer->set_size(size);
+      return ReplyOK(callback);
+    }
+  }
+
+  FTL_LOG(ERROR) << "QTBuffer: Malformed packet: " << params;
+  return ReplyWithError(util::ErrorCode::INVAL, callback);
+}
+
+bool CommandHandler::HandleSetTraceFrame(const ftl::StringView& params,
+                                         const ResponseCallback& callback) {
+  Process* current_process = server_->current_process();
+  if (!current_process) {
+    FTL_LOG(ERROR) << "QTFrame: No current process exists";
+    return ReplyWithError(util::ErrorCode::NOENT, callback);
+  }
+  const util::TraceBuffer& buffer =
+      *current_process->tracepoints()->buffer();
+
+  auto fields = ftl::SplitString(params, ":", ftl::kKeepWhitespace,
+                                 ftl::kSplitWantNonEmpty);
+  int found = -1;
+  if (fields.size() == 1) {
+    // QTFrame:n selects frame n; -1 goes back to the live process.
+    uint32_t number;
+    if (fields[0] == "-1") {
+      number = UINT32_MAX;
+    } else if (!ftl::StringToNumberWithError<uint32_t>(fields[0], &number,
+                                                       ftl::Base::k16)) {
+      FTL_LOG(ERROR) << "QTFrame: Malformed packet: " << params;
+      return ReplyWithError(util::ErrorCode::INVAL, callback);
+    }
+    if (number == UINT32_MAX) {
+      trace_frame_ = -1;
+      return ReplyOK(callback);
+    }
+    if (number < buffer.num_frames())
+      found = static_cast<int>(number);
+  } else {
+    // The rest select the first frame after the selected one that was
+    // collected by a given tracepoint ("tdp:t"), or at an address ("pc:addr")
+    // or in or outside a range ("range:start:end", "outside:start:end").
+    bool by_tracepoint = fields[0] == "tdp";
+    bool inside = fields[0] != "outside";
+    size_t num_values = (fields[0] == "pc" || by_tracepoint) ? 1 : 2;
+    if ((!by_tracepoint && fields[0] != "pc" && fields[0] != "range" &&
+         inside) ||
+        fields.size() != num_values + 1) {
+      FTL_LOG(ERROR) << "QTFrame: Malformed packet: " << params;
+      return ReplyWithError(util::ErrorCode::INVAL, callback);
+    }
+    uint64_t low, high;
+    if (!ftl::StringToNumberWithError<uint64_t>(fields[1], &low,
+                                                ftl::Base::k16) ||
+        !ftl::StringToNumberWithError<uint64_t>(fields[num_values], &high,
+                                                ftl::Base::k16)) {
+      FTL_LOG(ERROR) << "QTFrame: Malformed packet: " << params;
+      return ReplyWithError(util::ErrorCode::INVAL, callback);
+    }
+
+    for (size_t i = trace_frame_ + 1; i < buffer.num_frames(); ++i) {
+      const util::TraceFrame& frame = buffer.frame(i);
+      bool matches = by_tracepoint
+                         ? frame.tracepoint == low
+                         : (frame.address >= low && frame.address <= high) ==
+                               inside;
+      if (matches) {
+        found = static_cast<int>(i);
+        break;
+      }
+    }
+  }
+
+  trace_frame_ = found;
+  if (found < 0) {
+    callback("F-1");
+    return true;
+  }
+  callback(ftl::StringPrintf("F%xT%x", found, buffer.frame(found).tracepoint));
+  return true;
+}
+
+bool CommandHandler::HandleSetTraceInit(const ResponseCallback& callback) {
+  trace_frame_ = -1;
+  trace_readonly_regions_.clear();
+
+  Process* current_process = server_->current_process();
+  if (current_process) {
+    TracepointSet* tracepoints = current_process->tracepoints();
+    tracepoints->Stop(TracepointSet::StopReason::kStopped);
+    tracepoints->Clear();
+  }
+  return ReplyOK(callback);
+}
+
+bool CommandHandler::HandleSetTraceReadOnly(const ftl::StringView& params,
+                                            const ResponseCallback& callback) {
+  // QTro:start,end:start,end...
+  trace_readonly_regions_.clear();
+  auto regions = ftl::SplitString(params, ":", ftl::kKeepWhitespace,
+                                  ftl::kSplitWantNonEmpty);
+  for (const auto& region : regions) {
+    auto bounds = ftl::SplitString(region, ",", ftl::kKeepWhitespace,
+                                   ftl::kSplitWantNonEmpty);
+    uintptr_t start, end;
+    if (bounds.size() != 2 ||
+        !ftl::StringToNumberWithError<uintptr_t>(bounds[0], &start,
+                                                 ftl::Base::k16) ||
+        !ftl::StringToNumberWithError<uintptr_t>(bounds[1], &end,
+                                                 ftl::Base::k16) ||
+        end < start) {
+      FTL_LOG(ERROR) << "QTro: Malformed packet: " << params;
+      trace_readonly_regions_.clear();
+      return ReplyWithError(util::ErrorCode::INVAL, callback);
+    }
+    trace_readonly_regions_.emplace_back(start, end);
+  }
+  return ReplyOK(callback);
+}
+
+bool CommandHandler::HandleSetTraceStart(const ResponseCallback& callback) {
+  Process* current_process = server_->current_process();
+  if (!current_process || !current_process->IsLive()) {
+    FTL_LOG(ERROR) << "QTStart: No live inferior";
+    return ReplyWithError(util::ErrorCode::NOENT, callback);
+  }
+
+  trace_frame_ = -1;
+  if (!current_process->tracepoints()->Start())
+    return ReplyWithError(util::ErrorCode::PERM, callback);
+  return ReplyOK(callback);
+}
+
+bool CommandHandler::HandleSetTraceStop(const ResponseCallback& callback) {
+  Process* current_process = server_->current_process();
+  if (current_process) {
+    current_process->tracepoints()->Stop(
+        TracepointSet::StopReason::kStopped);
+  }
+  return ReplyOK(callback);
+}
+
+bool CommandHandler::HandleSetTracepoint(const ftl::StringView& params,
+                                         const ResponseCallback& callback) {
+  Process* current_process = server_->current_process();
+  if (!current_process) {
+    FTL_LOG(ERROR) << "QTDP: No current process exists";
+    return ReplyWithError(util::ErrorCode::NOENT, callback);
+  }
+  TracepointSet* tracepoints = current_process->tracepoints();
+
+  // A trailing '-' says that more packets for the tracepoint follow, which
+  // doesn't matter to us.
+  ftl::StringView packet = params;
+  if (!packet.empty() && packet[packet.size() - 1] == '-')
+    packet = packet.substr(0, packet.size() - 1);
+
+  // Either "n:addr:E|D:step:pass" followed by optional fields, which defines
+  // tracepoint n at addr, or "-n:addr:actions", which adds to its actions.
+  bool is_actions = ConsumeChar(&packet, '-');
+  auto fields = ftl::SplitString(packet, ":", ftl::kKeepWhitespace,
+                                 ftl::kSplitWantAll);
+  uint32_t number;
+  uintptr_t addr;
+  if (fields.size() < 3 ||
+      !ftl::StringToNumberWithError<uint32_t>(fields[0], &number,
+                                              ftl::Base::k16) ||
+      !ftl::StringToNumberWithError<uintptr_t>(fields[1], &addr,
+                                               ftl::Base::k16)) {
+    FTL_LOG(ERROR) << "QTDP: Malformed packet: " << params;
+    return ReplyWithError(util::ErrorCode::INVAL, callback);
+  }
+
+  if (is_actions) {
+    TracepointSet::Tracepoint* tracepoint = tracepoints->Find(number, addr);
+    if (!tracepoint) {
+      FTL_LOG(ERROR) << "QTDP: No such tracepoint: " << params;
+      return ReplyWithError(util::ErrorCode::NOENT, callback);
+    }
+    if (fields.size() != 3 || !ParseTracepointActions(fields[2], tracepoint))
+      return ReplyWithError(util::ErrorCode::INVAL, callback);
+    return ReplyOK(callback);
+  }
+
+  uint64_t step_count, pass_count;
+  if (fields.size() < 5 || (fields[2] != "E" && fields[2] != "D") ||
+      !ftl::StringToNumberWithError<uint64_t>(fields[3], &step_count,
+                                              ftl::Base::k16) ||
+      !ftl::StringToNumberWithError<uint64_t>(fields[4], &pass_count,
+                                              ftl::Base::k16)) {
+    FTL_LOG(ERROR) << "QTDP: Malformed packet: " << params;
+    return ReplyWithError(util::ErrorCode::INVAL, callback);
+  }
+  if (step_count != 0) {
+    FTL_LOG(ERROR) << "QTDP: while-stepping isn't supported";
+    return ReplyWithError(util::ErrorCode::INVAL, callback);
+  }
+
+  // The only optional field we support is the condition, "Xlen,expr". Fast
+  // tracepoints ("Fn") aren't.
+  std::unique_ptr<util::AgentExpression> condition;
+  for (size_t i = 5; i < fields.size(); ++i) {
+    ftl::StringView field = fields[i];
+    size_t size;
+    if (!ConsumeChar(&field, 'X') ||
+        !(condition = util::AgentExpression::Decode(field, &size)) ||
+        size != field.size()) {
+      FTL_LOG(ERROR) << "QTDP: Unsupported field: " << fields[i];
+      return ReplyWithError(util::ErrorCode::INVAL, callback);
+    }
+  }
+
+  TracepointSet::Tracepoint* tracepoint =
+      tracepoints->Add(number, addr, fields[2] == "E", pass_count);
+  if (!tracepoint)
+    return ReplyWithError(util::ErrorCode::PERM, callback);
+  tracepoint->condition = std::move(condition);
+  return ReplyOK(callback);
+}
+
 }  // namespace debugserver
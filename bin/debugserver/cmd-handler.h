@@ -5,10 +5,17 @@
 #pragma once
 
 #include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <magenta/types.h>
 
 #include "lib/ftl/macros.h"
 #include "lib/ftl/strings/string_view.h"
 
+#include "debugger-utils/trace-buffer.h"
+
 namespace debugserver {
 
 class RspServer;
@@ -47,10 +54,16 @@ class CommandHandler final {
                 const ResponseCallback& callback);
   bool Handle_H(const ftl::StringView& packet,
                 const ResponseCallback& callback);
+  bool Handle_j(const ftl::StringView& packet,
+                const ResponseCallback& callback);
   bool Handle_m(const ftl::StringView& packet,
                 const ResponseCallback& callback);
   bool Handle_M(const ftl::StringView& packet,
                 const ResponseCallback& callback);
+  bool Handle_p(const ftl::StringView& packet,
+                const ResponseCallback& callback);
+  bool Handle_P(const ftl::StringView& packet,
+                const ResponseCallback& callback);
   bool Handle_q(const ftl::StringView& prefix,
                 const ftl::StringView& params,
                 const ResponseCallback& callback);
@@ -61,6 +74,10 @@ class CommandHandler final {
                 const ResponseCallback& callback);
   bool Handle_v(const ftl::StringView& packet,
                 const ResponseCallback& callback);
+  bool Handle_x(const ftl::StringView& packet,
+                const ResponseCallback& callback);
+  bool Handle_X(const ftl::StringView& packet,
+                const ResponseCallback& callback);
   bool Handle_zZ(bool insert,
                  const ftl::StringView& packet,
                  const ResponseCallback& callback);
@@ -83,9 +100,31 @@ class CommandHandler final {
   // qXfer
   bool HandleQueryXfer(const ftl::StringView& params,
                        const ResponseCallback& callback);
+  bool HandleQueryXferAuxv(const ftl::StringView& annex,
+                           size_t offset,
+                           size_t length,
+                           const ResponseCallback& callback);
+  bool HandleQueryXferFeatures(const ftl::StringView& annex,
+                               size_t offset,
+                               size_t length,
+                               const ResponseCallback& callback);
+  bool HandleQueryXferLibrariesSvr4(const ftl::StringView& annex,
+                                    size_t offset,
+                                    size_t length,
+                                    const ResponseCallback& callback);
+  bool HandleQueryXferThreads(const ftl::StringView& annex,
+                              size_t offset,
+                              size_t length,
+                              const ResponseCallback& callback);
   // QNonStop
   bool HandleSetNonStop(const ftl::StringView& params,
                         const ResponseCallback& callback);
+  // QStartNoAckMode
+  bool HandleStartNoAckMode(const ftl::StringView& params,
+                            const ResponseCallback& callback);
+
+  // j packets:
+  bool Handle_jThreadsInfo(const ResponseCallback& callback);
 
   // v packets:
   bool Handle_vAttach(const ftl::StringView& packet,
@@ -105,6 +144,47 @@ class CommandHandler final {
   bool RemoveSoftwareBreakpoint(uintptr_t addr,
                                 size_t kind,
                                 const ResponseCallback& callback);
+  // Write watchpoints, implemented by write-protecting pages.
+  bool InsertWatchpoint(uintptr_t addr,
+                        size_t kind,
+                        const ResponseCallback& callback);
+  bool RemoveWatchpoint(uintptr_t addr,
+                        size_t kind,
+                        const ResponseCallback& callback);
+
+  // Tracepoints
+  // Returns the trace frame selected with QTFrame, or nullptr if there is
+  // none. While one is selected register and memory reads are served from it.
+  const util::TraceFrame* GetSelectedTraceFrame() const;
+  // Reads |length| bytes at |addr| from |frame|, or from the process if they
+  // are in a read-only region given with QTro.
+  bool ReadTraceFrameMemory(const util::TraceFrame& frame,
+                            uintptr_t addr,
+                            void* out_buffer,
+                            size_t length);
+  // qTStatus
+  bool HandleQueryTraceStatus(const ResponseCallback& callback);
+  // qTP
+  bool HandleQueryTracepointStatus(const ftl::StringView& params,
+                                   const ResponseCallback& callback);
+  // QTBuffer
+  bool HandleSetTraceBuffer(const ftl::StringView& params,
+                            const ResponseCallback& callback);
+  // QTFrame
+  bool HandleSetTraceFrame(const ftl::StringView& params,
+                           const ResponseCallback& callback);
+  // QTinit
+  bool HandleSetTraceInit(const ResponseCallback& callback);
+  // QTro
+  bool HandleSetTraceReadOnly(const ftl::StringView& params,
+                              const ResponseCallback& callback);
+  // QTStart
+  bool HandleSetTraceStart(const ResponseCallback& callback);
+  // QTStop
+  bool HandleSetTraceStop(const ResponseCallback& callback);
+  // QTDP
+  bool HandleSetTracepoint(const ftl::StringView& params,
+                           const ResponseCallback& callback);
 
   // The root Server instance that owns us.
   RspServer* server_;  // weak
@@ -112,6 +192,22 @@ class CommandHandler final {
   // Indicates whether we are currently in a qfThreadInfo/qsThreadInfo sequence.
   bool in_thread_info_sequence_;
 
+  // The thread ids being reported by the current qfThreadInfo/qsThreadInfo
+  // sequence, and the index of the next one to report. The list is split
+  // over as many packets as required by the maximum packet size.
+  std::vector<mx_koid_t> thread_info_ids_;
+  size_t thread_info_index_ = 0;
+
+  // The reply to the qXfer:threads:read sequence in progress, taken when the
+  // client asks for offset zero.
+  std::string xfer_threads_xml_;
+
+  // The index of the trace frame selected with QTFrame, or -1.
+  int trace_frame_ = -1;
+
+  // The [start, end) address ranges of read-only memory given with QTro.
+  std::vector<std::pair<uintptr_t, uintptr_t>> trace_readonly_regions_;
+
   FTL_DISALLOW_COPY_AND_ASSIGN(CommandHandler);
 };
 
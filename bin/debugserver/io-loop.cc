@@ -4,53 +4,59 @@
 
 #include "io-loop.h"
 
+#include <errno.h>
 #include <unistd.h>
 
 #include "debugger-utils/util.h"
 
 #include "lib/ftl/logging.h"
-#include "lib/mtl/tasks/message_loop.h"
 
 namespace debugserver {
 
-RspIOLoop::RspIOLoop(int in_fd, Delegate* delegate)
-    : IOLoop(in_fd, delegate) {
+RspIOLoop::RspIOLoop(int in_fd, size_t in_buffer_size, Delegate* delegate)
+    : IOLoop(in_fd, delegate),
+      in_buffer_size_(in_buffer_size),
+      in_buffer_(new char[in_buffer_size]) {
 }
 
-void RspIOLoop::OnReadTask() {
-  FTL_DCHECK(mtl::MessageLoop::GetCurrent()->task_runner().get() ==
-             read_task_runner().get());
-
-  ssize_t read_size = read(fd(), in_buffer_.data(), kMaxBufferSize);
-
-  // 0 bytes means that the remote end closed the TCP connection.
-  if (read_size == 0) {
-    FTL_VLOG(1) << "Client closed connection";
-    ReportDisconnected();
-    return;
-  }
+bool RspIOLoop::OnReadable() {
+  while (!quit_called()) {
+    ssize_t read_size = read(fd(), in_buffer_.get(), in_buffer_size_);
+
+    // 0 bytes means that the remote end closed the TCP connection.
+    if (read_size == 0) {
+      FTL_VLOG(1) << "Client closed connection";
+      ReportDisconnected();
+      return false;
+    }
+
+    if (read_size < 0) {
+      if (errno == EINTR)
+        continue;
+      // Nothing more to read for now.
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return true;
+      FTL_LOG(ERROR) << "Error occurred while waiting for a packet" << ", "
+                     << util::ErrnoString(errno);
+      ReportError();
+      return false;
+    }
+
+    ftl::StringView bytes_read(in_buffer_.get(), read_size);
+    FTL_VLOG(2) << "-> " << util::EscapeNonPrintableString(bytes_read);
+
+    // We're on the delegate's thread so we can hand it the bytes directly,
+    // without copying them.
+    delegate()->OnBytesRead(bytes_read);
 
-  // There was an error
-  if (read_size < 0) {
-    FTL_LOG(ERROR) << "Error occurred while waiting for a packet" << ", "
-                   << util::ErrnoString(errno);
-    ReportError();
-    return;
+    // A short read means we have most likely drained the socket. If not, the
+    // message loop will call us again, which saves a read() call that
+    // would just fail with EAGAIN.
+    if (static_cast<size_t>(read_size) < in_buffer_size_)
+      return true;
   }
 
-  ftl::StringView bytes_read(in_buffer_.data(), read_size);
-  FTL_VLOG(2) << "-> " << util::EscapeNonPrintableString(bytes_read);
-
-  // Notify the delegate that we read some bytes. We copy the buffer data
-  // into the closure as |in_buffer_| can get modified before the closure
-  // runs.
-  // TODO(armansito): Pass a weakptr to |delegate_|?
-  origin_task_runner()->PostTask([ bytes_read = bytes_read.ToString(), this ] {
-    delegate()->OnBytesRead(bytes_read);
-  });
-
-  if (!quit_called())
-    read_task_runner()->PostTask(std::bind(&RspIOLoop::OnReadTask, this));
+  return false;
 }
 
 }  // namespace debugserver
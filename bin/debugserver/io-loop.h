@@ -4,7 +4,7 @@
 
 #pragma once
 
-#include <array>
+#include <memory>
 
 #include "inferior-control/io-loop.h"
 
@@ -14,16 +14,16 @@ namespace debugserver {
 
 class RspIOLoop final : public IOLoop {
  public:
-  RspIOLoop(int in_fd, Delegate* delegate);
+  // |in_buffer_size| is the maximum number of bytes read at a time. This is
+  // normally the size of the largest packet we accept, framing included.
+  RspIOLoop(int in_fd, size_t in_buffer_size, Delegate* delegate);
 
  private:
-  // Maximum number of characters in the inbound buffer.
-  constexpr static size_t kMaxBufferSize = 4096;
-
-  void OnReadTask() override;
+  bool OnReadable() override;
 
   // Buffer used for reading incoming bytes.
-  std::array<char, kMaxBufferSize> in_buffer_;
+  size_t in_buffer_size_;
+  std::unique_ptr<char[]> in_buffer_;
 
   FTL_DISALLOW_COPY_AND_ASSIGN(RspIOLoop);
 };
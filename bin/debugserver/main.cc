@@ -34,6 +34,7 @@ constexpr char kUsageString[] =
     "\n"
     "Options:\n"
     "  --help             show this help message\n"
+    "  --packet-size=size maximum size of packet data, in bytes\n"
     "  --verbose[=level]  set debug verbosity level\n"
     "  --quiet[=level]    set quietness level (opposite of verbose)\n"
     "\n"
@@ -79,6 +80,21 @@ int main(int argc, char* argv[]) {
     }
   }
 
+  std::string packet_size_str;
+  size_t packet_size = debugserver::RspServer::kDefaultMaxPacketSize;
+  if (cl.GetOptionValue("packet-size", &packet_size_str)) {
+    if (!ftl::StringToNumberWithError<size_t>(packet_size_str,
+                                              &packet_size) ||
+        packet_size < debugserver::RspServer::kMinMaxPacketSize ||
+        packet_size > debugserver::RspServer::kMaxMaxPacketSize) {
+      FTL_LOG(ERROR) << "Not a valid packet size: " << packet_size_str
+                     << ", must be between "
+                     << debugserver::RspServer::kMinMaxPacketSize << " and "
+                     << debugserver::RspServer::kMaxMaxPacketSize;
+      return EXIT_FAILURE;
+    }
+  }
+
   uint16_t port;
   if (!ftl::StringToNumberWithError<uint16_t>(cl.positional_args()[0], &port)) {
     FTL_LOG(ERROR) << "Not a valid port number: " << cl.positional_args()[0];
@@ -90,7 +106,7 @@ int main(int argc, char* argv[]) {
   // Give this thread an identifiable name for debugging purposes.
   mtl::SetCurrentThreadName("server (main)");
 
-  debugserver::RspServer server(port);
+  debugserver::RspServer server(port, packet_size);
 
   std::vector<std::string> inferior_argv(cl.positional_args().begin() + 1,
                                          cl.positional_args().end());
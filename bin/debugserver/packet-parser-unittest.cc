@@ -0,0 +1,162 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "packet-parser.h"
+
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace debugserver {
+namespace {
+
+constexpr size_t kMaxPacketSize = 16;
+
+// Records everything reported by the parser as a sequence of strings:
+// "+", "-", "^C", or "$<packet-data>" ("!<packet-data>" if not verified).
+class TestDelegate : public PacketParser::Delegate {
+ public:
+  void OnPacket(const ftl::StringView& packet_data, bool verified) override {
+    events.push_back((verified ? "$" : "!") + packet_data.ToString());
+  }
+  void OnAck(bool ack) override { events.push_back(ack ? "+" : "-"); }
+  void OnInterrupt() override { events.push_back("^C"); }
+
+  std::vector<std::string> events;
+};
+
+TEST(PacketParserTest, SinglePacket) {
+  TestDelegate delegate;
+  PacketParser parser(kMaxPacketSize, &delegate);
+
+  parser.ParseBytes("$foo#44");
+  EXPECT_FALSE(parser.in_packet());
+  ASSERT_EQ(1u, delegate.events.size());
+  EXPECT_EQ("$foo", delegate.events[0]);
+
+  parser.ParseBytes("$#00");
+  ASSERT_EQ(2u, delegate.events.size());
+  EXPECT_EQ("$", delegate.events[1]);
+}
+
+TEST(PacketParserTest, CoalescedPackets) {
+  TestDelegate delegate;
+  PacketParser parser(kMaxPacketSize, &delegate);
+
+  parser.ParseBytes("+$foo#44$bar#35-\x03$baz#3d+");
+  std::vector<std::string> expected{"+",  "$foo", "$bar", "-",
+                                    "^C", "$baz", "+"};
+  EXPECT_EQ(expected, delegate.events);
+}
+
+TEST(PacketParserTest, SplitPackets) {
+  TestDelegate delegate;
+  PacketParser parser(kMaxPacketSize, &delegate);
+
+  // Feed the stream one byte at a time.
+  const std::string stream = "$foo#44+$bar#35";
+  for (char c : stream)
+    parser.ParseBytes(ftl::StringView(&c, 1));
+  std::vector<std::string> expected{"$foo", "+", "$bar"};
+  EXPECT_EQ(expected, delegate.events);
+
+  // Split at every possible point.
+  for (size_t i = 1; i < stream.size(); ++i) {
+    TestDelegate d;
+    PacketParser p(kMaxPacketSize, &d);
+    p.ParseBytes(ftl::StringView(stream.data(), i));
+    p.ParseBytes(ftl::StringView(stream.data() + i, stream.size() - i));
+    EXPECT_EQ(expected, d.events);
+  }
+}
+
+TEST(PacketParserTest, PartialPacket) {
+  TestDelegate delegate;
+  PacketParser parser(kMaxPacketSize, &delegate);
+
+  parser.ParseBytes("$fo");
+  EXPECT_TRUE(parser.in_packet());
+  EXPECT_TRUE(delegate.events.empty());
+  parser.ParseBytes("o#4");
+  EXPECT_TRUE(parser.in_packet());
+  EXPECT_TRUE(delegate.events.empty());
+  parser.ParseBytes("4");
+  EXPECT_FALSE(parser.in_packet());
+  ASSERT_EQ(1u, delegate.events.size());
+  EXPECT_EQ("$foo", delegate.events[0]);
+
+  // A reset discards the partial packet.
+  parser.ParseBytes("$fo");
+  parser.Reset();
+  EXPECT_FALSE(parser.in_packet());
+  parser.ParseBytes("o#44");
+  EXPECT_EQ(1u, delegate.events.size());
+}
+
+TEST(PacketParserTest, BadPackets) {
+  TestDelegate delegate;
+  PacketParser parser(kMaxPacketSize, &delegate);
+
+  parser.ParseBytes("$foo#43");  // Wrong checksum
+  parser.ParseBytes("$foo#4Z");  // Malformed checksum
+  parser.ParseBytes("$foo#44");  // The parser recovers
+  std::vector<std::string> expected{"!foo", "!foo", "$foo"};
+  EXPECT_EQ(expected, delegate.events);
+}
+
+TEST(PacketParserTest, StrayCharacters) {
+  TestDelegate delegate;
+  PacketParser parser(kMaxPacketSize, &delegate);
+
+  parser.ParseBytes("xyz$foo#44\r\n");
+  ASSERT_EQ(1u, delegate.events.size());
+  EXPECT_EQ("$foo", delegate.events[0]);
+}
+
+TEST(PacketParserTest, EscapedCharacters) {
+  TestDelegate delegate;
+  PacketParser parser(kMaxPacketSize, &delegate);
+
+  // An escaped '#' does not terminate the packet, and '$', '+', '-' and ^C
+  // within a packet are just data.
+  parser.ParseBytes("$a}#$+-\x03#80");
+  ASSERT_EQ(1u, delegate.events.size());
+  EXPECT_EQ("$a}#$+-\x03", delegate.events[0]);
+}
+
+TEST(PacketParserTest, Overflow) {
+  TestDelegate delegate;
+  PacketParser parser(kMaxPacketSize, &delegate);
+
+  std::string max_data(kMaxPacketSize, 'a');
+  parser.ParseBytes("$" + max_data + "#10");
+  std::string too_big(kMaxPacketSize + 1, 'a');
+  parser.ParseBytes("$" + too_big + "#71");
+  parser.ParseBytes("$foo#44");
+
+  ASSERT_EQ(3u, delegate.events.size());
+  EXPECT_EQ("$" + max_data, delegate.events[0]);
+  EXPECT_EQ('!', delegate.events[1][0]);
+  EXPECT_EQ("$foo", delegate.events[2]);
+}
+
+TEST(PacketParserTest, NoAckMode) {
+  TestDelegate delegate;
+  PacketParser parser(kMaxPacketSize, &delegate);
+
+  parser.set_no_ack_mode(true);
+  parser.ParseBytes("+$foo#44-$foo#00\x03");
+  std::vector<std::string> expected{"$foo", "$foo", "^C"};
+  EXPECT_EQ(expected, delegate.events);
+
+  // Overflow is still detected.
+  std::string too_big(kMaxPacketSize + 1, 'a');
+  parser.ParseBytes("$" + too_big + "#71");
+  ASSERT_EQ(4u, delegate.events.size());
+  EXPECT_EQ('!', delegate.events[3][0]);
+}
+
+}  // namespace
+}  // namespace debugserver
@@ -0,0 +1,129 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "packet-parser.h"
+
+#include "debugger-utils/util.h"
+
+#include "lib/ftl/logging.h"
+
+#include "util.h"
+
+namespace debugserver {
+
+PacketParser::PacketParser(size_t max_packet_size, Delegate* delegate)
+    : max_packet_size_(max_packet_size),
+      delegate_(delegate),
+      data_(new char[max_packet_size]) {
+  FTL_DCHECK(max_packet_size_ > 0);
+  FTL_DCHECK(delegate_);
+}
+
+void PacketParser::ParseBytes(const ftl::StringView& bytes) {
+  for (char c : bytes) {
+    switch (state_) {
+      case State::kIdle:
+        ParseIdleByte(c);
+        break;
+      case State::kData:
+        if (c == '#') {
+          state_ = State::kChecksum1;
+        } else {
+          if (c == util::kEscapeChar)
+            state_ = State::kDataEscape;
+          AppendDataByte(c);
+        }
+        break;
+      case State::kDataEscape:
+        // The escaped character is taken literally, even if it's '#'.
+        state_ = State::kData;
+        AppendDataByte(c);
+        break;
+      case State::kChecksum1:
+        checksum_chars_[0] = c;
+        state_ = State::kChecksum2;
+        break;
+      case State::kChecksum2:
+        checksum_chars_[1] = c;
+        FinishPacket();
+        break;
+    }
+  }
+}
+
+void PacketParser::Reset() {
+  state_ = State::kIdle;
+  data_size_ = 0;
+  overflow_ = false;
+}
+
+void PacketParser::ParseIdleByte(char c) {
+  switch (c) {
+    case '$':
+      Reset();
+      state_ = State::kData;
+      break;
+    case '+':
+    case '-':
+      // The remote end may still send an ack for our reply to
+      // QStartNoAckMode after we've switched modes.
+      if (no_ack_mode_) {
+        FTL_VLOG(2) << "Ignoring ack in no-ack mode: " << c;
+        break;
+      }
+      delegate_->OnAck(c == '+');
+      break;
+    case kInterruptChar:
+      delegate_->OnInterrupt();
+      break;
+    default:
+      // The remote end doesn't send notifications, and there's nothing else
+      // that can legitimately appear between packets. Ignore it.
+      FTL_VLOG(2) << "Ignoring stray character: 0x" << std::hex
+                  << (static_cast<unsigned>(c) & 0xff) << std::dec;
+      break;
+  }
+}
+
+void PacketParser::AppendDataByte(char c) {
+  if (data_size_ == max_packet_size_) {
+    overflow_ = true;
+    return;
+  }
+  data_[data_size_++] = c;
+}
+
+void PacketParser::FinishPacket() {
+  ftl::StringView packet_data(data_.get(), data_size_);
+  bool verified = false;
+  uint8_t received_checksum;
+
+  if (overflow_) {
+    FTL_LOG(ERROR) << "Packet exceeds maximum size of " << max_packet_size_
+                   << " bytes";
+  } else if (no_ack_mode_) {
+    verified = true;
+  } else if (!util::DecodeByteString(checksum_chars_, &received_checksum)) {
+    FTL_LOG(ERROR) << "Malformed packet checksum received";
+  } else {
+    // The checksum is computed over the raw (i.e., still escaped) data, which
+    // is what |data_| holds.
+    uint8_t computed_checksum = util::ComputeChecksum(packet_data);
+    if (computed_checksum != received_checksum) {
+      FTL_LOG(ERROR) << "Bad checksum: computed = "
+                     << (unsigned)computed_checksum
+                     << ", received = " << (unsigned)received_checksum
+                     << ", packet: " << packet_data;
+    } else {
+      verified = true;
+    }
+  }
+
+  // Reset our state before calling the delegate. This leaves the contents of
+  // |data_|, and thus |packet_data|, intact.
+  Reset();
+  delegate_->OnPacket(packet_data, verified);
+}
+
+}  // namespace debugserver
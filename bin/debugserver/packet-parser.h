@@ -0,0 +1,116 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+
+#include "lib/ftl/macros.h"
+#include "lib/ftl/strings/string_view.h"
+
+namespace debugserver {
+
+// Incremental parser for the byte stream received from the remote end of a
+// GDB Remote Serial Protocol connection.
+//
+// The stream is an arbitrary sequence of packets ($<packet-data>#<checksum>),
+// acknowledgments ('+' and '-') and interrupt requests (0x03). A single read
+// from the socket may contain several of these, and a packet may be split
+// across several reads. PacketParser consumes bytes as they arrive via
+// ParseBytes() and reports each complete unit to its Delegate, retaining any
+// partial packet until the rest of it is received.
+//
+// No memory is allocated after construction: packet data is accumulated in a
+// buffer of fixed size. Packets that don't fit are reported as invalid.
+class PacketParser final {
+ public:
+  // The interrupt character sent by the remote end (i.e. ^C).
+  constexpr static char kInterruptChar = 0x03;
+
+  // Delegate interface for receiving parsed stream elements.
+  class Delegate {
+   public:
+    virtual ~Delegate() = default;
+
+    // Called when a complete packet has been received. |packet_data| contains
+    // the data between '$' and '#' and is only valid for the duration of the
+    // call. If |verified| is false then the packet was malformed (bad
+    // checksum, or too large) and |packet_data| should be ignored.
+    virtual void OnPacket(const ftl::StringView& packet_data,
+                          bool verified) = 0;
+
+    // Called when an acknowledgment is received. |ack| is true for '+' and
+    // false for '-' (a request to retransmit the last packet).
+    virtual void OnAck(bool ack) = 0;
+
+    // Called when an interrupt request is received.
+    virtual void OnInterrupt() = 0;
+  };
+
+  // |max_packet_size| is the maximum number of bytes of packet data (i.e.,
+  // not including framing) that can be received.
+  PacketParser(size_t max_packet_size, Delegate* delegate);
+  ~PacketParser() = default;
+
+  // Consumes |bytes|, invoking the delegate for each complete element found.
+  void ParseBytes(const ftl::StringView& bytes);
+
+  // Discards any partially received packet.
+  void Reset();
+
+  // Returns true if we're in the middle of receiving a packet.
+  bool in_packet() const { return state_ != State::kIdle; }
+
+  // In no-acknowledgment mode (see QStartNoAckMode) the remote end doesn't
+  // send acks and the transport is assumed to be reliable: any '+' or '-'
+  // between packets is ignored, and packet checksums are not verified.
+  bool no_ack_mode() const { return no_ack_mode_; }
+  void set_no_ack_mode(bool no_ack_mode) { no_ack_mode_ = no_ack_mode; }
+
+ private:
+  enum class State {
+    // Between packets, looking for '$', '+', '-' or ^C.
+    kIdle,
+    // Receiving packet data.
+    kData,
+    // Receiving packet data, the previous character was the escape character.
+    kDataEscape,
+    // Expecting the first checksum character.
+    kChecksum1,
+    // Expecting the second checksum character.
+    kChecksum2,
+  };
+
+  // Handles a byte received while in State::kIdle.
+  void ParseIdleByte(char c);
+
+  // Appends |c| to the packet data buffer.
+  void AppendDataByte(char c);
+
+  // Called after the second checksum character has been received.
+  void FinishPacket();
+
+  size_t max_packet_size_;
+  Delegate* delegate_;  // weak
+
+  State state_ = State::kIdle;
+
+  // True if acks are no longer exchanged.
+  bool no_ack_mode_ = false;
+
+  // Buffer holding the packet data received so far.
+  std::unique_ptr<char[]> data_;
+  size_t data_size_ = 0;
+
+  // True if the packet data didn't fit in |data_|.
+  bool overflow_ = false;
+
+  // The received checksum characters.
+  char checksum_chars_[2];
+
+  FTL_DISALLOW_COPY_AND_ASSIGN(PacketParser);
+};
+
+}  // namespace debugserver
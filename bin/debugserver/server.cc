@@ -7,8 +7,11 @@
 #include <arpa/inet.h>
 #include <sys/socket.h>
 
+#include <algorithm>
 #include <array>
+#include <cinttypes>
 #include <cstdlib>
+#include <cstring>
 #include <limits>
 #include <string>
 #include <vector>
@@ -18,6 +21,7 @@
 #include "lib/ftl/functional/auto_call.h"
 #include "lib/ftl/log_settings.h"
 #include "lib/ftl/logging.h"
+#include "lib/ftl/strings/split_string.h"
 #include "lib/ftl/strings/string_number_conversions.h"
 #include "lib/ftl/strings/string_printf.h"
 #include "lib/ftl/strings/string_view.h"
@@ -32,6 +36,73 @@ namespace {
 constexpr char kStopNotification[] = "Stop";
 constexpr char kStopAck[] = "vStopped";
 
+// The number of characters added to packet data to form a packet: the
+// leading '$' or '%', the '#', and the two checksum characters.
+constexpr size_t kPacketFramingSize = 4;
+
+// Breakpoint output is held back for this long, so that the output of hits
+// in quick succession goes out in as few "O" packets as possible.
+constexpr int64_t kBreakpointOutputDelayMilliseconds = 10;
+
+// Returns true if gdb takes "O" packets ahead of the reply to |packet| in
+// non-stop mode: it does for "monitor" commands and tracepoint packets, whose
+// replies it reads with remote_get_noisy_reply().
+bool AcceptsConsoleOutput(const ftl::StringView& packet) {
+  return packet.substr(0, 6) == "qRcmd," || packet.substr(0, 2) == "qT" ||
+         packet.substr(0, 2) == "QT";
+}
+
+// Parses a boolean parameter value, "0" or "1".
+bool ParseBoolParameter(const ftl::StringView& value, bool* out_value) {
+  if (value == "0") {
+    *out_value = false;
+  } else if (value == "1") {
+    *out_value = true;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+std::vector<int> DefaultExpeditedRegisters() {
+  return {arch::GetFPRegisterNumber(), arch::GetSPRegisterNumber(),
+          arch::GetPCRegisterNumber()};
+}
+
+// Parses a list of register numbers, "N,N,...", or "default".
+bool ParseRegisterList(const ftl::StringView& value,
+                       std::vector<int>* out_regnos) {
+  if (value == "default") {
+    *out_regnos = DefaultExpeditedRegisters();
+    return true;
+  }
+
+  std::vector<int> regnos;
+  for (const auto& regno_string : ftl::SplitString(
+           value, ",", ftl::kTrimWhitespace, ftl::kSplitWantNonEmpty)) {
+    int regno;
+    if (!ftl::StringToNumberWithError<int>(regno_string, &regno) ||
+        regno < 0 || regno >= arch::GetNumGeneralRegisters() ||
+        regno >= std::numeric_limits<uint8_t>::max())
+      return false;
+    regnos.push_back(regno);
+  }
+  *out_regnos = std::move(regnos);
+  return true;
+}
+
+// Parses a size parameter value no larger than |max_value|.
+bool ParseSizeParameter(const ftl::StringView& value,
+                        size_t max_value,
+                        size_t* out_value) {
+  size_t result;
+  if (!ftl::StringToNumberWithError<size_t>(value, &result) ||
+      result > max_value)
+    return false;
+  *out_value = result;
+  return true;
+}
+
 }  // namespace
 
 RspServer::PendingNotification::PendingNotification(
@@ -42,10 +113,19 @@ RspServer::PendingNotification::PendingNotification(
     event(event.data(), event.size()),
     timeout(timeout) {}
 
-RspServer::RspServer(uint16_t port)
+constexpr size_t RspServer::kMaxExpeditedStackSize;
+constexpr size_t RspServer::kMaxExpeditedFrames;
+
+RspServer::RspServer(uint16_t port, size_t max_packet_size)
     : port_(port),
+      max_packet_size_(max_packet_size),
       server_sock_(-1),
-      command_handler_(this) {}
+      expedited_registers_(DefaultExpeditedRegisters()),
+      packet_parser_(max_packet_size, this),
+      command_handler_(this) {
+  FTL_DCHECK(max_packet_size_ >= kMinMaxPacketSize &&
+             max_packet_size_ <= kMaxMaxPacketSize);
+}
 
 bool RspServer::Run() {
   FTL_DCHECK(!io_loop_);
@@ -86,15 +166,19 @@ bool RspServer::Run() {
   // |client_sock_| should be ready to be consumed now.
   FTL_DCHECK(client_sock_.is_valid());
 
-  io_loop_ = std::make_unique<RspIOLoop>(client_sock_.get(), this);
-  io_loop_->Run();
+  io_loop_ = std::make_unique<RspIOLoop>(
+      client_sock_.get(), max_packet_size_ + kPacketFramingSize, this);
+  if (!io_loop_->Run()) {
+    FTL_LOG(ERROR) << "Failed to start socket I/O loop";
+    return false;
+  }
 
   // Start the main loop.
   message_loop_.Run();
 
   FTL_LOG(INFO) << "Main loop exited";
 
-  // Tell the I/O loop to quit its message loop and wait for it to finish.
+  // Tell the I/O loop to stop watching the socket.
   io_loop_->Quit();
 
   return run_status_;
@@ -108,6 +192,12 @@ void RspServer::QueueNotification(const ftl::StringView& name,
 
   FTL_VLOG(1) << "Preparing notification: " << name << ":" << event;
 
+  // Send any breakpoint output first: it happened before the event. In
+  // non-stop mode nothing but the notification may be sent now, see
+  // OnBreakpointOutput().
+  if (!non_stop_)
+    FlushBreakpointOutput();
+
   notify_queue_.push(
       std::make_unique<PendingNotification>(name, event, timeout));
   TryPostNextNotification();
@@ -137,6 +227,55 @@ bool RspServer::SetParameter(const ftl::StringView& parameter,
     log_settings.min_log_level = static_cast<ftl::LogSeverity>(verbosity);
     ftl::SetLogSettings(log_settings);
     return true;
+  } else if (parameter == "rle") {
+    if (!ParseBoolParameter(value, &rle_enabled_)) {
+      FTL_LOG(ERROR) << "Invalid rle value: " << value;
+      return false;
+    }
+    return true;
+  } else if (parameter == "memcache") {
+    bool enabled;
+    if (!ParseBoolParameter(value, &enabled)) {
+      FTL_LOG(ERROR) << "Invalid memcache value: " << value;
+      return false;
+    }
+    if (!current_process()) {
+      FTL_LOG(ERROR) << "No current process";
+      return false;
+    }
+    current_process()->memory_cache()->set_enabled(enabled);
+    return true;
+  } else if (parameter == "expedite-registers") {
+    if (!ParseRegisterList(value, &expedited_registers_)) {
+      FTL_LOG(ERROR) << "Invalid expedite-registers value: " << value;
+      return false;
+    }
+    return true;
+  } else if (parameter == "expedite-stack") {
+    if (!ParseSizeParameter(value, kMaxExpeditedStackSize,
+                            &expedited_stack_size_)) {
+      FTL_LOG(ERROR) << "Invalid expedite-stack value: " << value;
+      return false;
+    }
+    return true;
+  } else if (parameter == "expedite-frames") {
+    if (!ParseSizeParameter(value, kMaxExpeditedFrames, &expedited_frames_)) {
+      FTL_LOG(ERROR) << "Invalid expedite-frames value: " << value;
+      return false;
+    }
+    return true;
+  } else if (parameter == "library-events") {
+    bool enabled;
+    if (!ParseBoolParameter(value, &enabled)) {
+      FTL_LOG(ERROR) << "Invalid library-events value: " << value;
+      return false;
+    }
+    if (!current_process()) {
+      FTL_LOG(ERROR) << "No current process";
+      return false;
+    }
+    current_process()->set_report_library_events(enabled);
+    return true;
   } else {
     FTL_LOG(ERROR) << "Invalid parameter: " << parameter;
     return false;
@@ -148,6 +287,45 @@ bool RspServer::GetParameter(const ftl::StringView& parameter,
   if (parameter == "verbosity") {
     *value = ftl::NumberToString<int>(ftl::GetMinLogLevel());
     return true;
+  } else if (parameter == "rle") {
+    *value = rle_enabled_ ? "1" : "0";
+    return true;
+  } else if (parameter == "memcache" || parameter == "memcache-stats") {
+    if (!current_process()) {
+      FTL_LOG(ERROR) << "No current process";
+      return false;
+    }
+    const MemoryCache* cache = current_process()->memory_cache();
+    if (parameter == "memcache") {
+      *value = cache->enabled() ? "1" : "0";
+    } else {
+      const MemoryCache::Stats& stats = cache->stats();
+      *value = ftl::StringPrintf("%" PRIu64 " hits, %" PRIu64
+                                 " misses, %" PRIu64 " reads",
+                                 stats.hits, stats.misses, stats.reads);
+    }
+    return true;
+  } else if (parameter == "expedite-registers") {
+    value->clear();
+    for (int regno : expedited_registers_) {
+      if (!value->empty())
+        value->push_back(',');
+      *value += ftl::NumberToString<int>(regno);
+    }
+    return true;
+  } else if (parameter == "expedite-stack") {
+    *value = ftl::NumberToString<size_t>(expedited_stack_size_);
+    return true;
+  } else if (parameter == "expedite-frames") {
+    *value = ftl::NumberToString<size_t>(expedited_frames_);
+    return true;
+  } else if (parameter == "library-events") {
+    if (!current_process()) {
+      FTL_LOG(ERROR) << "No current process";
+      return false;
+    }
+    *value = current_process()->report_library_events() ? "1" : "0";
+    return true;
   } else {
     FTL_LOG(ERROR) << "Invalid parameter: " << parameter;
     return false;
@@ -204,36 +382,53 @@ bool RspServer::Listen() {
   return true;
 }
 
+void RspServer::EnterNoAckMode() {
+  FTL_LOG(INFO) << "Entering no-acknowledgment mode";
+  packet_parser_.set_no_ack_mode(true);
+  last_packet_ = IOLoop::WriteBuffer();
+}
+
 void RspServer::SendAck(bool ack) {
-  // TODO(armansito): Don't send anything if we're in no-acknowledgment mode. We
-  // currently don't support this mode.
   FTL_DCHECK(io_loop_);
-  char payload = ack ? '+' : '-';
-  io_loop_->PostWriteTask(ftl::StringView(&payload, 1));
+  if (no_ack_mode())
+    return;
+
+  IOLoop::WriteBuffer buffer;
+  buffer.SetHeader(ack ? "+" : "-");
+  io_loop_->PostWriteTask(buffer);
 }
 
-void RspServer::PostWriteTask(bool notify, const ftl::StringView& data) {
+void RspServer::PostWriteTask(bool notify,
+                              std::shared_ptr<const std::string> data) {
   FTL_DCHECK(io_loop_);
-  FTL_DCHECK(data.size() + 4 < kMaxBufferSize);
+  FTL_DCHECK(data);
+
+  // The checksum covers the encoded data, so encode first. Only bother
+  // replacing |data| if the encoding actually saved something.
+  if (rle_enabled_) {
+    std::string encoded;
+    util::RunLengthEncode(*data, &encoded);
+    if (encoded.size() < data->size())
+      data = std::make_shared<const std::string>(std::move(encoded));
+  }
 
-  // Copy the data into a std::string to capture it in the closure.
-  message_loop_.task_runner()->PostTask(
-      [ this, data = data.ToString(), notify ] {
-        int index = 0;
-        out_buffer_[index++] = notify ? '%' : '$';
-        memcpy(out_buffer_.data() + index, data.data(), data.size());
-        index += data.size();
-        out_buffer_[index++] = '#';
+  uint8_t checksum = util::ComputeChecksum(*data);
 
-        uint8_t checksum = 0;
-        for (uint8_t byte : data)
-          checksum += byte;
+  char trailer[3];
+  trailer[0] = '#';
+  util::EncodeByteString(checksum, trailer + 1);
 
-        util::EncodeByteString(checksum, out_buffer_.data() + index);
-        index += 2;
+  IOLoop::WriteBuffer buffer(std::move(data));
+  buffer.SetHeader(notify ? "%" : "$");
+  buffer.SetTrailer(ftl::StringView(trailer, sizeof(trailer)));
 
-        io_loop_->PostWriteTask(ftl::StringView(out_buffer_.data(), index));
-      });
+  if (!notify && !no_ack_mode())
+    last_packet_ = buffer;
+  io_loop_->PostWriteTask(buffer);
+}
+
+void RspServer::PostWriteTask(bool notify, const ftl::StringView& data) {
+  PostWriteTask(notify, std::make_shared<const std::string>(data.ToString()));
 }
 
 void RspServer::PostPacketWriteTask(const ftl::StringView& data) {
@@ -242,9 +437,9 @@ void RspServer::PostPacketWriteTask(const ftl::StringView& data) {
 
 void RspServer::PostPendingNotificationWriteTask() {
   FTL_DCHECK(pending_notification_);
-  std::string bytes(pending_notification_->name + ":" +
-                    pending_notification_->event);
-  PostWriteTask(true, bytes);
+  PostWriteTask(true, std::make_shared<const std::string>(
+                          pending_notification_->name + ":" +
+                          pending_notification_->event));
 }
 
 bool RspServer::TryPostNextNotification() {
@@ -280,19 +475,156 @@ void RspServer::PostNotificationTimeoutHandler() {
       pending_notification_->timeout);
 }
 
+void RspServer::FlushBreakpointOutput() {
+  // Each "O" packet carries as much of the output, hex encoded, as fits.
+  const size_t max_chunk_size = (max_packet_size_ - 1) / 2;
+  const uint8_t* output =
+      reinterpret_cast<const uint8_t*>(breakpoint_output_.data());
+  for (size_t pos = 0; pos < breakpoint_output_.size();
+       pos += max_chunk_size) {
+    size_t size = std::min(max_chunk_size, breakpoint_output_.size() - pos);
+    PostPacketWriteTask("O" + util::EncodeByteArrayString(output + pos, size));
+  }
+  breakpoint_output_.clear();
+}
+
+void RspServer::AddExpeditedState(Thread* thread,
+                                  StopReplyPacket* stop_reply) {
+  arch::Registers* registers = thread->registers();
+  if (!registers->RefreshGeneralRegisters()) {
+    FTL_LOG(WARNING)
+        << "Couldn't read thread registers while handling exception";
+    return;
+  }
+
+  for (int regno : expedited_registers_) {
+    FTL_DCHECK(regno < std::numeric_limits<uint8_t>::max() && regno >= 0);
+    std::string regval = registers->GetRegisterAsString(regno);
+    stop_reply->AddRegisterValue(regno, regval);
+  }
+
+  if (expedited_stack_size_ == 0 && expedited_frames_ == 0)
+    return;
+
+  // The stack window and the first frame record are fetched together with
+  // ReadV(). Frame records further up are taken from the window if they're
+  // in it, and read one at a time otherwise: each is found through the one
+  // before. While every thread is stopped all of this is served by the
+  // process's memory cache.
+  Process* process = thread->process();
+  util::ByteBlock* memory = process->memory_cache();
+  mx_vaddr_t sp = registers->GetSP();
+  mx_vaddr_t fp = registers->GetFP();
+  auto is_frame_address = [sp](mx_vaddr_t fp) {
+    return fp >= sp && fp % sizeof(uintptr_t) == 0;
+  };
+  uint8_t stack[kMaxExpeditedStackSize];
+  size_t stack_size = expedited_stack_size_;
+  uintptr_t frame[2];
+  bool batch_frame = expedited_frames_ > 0 && is_frame_address(fp) &&
+                     fp + sizeof(frame) > sp + stack_size;
+  util::ByteBlock::ReadRange ranges[2];
+  size_t num_ranges = 0;
+  if (stack_size > 0)
+    ranges[num_ranges++] = {sp, stack, stack_size};
+  if (batch_frame)
+    ranges[num_ranges++] = {fp, frame, sizeof(frame)};
+  bool batched = num_ranges > 0 && memory->ReadV(ranges, num_ranges);
+
+  mx_vaddr_t stack_end = sp;
+  if (stack_size > 0) {
+    // The window may extend past the top of the stack. If so, settle for
+    // what's left of the page.
+    constexpr size_t kPageSize = 4096;
+    bool ok = batched || memory->Read(sp, stack, stack_size);
+    if (!ok) {
+      stack_size = std::min(stack_size, kPageSize - (sp & (kPageSize - 1)));
+      ok = memory->Read(sp, stack, stack_size);
+    }
+    if (ok) {
+      stop_reply->AddMemory(sp, stack, stack_size);
+      stack_end = sp + stack_size;
+    }
+  }
+
+  // Each frame record holds the caller's frame pointer and the return
+  // address. Follow the chain as long as it goes up the stack.
+  for (size_t i = 0; i < expedited_frames_; ++i) {
+    if (!is_frame_address(fp))
+      break;
+    if (fp + sizeof(frame) <= stack_end) {
+      memcpy(frame, stack + (fp - sp), sizeof(frame));
+    } else {
+      if (!(i == 0 && batch_frame && batched) &&
+          !memory->Read(fp, frame, sizeof(frame)))
+        break;
+      stop_reply->AddMemory(fp, reinterpret_cast<const uint8_t*>(frame),
+                            sizeof(frame));
+    }
+    if (frame[0] <= fp)
+      break;
+    fp = frame[0];
+  }
+}
+
+void RspServer::AddThreadList(Process* process, StopReplyPacket* stop_reply) {
+  if (!list_threads_in_stop_reply_)
+    return;
+
+  // Pcs can only be reported if every thread is stopped: the two lists must
+  // line up.
+  std::vector<mx_koid_t> thread_ids;
+  std::vector<mx_vaddr_t> pcs;
+  bool have_pcs = true;
+  process->ForEachLiveThread([&](Thread* thread) {
+    thread_ids.push_back(thread->id());
+    if (!have_pcs)
+      return;
+    if (thread->state() == Thread::State::kStopped &&
+        thread->registers()->RefreshGeneralRegisters()) {
+      pcs.push_back(thread->registers()->GetPC());
+    } else {
+      have_pcs = false;
+    }
+  });
+  if (!have_pcs)
+    pcs.clear();
+
+  stop_reply->SetThreadList(process->id(), thread_ids, pcs);
+}
+
 void RspServer::OnBytesRead(const ftl::StringView& bytes_read) {
-  // If this is a packet acknowledgment then ignore it and read again.
-  // TODO(armansito): Re-send previous packet if we got "-".
-  if (bytes_read == "+")
+  // A single read may contain any number of packets, acks and interrupts,
+  // including partial packets. The parser sorts it all out and calls us back
+  // for each complete element.
+  packet_parser_.ParseBytes(bytes_read);
+}
+
+void RspServer::OnAck(bool ack) {
+  if (ack)
     return;
 
-  ftl::StringView packet_data;
-  bool verified = util::VerifyPacket(bytes_read, &packet_data);
+  if (!last_packet_.size()) {
+    FTL_LOG(WARNING) << "Retransmission requested, but nothing to resend";
+    return;
+  }
 
+  FTL_VLOG(1) << "Retransmission requested, resending last packet";
+  io_loop_->PostWriteTask(last_packet_);
+}
+
+void RspServer::OnInterrupt() {
+  // TODO(dje): Suspend the inferior and report a stop. Non-stop mode uses
+  // vCtrlC instead.
+  FTL_LOG(WARNING) << "Interrupt request received, not supported yet";
+}
+
+void RspServer::OnPacket(const ftl::StringView& packet_data, bool verified) {
   // Send acknowledgment back
   SendAck(verified);
 
-  // Wait for the next command if we requested retransmission
+  // Wait for the next command if we requested retransmission. In
+  // no-acknowledgment mode the packet is simply dropped.
   if (!verified)
     return;
 
@@ -326,6 +658,10 @@ void RspServer::OnBytesRead(const ftl::StringView& bytes_read) {
     return;
   }
 
+  // Breakpoint output held in non-stop mode goes out when it can.
+  if (non_stop_ && AcceptsConsoleOutput(packet_data))
+    FlushBreakpointOutput();
+
   // Route the packet data to the command handler.
   auto callback = [this](const ftl::StringView& rsp) {
     // Send the response if there is one.
@@ -444,24 +780,65 @@ void RspServer::OnArchitecturalException(
   stop_reply.SetSignalNumber(isigval);
   stop_reply.SetThreadId(process->id(), context.tid);
 
-  // Registers.
-  if (thread->registers()->RefreshGeneralRegisters()) {
-    std::array<int, 3> regnos{{arch::GetFPRegisterNumber(),
-                               arch::GetSPRegisterNumber(),
-                               arch::GetPCRegisterNumber()}};
-
-    for (int regno : regnos) {
-      FTL_DCHECK(regno < std::numeric_limits<uint8_t>::max() && regno >= 0);
-      std::string regval = thread->registers()->GetRegisterAsString(regno);
-      stop_reply.AddRegisterValue(regno, regval);
-    }
-  } else {
-    FTL_LOG(WARNING)
-        << "Couldn't read thread registers while handling exception";
+  // Report the data address of a watchpoint that triggered.
+  uintptr_t hit = thread->breakpoints()->watchpoint_hit();
+  if (hit) {
+    stop_reply.SetStopReason(
+        "watch", ftl::NumberToString<uintptr_t>(hit, ftl::Base::k16));
   }
 
+  AddExpeditedState(thread, &stop_reply);
+  AddThreadList(process, &stop_reply);
+
   auto packet = stop_reply.Build();
   QueueStopNotification(ftl::StringView(packet.data(), packet.size()));
 }
 
+void RspServer::OnLibrariesChanged(Process* process,
+                                   Thread* thread,
+                                   const mx_exception_context_t& context) {
+  FTL_DCHECK(process);
+  FTL_DCHECK(thread);
+  FTL_VLOG(1) << "Loaded libraries changed";
+
+  // The client is expected to re-read the library list.
+  StopReplyPacket stop_reply(StopReplyPacket::Type::kReceivedSignal);
+  stop_reply.SetSignalNumber(5);
+  stop_reply.SetThreadId(process->id(), thread->id());
+  AddThreadList(process, &stop_reply);
+  stop_reply.SetStopReason("library");
+
+  auto packet = stop_reply.Build();
+  QueueStopNotification(ftl::StringView(packet.data(), packet.size()));
+}
+
+void RspServer::OnBreakpointOutput(Process* process,
+                                   const ftl::StringView& text) {
+  FTL_DCHECK(process);
+
+  breakpoint_output_.append(text.data(), text.size());
+
+  // In all-stop mode the client is waiting for the reply to its continue
+  // packet, and reads "O" packets until it gets it. In non-stop mode it
+  // treats unsolicited ones as invalid replies, so the output is held until
+  // the next packet that it reads them ahead of, see OnPacket().
+  if (non_stop_)
+    return;
+
+  if (breakpoint_output_.size() >= (max_packet_size_ - 1) / 2) {
+    FlushBreakpointOutput();
+    return;
+  }
+
+  if (breakpoint_output_flush_pending_)
+    return;
+  breakpoint_output_flush_pending_ = true;
+  message_loop_.task_runner()->PostDelayedTask(
+      [this] {
+        breakpoint_output_flush_pending_ = false;
+        FlushBreakpointOutput();
+      },
+      ftl::TimeDelta::FromMilliseconds(kBreakpointOutputDelayMilliseconds));
+}
+
 }  // namespace debugserver
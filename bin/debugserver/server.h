@@ -4,9 +4,10 @@
 
 #pragma once
 
-#include <array>
 #include <memory>
 #include <queue>
+#include <string>
+#include <vector>
 
 #include "lib/ftl/files/unique_fd.h"
 #include "lib/ftl/macros.h"
@@ -19,6 +20,8 @@
 
 #include "cmd-handler.h"
 #include "io-loop.h"
+#include "packet-parser.h"
+#include "stop-reply-packet.h"
 
 namespace debugserver {
 
@@ -29,12 +32,31 @@ namespace debugserver {
 // NOTE: This class is generally not thread safe. Care must be taken when
 // calling methods such as set_current_process(), SetCurrentThread(), and
 // QueueNotification() which modify its internal state.
-class RspServer final : public Server {
+class RspServer final : public Server, public PacketParser::Delegate {
  public:
   // The default timeout interval used when sending notifications.
   constexpr static int64_t kDefaultTimeoutSeconds = 30;
 
-  explicit RspServer(uint16_t port);
+  // The default, minimum and maximum values for the maximum size of packet
+  // data (i.e. not including the framing characters and checksum).
+  constexpr static size_t kDefaultMaxPacketSize = 64 * 1024;
+  constexpr static size_t kMinMaxPacketSize = 1024;
+  constexpr static size_t kMaxMaxPacketSize = 1024 * 1024;
+
+  // |max_packet_size| is the maximum size of packet data that we accept, and
+  // is advertised to the client as "PacketSize" in the qSupported reply.
+  // Replies whose size we can choose (e.g., memory reads, thread lists) are
+  // limited to this size as well.
+  explicit RspServer(uint16_t port,
+                     size_t max_packet_size = kDefaultMaxPacketSize);
+
+  // Returns the maximum size of packet data.
+  size_t max_packet_size() const { return max_packet_size_; }
+
+  // Switches to no-acknowledgment mode, as negotiated by QStartNoAckMode.
+  // From then on we neither send acks nor expect them. There's no way back.
+  void EnterNoAckMode();
+  bool no_ack_mode() const { return packet_parser_.no_ack_mode(); }
 
   // Starts the main loop. This will first block and wait for an incoming
   // connection. Once there is a connection, this will start an event loop for
@@ -61,6 +83,29 @@ class RspServer final : public Server {
       const ftl::TimeDelta& timeout =
           ftl::TimeDelta::FromSeconds(kDefaultTimeoutSeconds));
 
+  // The limits of the stack memory that can be sent with stop replies.
+  constexpr static size_t kMaxExpeditedStackSize = 1024;
+  constexpr static size_t kMaxExpeditedFrames = 32;
+
+  // The registers whose values are sent with stop replies and jThreadsInfo.
+  // The default is FP, SP and PC.
+  const std::vector<int>& expedited_registers() const {
+    return expedited_registers_;
+  }
+
+  // If true then stop replies for the current process list all of its
+  // threads, as requested by QListThreadsInStopReply.
+  bool list_threads_in_stop_reply() const {
+    return list_threads_in_stop_reply_;
+  }
+  void set_list_threads_in_stop_reply(bool enable) {
+    list_threads_in_stop_reply_ = enable;
+  }
+
+  // True once the client has switched to non-stop mode with QNonStop.
+  bool non_stop() const { return non_stop_; }
+  void set_non_stop(bool enable) { non_stop_ = enable; }
+
   // Set |parameter| to |value|. Return true if success.
   bool SetParameter(const ftl::StringView& parameter,
                     const ftl::StringView& value);
@@ -70,9 +115,6 @@ class RspServer final : public Server {
                     std::string* value);
 
  private:
-  // Maximum number of characters in the outbound buffer.
-  constexpr static size_t kMaxBufferSize = 4096;
-
   // Represents a pending notification packet.
   struct PendingNotification {
     PendingNotification(const ftl::StringView& name,
@@ -91,17 +133,29 @@ class RspServer final : public Server {
   // and the server socket in |server_sock_|. Returns false if an error occurs.
   bool Listen();
 
+  // Adds the expedited registers of |thread|, and any stack memory the client
+  // asked for, to |stop_reply|.
+  void AddExpeditedState(Thread* thread, StopReplyPacket* stop_reply);
+
+  // Adds the "threads:" and "thread-pcs:" fields to |stop_reply| if the
+  // client asked for them.
+  void AddThreadList(Process* process, StopReplyPacket* stop_reply);
+
+  // Sends the pending output of breakpoint commands to the client in "O"
+  // packets.
+  void FlushBreakpointOutput();
+
   // Send an acknowledgment packet. If |ack| is true, then a '+' ACK will be
   // sent to indicate that a packet was received correctly, or '-' to request
-  // retransmission. This method blocks until the syscall to write to the socket
-  // returns.
+  // retransmission. Nothing is sent in no-acknowledgment mode.
   void SendAck(bool ack);
 
-  // Posts an asynchronous task on the message loop to send a packet over the
-  // wire. |data| will be wrapped in a GDB Remote Protocol packet after
-  // computing the checksum. If |notify| is true, then a notification packet
-  // will be sent (where the first byte of the packet equals '%'), otherwise a
-  // regular packet will be sent (first byte is '$').
+  // Queues a packet to be sent over the wire. |data| will be wrapped in a GDB
+  // Remote Protocol packet after computing the checksum. If |notify| is true,
+  // then a notification packet will be sent (where the first byte of the
+  // packet equals '%'), otherwise a regular packet will be sent (first byte is
+  // '$'). The framing is added around |data| without copying it.
+  void PostWriteTask(bool notify, std::shared_ptr<const std::string> data);
   void PostWriteTask(bool notify, const ftl::StringView& data);
 
   // Convenience helpers for PostWriteTask
@@ -125,6 +179,11 @@ class RspServer final : public Server {
   void OnDisconnected() override;
   void OnIOError() override;
 
+  // PacketParser::Delegate overrides.
+  void OnPacket(const ftl::StringView& packet_data, bool verified) override;
+  void OnAck(bool ack) override;
+  void OnInterrupt() override;
+
   // Process::Delegate overrides.
   void OnThreadStarting(Process* process,
                        Thread* thread,
@@ -140,16 +199,54 @@ class RspServer final : public Server {
                                 Thread* thread,
                                 const mx_excp_type_t type,
                                 const mx_exception_context_t& context) override;
+  void OnLibrariesChanged(Process* process,
+                          Thread* thread,
+                          const mx_exception_context_t& context) override;
+  void OnBreakpointOutput(Process* process,
+                          const ftl::StringView& text) override;
 
   // TCP port number that we will listen on.
   uint16_t port_;
 
+  // The maximum size of packet data, not including framing.
+  size_t max_packet_size_;
+
   // File descriptor for the socket used for listening for incoming
   // connections (e.g. from gdb or lldb).
   ftl::UniqueFD server_sock_;
 
-  // Buffer used for writing outgoing bytes.
-  std::array<char, kMaxBufferSize> out_buffer_;
+  // The last regular (i.e., non-notification) packet sent, kept for
+  // retransmission if the remote end requests it. Unused in no-acknowledgment
+  // mode.
+  IOLoop::WriteBuffer last_packet_;
+
+  // True if outgoing packets are run-length encoded.
+  bool rle_enabled_ = true;
+
+  // See expedited_registers().
+  std::vector<int> expedited_registers_;
+
+  // The number of bytes of stack, starting at the stack pointer, and the
+  // number of frame pointer chain entries sent with stop replies.
+  // Both are off by default.
+  size_t expedited_stack_size_ = 0;
+  size_t expedited_frames_ = 0;
+
+  // See list_threads_in_stop_reply().
+  bool list_threads_in_stop_reply_ = false;
+
+  // See non_stop().
+  bool non_stop_ = false;
+
+  // Output of breakpoint commands (i.e., dprintf) waiting to be sent, and
+  // whether a task to send it has been posted. In non-stop mode the output
+  // can only be sent ahead of the replies to some packets, and is kept here
+  // until then.
+  std::string breakpoint_output_;
+  bool breakpoint_output_flush_pending_ = false;
+
+  // Splits the incoming byte stream into packets, acks and interrupts.
+  PacketParser packet_parser_;
 
   // The CommandHandler that is responsible for interpreting received command
   // packets and routing them to the correct handler.
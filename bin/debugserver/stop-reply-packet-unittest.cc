@@ -40,5 +40,50 @@ TEST(StopReplyPacketTest, ReceivedSignal) {
       "swbreak:;");
 }
 
+TEST(StopReplyPacketTest, ThreadList) {
+  StopReplyPacket stop_reply(StopReplyPacket::Type::kReceivedSignal);
+  stop_reply.SetSignalNumber(5);
+  stop_reply.SetThreadId(1, 2);
+  stop_reply.SetThreadList(1, {2, 0x1A}, {});
+
+  auto packet = stop_reply.Build();
+  ExpectPacketEquals(packet, "T05thread:p1.2;threads:p1.2,p1.1A;");
+
+  stop_reply.SetThreadList(1, {2, 0x1A}, {0x1000, 0xabcdef});
+  stop_reply.SetStopReason("library");
+  packet = stop_reply.Build();
+  ExpectPacketEquals(
+      packet,
+      "T05thread:p1.2;threads:p1.2,p1.1A;thread-pcs:1000,ABCDEF;library:;");
+}
+
+TEST(StopReplyPacketTest, StopReasonWithValue) {
+  StopReplyPacket stop_reply(StopReplyPacket::Type::kReceivedSignal);
+  stop_reply.SetSignalNumber(5);
+  stop_reply.SetThreadId(1, 2);
+  stop_reply.SetStopReason("watch", "7ffc1000");
+
+  auto packet = stop_reply.Build();
+  ExpectPacketEquals(packet, "T05thread:p1.2;watch:7ffc1000;");
+
+  stop_reply.SetStopReason("awatch", "10");
+  packet = stop_reply.Build();
+  ExpectPacketEquals(packet, "T05thread:p1.2;awatch:10;");
+}
+
+TEST(StopReplyPacketTest, Memory) {
+  StopReplyPacket stop_reply(StopReplyPacket::Type::kReceivedSignal);
+  stop_reply.SetSignalNumber(5);
+  stop_reply.SetThreadId(1, 2);
+  stop_reply.AddRegisterValue(7, "0010");
+
+  const uint8_t stack[] = {0x01, 0x23, 0xab};
+  stop_reply.AddMemory(0x1000, stack, sizeof(stack));
+  stop_reply.AddMemory(0x2ff0, stack, 1);
+  auto packet = stop_reply.Build();
+  ExpectPacketEquals(
+      packet, "T0507:0010;thread:p1.2;memory:1000=0123ab;memory:2FF0=01;");
+}
+
 }  // namespace
 }  // namespace debugserver
@@ -7,6 +7,7 @@
 #include "debugger-utils/util.h"
 
 #include "lib/ftl/logging.h"
+#include "lib/ftl/strings/string_number_conversions.h"
 
 #include "util.h"
 
@@ -14,6 +15,9 @@ namespace debugserver {
 namespace {
 
 const char kThreadIdPrefix[] = "thread:";
+const char kMemoryPrefix[] = "memory:";
+const char kThreadsPrefix[] = "threads:";
+const char kThreadPcsPrefix[] = "thread-pcs:";
 
 template <class T>
 void InsertChars(std::vector<char>& collection, const T& to_insert) {
@@ -61,11 +65,55 @@ void StopReplyPacket::AddRegisterValue(uint8_t register_number,
   register_values_.push_back(std::move(result));
 }
 
+void StopReplyPacket::AddMemory(mx_vaddr_t address,
+                                const uint8_t* bytes,
+                                size_t size) {
+  FTL_DCHECK(type_ == Type::kReceivedSignal);
+  FTL_DCHECK(size > 0);
+
+  // memory:ADDR=BYTES
+  std::string result(kMemoryPrefix);
+  result += ftl::NumberToString<mx_vaddr_t>(address, ftl::Base::k16);
+  result.push_back('=');
+  result += util::EncodeByteArrayString(bytes, size);
+  memory_.push_back(std::move(result));
+}
+
+void StopReplyPacket::SetThreadList(mx_koid_t process_id,
+                                    const std::vector<mx_koid_t>& thread_ids,
+                                    const std::vector<mx_vaddr_t>& pcs) {
+  FTL_DCHECK(type_ == Type::kReceivedSignal);
+  FTL_DCHECK(pcs.empty() || pcs.size() == thread_ids.size());
+
+  threads_ = kThreadsPrefix;
+  for (size_t i = 0; i < thread_ids.size(); ++i) {
+    if (i > 0)
+      threads_.push_back(',');
+    threads_ += util::EncodeThreadId(process_id, thread_ids[i]);
+  }
+
+  thread_pcs_.clear();
+  if (!pcs.empty()) {
+    thread_pcs_ = kThreadPcsPrefix;
+    for (size_t i = 0; i < pcs.size(); ++i) {
+      if (i > 0)
+        thread_pcs_.push_back(',');
+      thread_pcs_ += ftl::NumberToString<mx_vaddr_t>(pcs[i], ftl::Base::k16);
+    }
+  }
+}
+
 void StopReplyPacket::SetStopReason(const ftl::StringView& reason) {
   FTL_DCHECK(type_ == Type::kReceivedSignal);
   stop_reason_ = reason.ToString() + ":";
 }
 
+void StopReplyPacket::SetStopReason(const ftl::StringView& reason,
+                                    const ftl::StringView& value) {
+  SetStopReason(reason);
+  stop_reason_.append(value.data(), value.size());
+}
+
 std::vector<char> StopReplyPacket::Build() const {
   char type;
 
@@ -121,6 +169,22 @@ std::vector<char> StopReplyPacket::Build() const {
     }
   }
 
+  // Memory
+  for (const auto& memory : memory_) {
+    InsertString(packet, memory);
+    packet.push_back(';');
+  }
+
+  // Thread list
+  if (!threads_.empty()) {
+    InsertString(packet, threads_);
+    packet.push_back(';');
+  }
+  if (!thread_pcs_.empty()) {
+    InsertString(packet, thread_pcs_);
+    packet.push_back(';');
+  }
+
   // Stop reason
   if (!stop_reason_.empty()) {
     InsertString(packet, stop_reason_);
@@ -133,7 +197,7 @@ std::vector<char> StopReplyPacket::Build() const {
 bool StopReplyPacket::HasParameters() const {
   FTL_DCHECK(type_ == Type::kReceivedSignal);
   return !tid_string_.empty() || !register_values_.empty() ||
-         !stop_reason_.empty();
+         !memory_.empty() || !threads_.empty() || !stop_reason_.empty();
 }
 
 }  // namespace debugserver
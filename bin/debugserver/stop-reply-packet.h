@@ -55,11 +55,31 @@ class StopReplyPacket final {
   // number.
   void AddRegisterValue(uint8_t register_number, const ftl::StringView& value);
 
+  // Adds |size| bytes of inferior memory at |address|, whose contents are
+  // |bytes|, as a "memory:" hint that the client can cache instead of
+  // reading it. This can only be set if the packet type is equal to
+  // kReceivedSignal.
+  void AddMemory(mx_vaddr_t address, const uint8_t* bytes, size_t size);
+
+  // Sets the list of threads of |process_id| to report in the "threads:"
+  // field, as enabled by QListThreadsInStopReply. If |pcs| is non-empty it
+  // holds the pc of each thread in |thread_ids|, in the same order, which are
+  // reported in the "thread-pcs:" field. This can only be set if the packet
+  // type is equal to kReceivedSignal.
+  void SetThreadList(mx_koid_t process_id,
+                     const std::vector<mx_koid_t>& thread_ids,
+                     const std::vector<mx_vaddr_t>& pcs);
+
   // Sets a stop reason. This can only be set if the packet type is equal to
   // kReceivedSignal. Setting a stop-reason overrides any previously set signal
   // number in favor of "05", the trap signal.
   void SetStopReason(const ftl::StringView& reason);
 
+  // Same as above, for the stop reasons that come with a value, e.g. the
+  // data address of a "watch" stop reason.
+  void SetStopReason(const ftl::StringView& reason,
+                     const ftl::StringView& value);
+
   // Returns the encoded packet payload. Returns an empty string if the minimum
   // required parameters have not been set for the type this object was
   // initialized with.
@@ -75,6 +95,9 @@ class StopReplyPacket final {
   uint8_t signo_;
   std::string tid_string_;
   std::vector<std::vector<char>> register_values_;
+  std::vector<std::string> memory_;
+  std::string threads_;
+  std::string thread_pcs_;
   std::string stop_reason_;
 };
 
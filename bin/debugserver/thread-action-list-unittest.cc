@@ -28,6 +28,8 @@ struct ActionTest {
 
 #define CONTINUE ThreadActionList::Action::kContinue
 #define NONE ThreadActionList::Action::kNone
+#define RANGE_STEP ThreadActionList::Action::kRangeStep
+#define STEP ThreadActionList::Action::kStep
 
 const ActionTest basic_tests[] = {
     {true, "c", CONTINUE, 0, {}},
@@ -41,6 +43,10 @@ const ActionTest basic_tests[] = {
      2,
      {{CONTINUE, 1, kMinusOne}, {CONTINUE, 2, 3}}},
     {true, "c:p0.0", NONE, 1, {{CONTINUE, kCurProc, 0}}},
+    {true, "C0b", CONTINUE, 0, {}},
+    {true, "S05:p1.2;c", CONTINUE, 1, {{STEP, 1, 2}}},
+    {true, "r1000,1010:p1.2;c", CONTINUE, 1, {{RANGE_STEP, 1, 2}}},
+    {true, "r1000,1000", RANGE_STEP, 0, {}},
 
     {false, "", NONE, 0, {}},
     {false, "?", NONE, 0, {}},
@@ -52,6 +58,14 @@ const ActionTest basic_tests[] = {
     {false, "c;c", NONE, 0, {}},
     // Specifying all processes and a specific thread is an error.
     {false, "c:p-1.1", NONE, 0, {}},
+    // Signals are two hex digits.
+    {false, "C", NONE, 0, {}},
+    {false, "S5:p1.2", NONE, 0, {}},
+    // Ranges need a start and an end, in that order.
+    {false, "r", NONE, 0, {}},
+    {false, "r1000:p1.2", NONE, 0, {}},
+    {false, "r1010,1000:p1.2", NONE, 0, {}},
+    {false, "c1000", NONE, 0, {}},
 };
 
 TEST(ThreadActionListTest, Basic) {
@@ -75,5 +89,36 @@ TEST(ThreadActionListTest, Basic) {
   }
 }
 
+TEST(ThreadActionListTest, StepRange) {
+  ThreadActionList actions(ftl::StringView("r1000,1010:p1.2;r20,30"),
+                           kCurProc);
+  ASSERT_TRUE(actions.valid());
+  actions.MarkPickOnesResolved();
+
+  uint64_t start, end;
+  EXPECT_EQ(RANGE_STEP, actions.GetAction(1, 2));
+  actions.GetStepRange(1, 2, &start, &end);
+  EXPECT_EQ(0x1000u, start);
+  EXPECT_EQ(0x1010u, end);
+
+  EXPECT_EQ(RANGE_STEP, actions.GetAction(1, 3));
+  actions.GetStepRange(1, 3, &start, &end);
+  EXPECT_EQ(0x20u, start);
+  EXPECT_EQ(0x30u, end);
+}
+
+TEST(ThreadActionListTest, Signal) {
+  ThreadActionList actions(ftl::StringView("S05:p1.2;c:p1.3;C0b"), kCurProc);
+  ASSERT_TRUE(actions.valid());
+  actions.MarkPickOnesResolved();
+
+  EXPECT_EQ(STEP, actions.GetAction(1, 2));
+  EXPECT_EQ(5, actions.GetSignal(1, 2));
+  EXPECT_EQ(CONTINUE, actions.GetAction(1, 3));
+  EXPECT_EQ(-1, actions.GetSignal(1, 3));
+  EXPECT_EQ(CONTINUE, actions.GetAction(1, 4));
+  EXPECT_EQ(11, actions.GetSignal(1, 4));
+}
+
 }  // anonymous namespace
 }  // namespace debugserver
@@ -4,9 +4,13 @@
 
 #include "thread-action-list.h"
 
+#include <cctype>
+
 #include "debugger-utils/util.h"
 
 #include "lib/ftl/logging.h"
+#include "lib/ftl/strings/split_string.h"
+#include "lib/ftl/strings/string_number_conversions.h"
 
 #include "util.h"
 
@@ -18,8 +22,16 @@ namespace debugserver {
 
 ThreadActionList::Entry::Entry(ThreadActionList::Action action,
                                mx_koid_t pid,
-                               mx_koid_t tid)
-    : action_(action), pid_(pid), tid_(tid) {
+                               mx_koid_t tid,
+                               uint64_t range_start,
+                               uint64_t range_end,
+                               int signo)
+    : action_(action),
+      pid_(pid),
+      tid_(tid),
+      range_start_(range_start),
+      range_end_(range_end),
+      signo_(signo) {
   FTL_DCHECK(pid_ != 0);
   // A tid value of zero is ok.
 }
@@ -46,13 +58,21 @@ bool ThreadActionList::Entry::Contains(mx_koid_t pid, mx_koid_t tid) const {
 }
 
 bool ThreadActionList::DecodeAction(char c, ThreadActionList::Action* out_action) {
+  // Magenta has no signals to deliver: C and S are c and s with the signal
+  // the thread stopped with, which the caller checks. gdb only uses vCont if
+  // all four are supported.
   switch (c) {
     case 'c':
+    case 'C':
       *out_action = Action::kContinue;
       break;
     case 's':
+    case 'S':
       *out_action = Action::kStep;
       break;
+    case 'r':
+      *out_action = Action::kRangeStep;
+      break;
     default:
       return false;
   }
@@ -68,6 +88,7 @@ const char* ThreadActionList::ActionToString(ThreadActionList::Action action) {
     CASE_TO_STR(Action::kNone);
     CASE_TO_STR(Action::kContinue);
     CASE_TO_STR(Action::kStep);
+    CASE_TO_STR(Action::kRangeStep);
     default:
       break;
   }
@@ -80,6 +101,9 @@ ThreadActionList::ThreadActionList(const ftl::StringView& str,
   size_t len = str.size();
   size_t s = 0;
   Action default_action = Action::kNone;
+  uint64_t default_range_start = 0;
+  uint64_t default_range_end = 0;
+  int default_signo = -1;
 
   if (len == 0) {
     FTL_LOG(ERROR) << "Empty action string";
@@ -102,18 +126,53 @@ ThreadActionList::ThreadActionList(const ftl::StringView& str,
       FTL_LOG(ERROR) << "Bad action: " << str;
       return;
     }
-    if (n == 1) {
+    // The action's own arguments come before the optional thread id.
+    size_t args_end = str.find(':', s);
+    if (args_end == str.npos || args_end > s + n)
+      args_end = s + n;
+    ftl::StringView args = str.substr(s + 1, args_end - s - 1);
+    uint64_t range_start = 0;
+    uint64_t range_end = 0;
+    int signo = -1;
+    if (str[s] == 'C' || str[s] == 'S') {
+      // The signal number, which is two hex digits.
+      if (args.size() != 2 || !isxdigit(args[0]) || !isxdigit(args[1]) ||
+          !ftl::StringToNumberWithError<int>(args, &signo, ftl::Base::k16)) {
+        FTL_LOG(ERROR) << "Bad signal in action: " << str;
+        return;
+      }
+    } else if (action == Action::kRangeStep) {
+      // rSTART,END
+      auto range = ftl::SplitString(args, ",", ftl::kKeepWhitespace,
+                                    ftl::kSplitWantNonEmpty);
+      if (range.size() != 2 ||
+          !ftl::StringToNumberWithError<uint64_t>(range[0], &range_start,
+                                                  ftl::Base::k16) ||
+          !ftl::StringToNumberWithError<uint64_t>(range[1], &range_end,
+                                                  ftl::Base::k16) ||
+          range_start > range_end) {
+        FTL_LOG(ERROR) << "Bad range in action: " << str;
+        return;
+      }
+    } else if (!args.empty()) {
+      FTL_LOG(ERROR) << "Syntax error in action: " << str;
+      return;
+    }
+    if (args_end == s + n) {
       if (default_action != Action::kNone) {
         FTL_LOG(ERROR) << "Multiple default actions: " << str;
         return;
       }
       default_action = action;
-    } else if (str[s + 1] == ':') {
+      default_range_start = range_start;
+      default_range_end = range_end;
+      default_signo = signo;
+    } else {
       bool has_pid;
       // TODO(dje): koids are uint64_t
       int64_t pid, tid;
-      if (!util::ParseThreadId(str.substr(s + 2, n - 2), &has_pid, &pid,
-                               &tid)) {
+      if (!util::ParseThreadId(str.substr(args_end + 1, s + n - args_end - 1),
+                               &has_pid, &pid, &tid)) {
         FTL_LOG(ERROR) << "Bad thread id in action: " << str;
         return;
       }
@@ -127,11 +186,9 @@ ThreadActionList::ThreadActionList(const ftl::StringView& str,
         FTL_LOG(ERROR) << "All processes and one thread: " << str;
         return;
       }
-      actions_.push_back(
-          Entry(action, pid == -1 ? kAll : pid, tid == -1 ? kAll : tid));
-    } else {
-      FTL_LOG(ERROR) << "Syntax error in action: " << str;
-      return;
+      actions_.push_back(Entry(action, pid == -1 ? kAll : pid,
+                               tid == -1 ? kAll : tid, range_start,
+                               range_end, signo));
     }
     if (semi == str.npos)
       s = len;
@@ -140,6 +197,9 @@ ThreadActionList::ThreadActionList(const ftl::StringView& str,
   }
 
   default_action_ = default_action;
+  default_range_start_ = default_range_start;
+  default_range_end_ = default_range_end;
+  default_signo_ = default_signo;
   valid_ = true;
 }
 
@@ -155,4 +215,33 @@ ThreadActionList::Action ThreadActionList::GetAction(mx_koid_t pid,
   return default_action_;
 }
 
+void ThreadActionList::GetStepRange(mx_koid_t pid,
+                                    mx_koid_t tid,
+                                    uint64_t* out_start,
+                                    uint64_t* out_end) const {
+  FTL_DCHECK(pick_ones_resolved_);
+
+  for (const auto& e : actions_) {
+    if (e.Contains(pid, tid)) {
+      *out_start = e.range_start();
+      *out_end = e.range_end();
+      return;
+    }
+  }
+
+  *out_start = default_range_start_;
+  *out_end = default_range_end_;
+}
+
+int ThreadActionList::GetSignal(mx_koid_t pid, mx_koid_t tid) const {
+  FTL_DCHECK(pick_ones_resolved_);
+
+  for (const auto& e : actions_) {
+    if (e.Contains(pid, tid))
+      return e.signo();
+  }
+
+  return default_signo_;
+}
+
 }  // namespace debugserver
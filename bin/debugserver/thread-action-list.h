@@ -30,19 +30,33 @@ class ThreadActionList final {
     kContinue,
     // Step the thread one instruction.
     kStep,
+    // Step the thread until it leaves a range of addresses.
+    kRangeStep,
     // Other actions are not supported yet.
   };
 
   // Utility class to hold one entry in ThreadActionList.
   class Entry final {
    public:
-    Entry(Action action, mx_koid_t pid, mx_koid_t tid);
+    Entry(Action action,
+          mx_koid_t pid,
+          mx_koid_t tid,
+          uint64_t range_start = 0,
+          uint64_t range_end = 0,
+          int signo = -1);
     ~Entry() = default;
 
     Action action() const { return action_; }
     mx_koid_t pid() const { return pid_; }
     mx_koid_t tid() const { return tid_; }
 
+    // The range of a kRangeStep action: [range_start, range_end).
+    uint64_t range_start() const { return range_start_; }
+    uint64_t range_end() const { return range_end_; }
+
+    // The signal number of a "C" or "S" action, or -1 if there is none.
+    int signo() const { return signo_; }
+
     // Call this to upgrade a "pick one" entry (tid == 0) to the chosen value.
     void set_picked_tid(mx_koid_t tid);
 
@@ -57,6 +71,9 @@ class ThreadActionList final {
     // later though, after the Entry is created.
     mx_koid_t pid_;
     mx_koid_t tid_;
+    uint64_t range_start_;
+    uint64_t range_end_;
+    int signo_;
   };
 
   // For pid,tid values, means "all processes" or "all threads".
@@ -85,6 +102,16 @@ class ThreadActionList final {
   // Return the action for |thread|.
   Action GetAction(mx_koid_t pid, mx_koid_t tid) const;
 
+  // Return the range to step in for |thread|, if its action is kRangeStep.
+  void GetStepRange(mx_koid_t pid,
+                    mx_koid_t tid,
+                    uint64_t* out_start,
+                    uint64_t* out_end) const;
+
+  // Return the signal number given with the action for |thread|, or -1 if
+  // there is none.
+  int GetSignal(mx_koid_t pid, mx_koid_t tid) const;
+
   Action default_action() const { return default_action_; }
   const std::vector<Entry>& actions() const { return actions_; }
 
@@ -98,6 +125,9 @@ class ThreadActionList final {
   bool pick_ones_resolved_ = false;
 
   Action default_action_ = Action::kNone;
+  uint64_t default_range_start_ = 0;
+  uint64_t default_range_end_ = 0;
+  int default_signo_ = -1;
   std::vector<Entry> actions_;
 
   FTL_DISALLOW_COPY_AND_ASSIGN(ThreadActionList);
@@ -150,6 +150,86 @@ TEST(UtilTest, FindUnescapedChar) {
   EXPECT_FALSE(FindUnescapedChar(kEscapeChar, kPacket7, &index));
 }
 
+TEST(UtilTest, EscapeBinaryData) {
+  const uint8_t kBytes[] = {'a', '#', '$', '}', '*', 0, 0xff, 'z'};
+  std::string result = "b";
+  EscapeBinaryData(kBytes, sizeof(kBytes), &result);
+  EXPECT_EQ(std::string("ba}\x03}\x04}]}\x0a\0\xffz", 13), result);
+
+  result.clear();
+  EscapeBinaryData(nullptr, 0, &result);
+  EXPECT_TRUE(result.empty());
+}
+
+TEST(UtilTest, UnescapeBinaryData) {
+  std::vector<uint8_t> result;
+  EXPECT_TRUE(UnescapeBinaryData(
+      ftl::StringView("a}\x03}\x04}]}\x0a\0\xffz", 12), &result));
+  const std::vector<uint8_t> kExpected = {'a', '#', '$', '}',
+                                          '*', 0,   0xff, 'z'};
+  EXPECT_EQ(kExpected, result);
+
+  result.clear();
+  EXPECT_TRUE(UnescapeBinaryData("", &result));
+  EXPECT_TRUE(result.empty());
+
+  // A trailing escape character is malformed.
+  EXPECT_FALSE(UnescapeBinaryData("ab}", &result));
+
+  // Round trip all byte values.
+  std::vector<uint8_t> bytes;
+  for (int i = 0; i < 256; ++i)
+    bytes.push_back(static_cast<uint8_t>(i));
+  std::string escaped;
+  EscapeBinaryData(bytes.data(), bytes.size(), &escaped);
+  EXPECT_EQ(bytes.size() + 4, escaped.size());
+  result.clear();
+  EXPECT_TRUE(UnescapeBinaryData(escaped, &result));
+  EXPECT_EQ(bytes, result);
+}
+
+TEST(UtilTest, RunLengthEncode) {
+  auto encode = [](const ftl::StringView& data) {
+    std::string result;
+    RunLengthEncode(data, &result);
+    return result;
+  };
+
+  EXPECT_EQ("", encode(""));
+  EXPECT_EQ("abc", encode("abc"));
+
+  // Runs of up to 3 characters are left alone.
+  EXPECT_EQ("a000b", encode("a000b"));
+  // 0 followed by 3 repeats: 3 + 29 = ' '.
+  EXPECT_EQ("a0* b", encode("a0000b"));
+  // 0 followed by 5 repeats: 5 + 29 = '"'.
+  EXPECT_EQ("0*\"", encode("000000"));
+
+  // 6 and 7 repeats would produce '#' and '$'.
+  EXPECT_EQ("0*\"0", encode(std::string(7, '0')));
+  EXPECT_EQ("0*\"00", encode(std::string(8, '0')));
+  // 8 repeats: 8 + 29 = '%'.
+  EXPECT_EQ("0*%", encode(std::string(9, '0')));
+
+  // The longest run is 1 + 97 characters ('~').
+  EXPECT_EQ("0*~", encode(std::string(98, '0')));
+  EXPECT_EQ("0*~0", encode(std::string(99, '0')));
+  EXPECT_EQ("0*~0* ", encode(std::string(102, '0')));
+
+  // Escape sequences are handled like any other characters.
+  EXPECT_EQ("}]* ", encode("}]]]]"));
+}
+
+TEST(UtilTest, EscapeXmlAttribute) {
+  std::string result("x=");
+  EscapeXmlAttribute("/boot/lib/libfoo.so", &result);
+  EXPECT_EQ("x=/boot/lib/libfoo.so", result);
+
+  result.clear();
+  EscapeXmlAttribute("a&b<c>d\"e'f", &result);
+  EXPECT_EQ("a&amp;b&lt;c&gt;d&quot;e&apos;f", result);
+}
+
 }  // namespace
 }  // namespace util
 }  // namespace debugserver
@@ -112,6 +112,110 @@ bool FindUnescapedChar(const char val,
   return found;
 }
 
+void EscapeBinaryData(const uint8_t* bytes,
+                      size_t num_bytes,
+                      std::string* out) {
+  FTL_DCHECK(bytes || num_bytes == 0);
+  FTL_DCHECK(out);
+
+  // Reserve for the common case of there being few characters to escape.
+  out->reserve(out->size() + num_bytes + num_bytes / 8);
+  for (size_t i = 0; i < num_bytes; ++i) {
+    char c = static_cast<char>(bytes[i]);
+    switch (c) {
+      case '#':
+      case '$':
+      case '*':
+      case kEscapeChar:
+        out->push_back(kEscapeChar);
+        out->push_back(c ^ 0x20);
+        break;
+      default:
+        out->push_back(c);
+        break;
+    }
+  }
+}
+
+bool UnescapeBinaryData(const ftl::StringView& data,
+                        std::vector<uint8_t>* out) {
+  FTL_DCHECK(out);
+
+  out->reserve(out->size() + data.size());
+  for (size_t i = 0; i < data.size(); ++i) {
+    char c = data[i];
+    if (c == kEscapeChar) {
+      if (++i == data.size()) {
+        FTL_LOG(ERROR) << "Binary data ends with an escape character";
+        return false;
+      }
+      c = data[i] ^ 0x20;
+    }
+    out->push_back(static_cast<uint8_t>(c));
+  }
+
+  return true;
+}
+
+void RunLengthEncode(const ftl::StringView& data, std::string* out) {
+  FTL_DCHECK(out);
+
+  // The repeat count is sent as a printable character: N + 29, up to '~'.
+  constexpr size_t kRepeatBase = 29;
+  constexpr size_t kMinRepeat = 3;  // Anything shorter isn't worth it.
+  constexpr size_t kMaxRepeat = '~' - kRepeatBase;
+
+  out->reserve(out->size() + data.size());
+  size_t i = 0;
+  while (i < data.size()) {
+    char c = data[i];
+    size_t repeat = 0;
+    while (i + 1 + repeat < data.size() && data[i + 1 + repeat] == c &&
+           repeat < kMaxRepeat)
+      ++repeat;
+
+    out->push_back(c);
+    if (repeat < kMinRepeat) {
+      ++i;
+      continue;
+    }
+
+    // '#' and '$' would be taken as packet framing.
+    while (repeat + kRepeatBase == '#' || repeat + kRepeatBase == '$')
+      --repeat;
+    out->push_back('*');
+    out->push_back(static_cast<char>(repeat + kRepeatBase));
+    i += 1 + repeat;
+  }
+}
+
+void EscapeXmlAttribute(const ftl::StringView& str, std::string* out) {
+  FTL_DCHECK(out);
+
+  for (char c : str) {
+    switch (c) {
+      case '&':
+        out->append("&amp;");
+        break;
+      case '<':
+        out->append("&lt;");
+        break;
+      case '>':
+        out->append("&gt;");
+        break;
+      case '"':
+        out->append("&quot;");
+        break;
+      case '\'':
+        out->append("&apos;");
+        break;
+      default:
+        out->push_back(c);
+        break;
+    }
+  }
+}
+
 // We take |packet| by copying since we modify it internally while processing
 // it.
 bool VerifyPacket(ftl::StringView packet, ftl::StringView* out_packet_data) {
@@ -169,9 +273,7 @@ bool VerifyPacket(ftl::StringView packet, ftl::StringView* out_packet_data) {
   }
 
   // Compute the checksum over packet payload
-  uint8_t local_checksum = 0;
-  for (char byte : packet_data)
-    local_checksum += (uint8_t)byte;
+  uint8_t local_checksum = util::ComputeChecksum(packet_data);
 
   if (local_checksum != received_checksum) {
     FTL_LOG(ERROR) << "Bad checksum: computed = " << (unsigned)local_checksum
@@ -89,6 +89,34 @@ bool FindUnescapedChar(const char val,
                        const ftl::StringView& packet,
                        size_t* out_index);
 
+// Appends the binary data in |bytes| of size |num_bytes| to |out|, escaping
+// the characters that may not appear unescaped in a packet ('#', '$', '}' and
+// '*'). An escaped character is sent as |kEscapeChar| followed by the
+// original character XOR'd with 0x20. This is the encoding used by the binary
+// memory transfer packets, "x" and "X".
+void EscapeBinaryData(const uint8_t* bytes,
+                      size_t num_bytes,
+                      std::string* out);
+
+// Reverses EscapeBinaryData: decodes the escaped binary data in |data| and
+// appends the result to |out|. Returns false if |data| is malformed (i.e. ends
+// with a lone escape character).
+bool UnescapeBinaryData(const ftl::StringView& data,
+                        std::vector<uint8_t>* out);
+
+// Appends |data| to |out|, run-length encoded as described in
+// https://sourceware.org/gdb/current/onlinedocs/gdb/Overview.html#Binary-Data
+// A run of a character followed by N repeats of it (3 <= N <= 97) is sent as
+// the character, followed by '*', followed by the character N + 29. Repeat
+// counts of 6 and 7 would produce '#' and '$' and are avoided by using a
+// shorter run. Any '*' in |data| must already have been escaped.
+void RunLengthEncode(const ftl::StringView& data, std::string* out);
+
+// Appends |str| to |out| with the characters that are special in XML
+// attribute values ('&', '<', '>', '"' and '\'') replaced by entity
+// references.
+void EscapeXmlAttribute(const ftl::StringView& str, std::string* out);
+
 // Verifies that the given command is formatted correctly and that the checksum
 // is correct. Returns false verification fails. Otherwise returns true, and
 // returns a pointer to the beginning of the packet data and the size of the
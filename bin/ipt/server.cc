@@ -286,4 +286,16 @@ void IptServer::OnArchitecturalException(Process* process,
   QuitMessageLoop(true);
 }
 
+void IptServer::OnLibrariesChanged(Process* process,
+                                   Thread* thread,
+                                   const mx_exception_context_t& context) {
+  // We don't ask for these, but if we get one there's nothing to do.
+  thread->Resume();
+}
+
+void IptServer::OnBreakpointOutput(Process* process,
+                                   const ftl::StringView& text) {
+  // We don't insert breakpoints with commands.
+}
+
 }  // namespace debugserver
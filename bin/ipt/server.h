@@ -119,6 +119,11 @@ class IptServer final : public Server {
                                 Thread* thread,
                                 const mx_excp_type_t type,
                                 const mx_exception_context_t& context) override;
+  void OnLibrariesChanged(Process* process,
+                          Thread* thread,
+                          const mx_exception_context_t& context) override;
+  void OnBreakpointOutput(Process* process,
+                          const ftl::StringView& text) override;
 
   IptConfig config_;
 
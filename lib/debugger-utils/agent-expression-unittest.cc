@@ -0,0 +1,295 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "agent-expression.h"
+
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace debugserver {
+namespace util {
+namespace {
+
+// Registers 0-7 hold 0x100 times their number, and memory at
+// [kMemoryBase, kMemoryBase + sizeof(memory)) holds a few known values,
+// followed by the string "hi".
+class TestContext final : public AgentExpression::Context {
+ public:
+  static constexpr uint64_t kMemoryBase = 0x1000;
+
+  TestContext() {
+    const uint8_t bytes[] = {0x81, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88,
+                             'h',  'i',  0};
+    memcpy(memory, bytes, sizeof(bytes));
+  }
+
+  bool GetRegister(int regno, uint64_t* out_value) override {
+    if (regno < 0 || regno >= 8)
+      return false;
+    *out_value = regno * 0x100;
+    return true;
+  }
+
+  bool ReadMemory(uint64_t address,
+                  void* out_buffer,
+                  size_t length) override {
+    if (address < kMemoryBase ||
+        address + length > kMemoryBase + sizeof(memory))
+      return false;
+    memcpy(out_buffer, memory + (address - kMemoryBase), length);
+    return true;
+  }
+
+  void WriteOutput(const ftl::StringView& text) override {
+    output.append(text.data(), text.size());
+  }
+
+  bool CollectMemory(uint64_t address, size_t length) override {
+    collected.emplace_back(address, length);
+    return true;
+  }
+
+  uint8_t memory[64] = {};
+  std::string output;
+  std::vector<std::pair<uint64_t, size_t>> collected;
+};
+
+constexpr uint64_t TestContext::kMemoryBase;
+
+// Evaluates |bytecode|, and returns true if it succeeded.
+bool Evaluate(std::vector<uint8_t> bytecode, uint64_t* out_value) {
+  TestContext context;
+  AgentExpression expression(std::move(bytecode));
+  return expression.Evaluate(&context, out_value);
+}
+
+TEST(AgentExpressionTest, Decode) {
+  size_t size;
+  std::unique_ptr<AgentExpression> expression =
+      AgentExpression::Decode("3,220527X1,27", &size);
+  ASSERT_TRUE(expression);
+  EXPECT_EQ(8u, size);
+  EXPECT_EQ((std::vector<uint8_t>{0x22, 0x05, 0x27}), expression->bytecode());
+
+  EXPECT_FALSE(AgentExpression::Decode("", &size));
+  EXPECT_FALSE(AgentExpression::Decode("3", &size));
+  EXPECT_FALSE(AgentExpression::Decode("0,", &size));
+  EXPECT_FALSE(AgentExpression::Decode("3,2205", &size));
+  EXPECT_FALSE(AgentExpression::Decode("2,22zz", &size));
+  EXPECT_FALSE(AgentExpression::Decode("x,2205", &size));
+}
+
+TEST(AgentExpressionTest, Arithmetic) {
+  uint64_t value;
+
+  // (5 - 7) * 3 == -6
+  EXPECT_TRUE(Evaluate({0x22, 0x05, 0x22, 0x07, 0x03, 0x22, 0x03, 0x04, 0x27},
+                       &value));
+  EXPECT_EQ(static_cast<uint64_t>(-6), value);
+
+  // -6 / 4 signed and unsigned, and the remainders.
+  EXPECT_TRUE(Evaluate({0x22, 0xfa, 0x16, 0x08, 0x22, 0x04, 0x05, 0x27},
+                       &value));
+  EXPECT_EQ(static_cast<uint64_t>(-1), value);
+  EXPECT_TRUE(Evaluate({0x22, 0xfa, 0x22, 0x04, 0x06, 0x27}, &value));
+  EXPECT_EQ(0x3eu, value);
+  EXPECT_TRUE(Evaluate({0x22, 0xfa, 0x16, 0x08, 0x22, 0x04, 0x07, 0x27},
+                       &value));
+  EXPECT_EQ(static_cast<uint64_t>(-2), value);
+  EXPECT_TRUE(Evaluate({0x22, 0xfa, 0x22, 0x04, 0x08, 0x27}, &value));
+  EXPECT_EQ(2u, value);
+
+  // Division by zero fails.
+  EXPECT_FALSE(Evaluate({0x22, 0x01, 0x22, 0x00, 0x06, 0x27}, &value));
+
+  // Shifts, including by more than the width of a value.
+  EXPECT_TRUE(Evaluate({0x22, 0x01, 0x22, 0x3f, 0x09, 0x27}, &value));
+  EXPECT_EQ(uint64_t{1} << 63, value);
+  EXPECT_TRUE(Evaluate({0x22, 0x01, 0x22, 0x40, 0x09, 0x27}, &value));
+  EXPECT_EQ(0u, value);
+  EXPECT_TRUE(Evaluate({0x22, 0x80, 0x16, 0x08, 0x22, 0x04, 0x0a, 0x27},
+                       &value));
+  EXPECT_EQ(static_cast<uint64_t>(-8), value);
+  EXPECT_TRUE(Evaluate({0x22, 0x80, 0x22, 0x04, 0x0b, 0x27}, &value));
+  EXPECT_EQ(8u, value);
+}
+
+TEST(AgentExpressionTest, Comparisons) {
+  uint64_t value;
+
+  // -1 < 1 signed, but not unsigned.
+  EXPECT_TRUE(Evaluate({0x22, 0xff, 0x16, 0x08, 0x22, 0x01, 0x14, 0x27},
+                       &value));
+  EXPECT_EQ(1u, value);
+  EXPECT_TRUE(Evaluate({0x22, 0xff, 0x16, 0x08, 0x22, 0x01, 0x15, 0x27},
+                       &value));
+  EXPECT_EQ(0u, value);
+
+  EXPECT_TRUE(Evaluate({0x23, 0x12, 0x34, 0x24, 0x00, 0x00, 0x12, 0x34, 0x13,
+                        0x27},
+                       &value));
+  EXPECT_EQ(1u, value);
+  EXPECT_TRUE(Evaluate({0x22, 0x00, 0x0e, 0x27}, &value));
+  EXPECT_EQ(1u, value);
+  EXPECT_TRUE(Evaluate({0x22, 0x00, 0x12, 0x27}, &value));
+  EXPECT_EQ(~uint64_t{0}, value);
+}
+
+TEST(AgentExpressionTest, RegistersAndMemory) {
+  uint64_t value;
+
+  // $r3 == 0x300
+  EXPECT_TRUE(Evaluate({0x26, 0x00, 0x03, 0x23, 0x03, 0x00, 0x13, 0x27},
+                       &value));
+  EXPECT_EQ(1u, value);
+  EXPECT_FALSE(Evaluate({0x26, 0x00, 0x08, 0x27}, &value));
+
+  // Memory reads are zero-extended, in the inferior's byte order.
+  EXPECT_TRUE(Evaluate({0x23, 0x10, 0x00, 0x17, 0x27}, &value));
+  EXPECT_EQ(0x81u, value);
+  EXPECT_TRUE(Evaluate({0x23, 0x10, 0x00, 0x18, 0x27}, &value));
+  EXPECT_EQ(0x8281u, value);
+  EXPECT_TRUE(Evaluate({0x23, 0x10, 0x00, 0x19, 0x27}, &value));
+  EXPECT_EQ(0x84838281u, value);
+  EXPECT_TRUE(Evaluate({0x23, 0x10, 0x00, 0x1a, 0x27}, &value));
+  EXPECT_EQ(0x8887868584838281u, value);
+
+  // ... and sign-extended with "ext".
+  EXPECT_TRUE(Evaluate({0x23, 0x10, 0x00, 0x17, 0x16, 0x08, 0x27}, &value));
+  EXPECT_EQ(static_cast<uint64_t>(-0x7f), value);
+  EXPECT_TRUE(Evaluate({0x23, 0x10, 0x00, 0x18, 0x2a, 0x08, 0x27}, &value));
+  EXPECT_EQ(0x81u, value);
+
+  EXPECT_FALSE(Evaluate({0x23, 0x10, 0x3c, 0x1a, 0x27}, &value));
+}
+
+TEST(AgentExpressionTest, StackOps) {
+  uint64_t value;
+
+  // 1 2 3 rot => 3 1 2; the rest picks them off one at a time.
+  const std::vector<uint8_t> rot = {0x22, 0x01, 0x22, 0x02, 0x22, 0x03, 0x33};
+  std::vector<uint8_t> bytecode = rot;
+  bytecode.push_back(0x27);
+  EXPECT_TRUE(Evaluate(bytecode, &value));
+  EXPECT_EQ(2u, value);
+  bytecode = rot;
+  bytecode.insert(bytecode.end(), {0x29, 0x27});
+  EXPECT_TRUE(Evaluate(bytecode, &value));
+  EXPECT_EQ(1u, value);
+  bytecode = rot;
+  bytecode.insert(bytecode.end(), {0x32, 0x02, 0x27});
+  EXPECT_TRUE(Evaluate(bytecode, &value));
+  EXPECT_EQ(3u, value);
+  bytecode = rot;
+  bytecode.insert(bytecode.end(), {0x2b, 0x27});
+  EXPECT_TRUE(Evaluate(bytecode, &value));
+  EXPECT_EQ(1u, value);
+
+  // 4 dup * == 16
+  EXPECT_TRUE(Evaluate({0x22, 0x04, 0x28, 0x04, 0x27}, &value));
+  EXPECT_EQ(16u, value);
+
+  // An empty stack at the end gives zero.
+  EXPECT_TRUE(Evaluate({0x22, 0x01, 0x29, 0x27}, &value));
+  EXPECT_EQ(0u, value);
+  EXPECT_FALSE(Evaluate({0x22, 0x01, 0x02, 0x27}, &value));
+  EXPECT_FALSE(Evaluate({0x22, 0x01, 0x32, 0x01, 0x27}, &value));
+
+  // Pushing forever overflows the stack.
+  EXPECT_FALSE(Evaluate({0x22, 0x01, 0x21, 0x00, 0x00}, &value));
+}
+
+TEST(AgentExpressionTest, ControlFlow) {
+  uint64_t value;
+
+  // if ($r1 == 0x100) 7 else 9
+  const std::vector<uint8_t> bytecode = {
+      0x26, 0x00, 0x01, 0x23, 0x01, 0x00, 0x13,  // 0: $r1 == 0x100
+      0x20, 0x00, 0x0e,                          // 7: if_goto 14
+      0x22, 0x09, 0x27,                          // 10: 9 end
+      0x00,                                      // 13: never reached
+      0x22, 0x07, 0x27,                          // 14: 7 end
+  };
+  EXPECT_TRUE(Evaluate(bytecode, &value));
+  EXPECT_EQ(7u, value);
+
+  // An infinite loop is cut short.
+  EXPECT_FALSE(Evaluate({0x21, 0x00, 0x00}, &value));
+
+  // So is running off the end, and truncated or unknown instructions.
+  EXPECT_FALSE(Evaluate({0x22, 0x01}, &value));
+  EXPECT_FALSE(Evaluate({0x23, 0x01}, &value));
+  EXPECT_FALSE(Evaluate({0x22, 0x01, 0x21, 0x00, 0x10}, &value));
+  EXPECT_FALSE(Evaluate({0x22, 0x01, 0x1e, 0x27}, &value));
+}
+
+TEST(AgentExpressionTest, Printf) {
+  // What gdb generates for a dprintf: the arguments in reverse order, the
+  // channel and the function, then the printf.
+  const char kFormat[] = "%d %s %#hhx %c %p%%\n";
+  std::vector<uint8_t> bytecode = {
+      0x23, 0x10, 0x00,        // %p
+      0x22, 'A',               // %c
+      0x23, 0x01, 0xff,        // %#hhx
+      0x23, 0x10, 0x08,        // %s
+      0x22, 0xff, 0x16, 0x08,  // %d
+      0x22, 0x00, 0x22, 0x00,  // channel and function
+      0x34, 0x05, 0x00, sizeof(kFormat),
+  };
+  bytecode.insert(bytecode.end(), kFormat, kFormat + sizeof(kFormat));
+  bytecode.push_back(0x27);
+
+  TestContext context;
+  AgentExpression expression(bytecode);
+  uint64_t value;
+  EXPECT_TRUE(expression.Evaluate(&context, &value));
+  EXPECT_EQ("-1 hi 0xff A 0x1000%\n", context.output);
+
+  // Too few arguments.
+  bytecode[20] = 0x06;
+  AgentExpression too_few(bytecode);
+  EXPECT_FALSE(too_few.Evaluate(&context, &value));
+
+  // A format string that isn't NUL-terminated.
+  bytecode[20] = 0x05;
+  bytecode[22] = sizeof(kFormat) - 1;
+  AgentExpression unterminated(bytecode);
+  EXPECT_FALSE(unterminated.Evaluate(&context, &value));
+}
+
+TEST(AgentExpressionTest, Trace) {
+  using Range = std::pair<uint64_t, size_t>;
+
+  // What gdb generates to collect "*(long*) $r1" and "(char*) 0x1008".
+  TestContext context;
+  AgentExpression expression({
+      0x26, 0x00, 0x01, 0x0d, 0x08, 0x29,  // reg 1, trace_quick 8, pop
+      0x23, 0x10, 0x08, 0x22, 0x10, 0x2f,  // const 0x1008, const 16, tracenz
+      0x23, 0x10, 0x00, 0x30, 0x01, 0x00,  // const 0x1000, trace16 0x100
+      0x22, 0x04, 0x0c,                    // const 4, trace
+      0x27,
+  });
+  uint64_t value;
+  EXPECT_TRUE(expression.Evaluate(&context, &value));
+  EXPECT_EQ((std::vector<Range>{Range(0x100, 8), Range(0x1008, 3),
+                                Range(0x1000, 0x100), Range(0x1000, 4)}),
+            context.collected);
+
+  // tracenz stops at the limit if it comes before the NUL.
+  context.collected.clear();
+  AgentExpression limited({0x23, 0x10, 0x08, 0x22, 0x01, 0x2f, 0x27});
+  EXPECT_TRUE(limited.Evaluate(&context, &value));
+  EXPECT_EQ((std::vector<Range>{Range(0x1008, 1)}), context.collected);
+
+  EXPECT_FALSE(Evaluate({0x22, 0x01, 0x0c, 0x27}, &value));
+  EXPECT_FALSE(Evaluate({0x22, 0x01, 0x30, 0x01}, &value));
+}
+
+}  // namespace
+}  // namespace util
+}  // namespace debugserver
@@ -0,0 +1,615 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "agent-expression.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <utility>
+
+#include "lib/ftl/logging.h"
+#include "lib/ftl/strings/string_number_conversions.h"
+#include "lib/ftl/strings/string_printf.h"
+
+#include "util.h"
+
+namespace debugserver {
+namespace util {
+
+namespace {
+
+// The opcodes, as defined by gdb's ax.def.
+enum Opcode : uint8_t {
+  kOpAdd = 0x02,
+  kOpSub = 0x03,
+  kOpMul = 0x04,
+  kOpDivSigned = 0x05,
+  kOpDivUnsigned = 0x06,
+  kOpRemSigned = 0x07,
+  kOpRemUnsigned = 0x08,
+  kOpLsh = 0x09,
+  kOpRshSigned = 0x0a,
+  kOpRshUnsigned = 0x0b,
+  kOpTrace = 0x0c,
+  kOpTraceQuick = 0x0d,
+  kOpLogNot = 0x0e,
+  kOpBitAnd = 0x0f,
+  kOpBitOr = 0x10,
+  kOpBitXor = 0x11,
+  kOpBitNot = 0x12,
+  kOpEqual = 0x13,
+  kOpLessSigned = 0x14,
+  kOpLessUnsigned = 0x15,
+  kOpExt = 0x16,
+  kOpRef8 = 0x17,
+  kOpRef16 = 0x18,
+  kOpRef32 = 0x19,
+  kOpRef64 = 0x1a,
+  kOpIfGoto = 0x20,
+  kOpGoto = 0x21,
+  kOpConst8 = 0x22,
+  kOpConst16 = 0x23,
+  kOpConst32 = 0x24,
+  kOpConst64 = 0x25,
+  kOpReg = 0x26,
+  kOpEnd = 0x27,
+  kOpDup = 0x28,
+  kOpPop = 0x29,
+  kOpZeroExt = 0x2a,
+  kOpSwap = 0x2b,
+  kOpTraceNz = 0x2f,
+  kOpTrace16 = 0x30,
+  kOpPick = 0x32,
+  kOpRot = 0x33,
+  kOpPrintf = 0x34,
+};
+
+// The longest string printed for a "%s" without a precision.
+constexpr size_t kMaxPrintfStringLength = 1024;
+
+// Applies the binary operator |op| to |a| and |b|, where |b| was on top of
+// the stack. Returns false if the operation is undefined.
+bool ApplyBinaryOp(uint8_t op, uint64_t a, uint64_t b, uint64_t* out_value) {
+  int64_t sa = static_cast<int64_t>(a);
+  int64_t sb = static_cast<int64_t>(b);
+  // The one signed division that overflows.
+  bool overflow = sa == std::numeric_limits<int64_t>::min() && sb == -1;
+
+  switch (op) {
+    case kOpAdd:
+      *out_value = a + b;
+      return true;
+    case kOpSub:
+      *out_value = a - b;
+      return true;
+    case kOpMul:
+      *out_value = a * b;
+      return true;
+    case kOpDivSigned:
+      if (b == 0)
+        return false;
+      *out_value = overflow ? a : static_cast<uint64_t>(sa / sb);
+      return true;
+    case kOpDivUnsigned:
+      if (b == 0)
+        return false;
+      *out_value = a / b;
+      return true;
+    case kOpRemSigned:
+      if (b == 0)
+        return false;
+      *out_value = overflow ? 0 : static_cast<uint64_t>(sa % sb);
+      return true;
+    case kOpRemUnsigned:
+      if (b == 0)
+        return false;
+      *out_value = a % b;
+      return true;
+    // Shifting by the width of the value or more is undefined in C++; give
+    // the result of shifting one bit at a time.
+    case kOpLsh:
+      *out_value = b < 64 ? a << b : 0;
+      return true;
+    case kOpRshSigned:
+      *out_value = static_cast<uint64_t>(b < 64 ? sa >> b : (sa < 0 ? -1 : 0));
+      return true;
+    case kOpRshUnsigned:
+      *out_value = b < 64 ? a >> b : 0;
+      return true;
+    case kOpBitAnd:
+      *out_value = a & b;
+      return true;
+    case kOpBitOr:
+      *out_value = a | b;
+      return true;
+    case kOpBitXor:
+      *out_value = a ^ b;
+      return true;
+    case kOpEqual:
+      *out_value = a == b;
+      return true;
+    case kOpLessSigned:
+      *out_value = sa < sb;
+      return true;
+    case kOpLessUnsigned:
+      *out_value = a < b;
+      return true;
+    default:
+      FTL_NOTREACHED();
+      return false;
+  }
+}
+
+// Returns |value| truncated to |size| bytes and sign- or zero-extended back.
+uint64_t TruncateValue(uint64_t value, size_t size, bool is_signed) {
+  if (size >= sizeof(value))
+    return value;
+  size_t shift = 64 - size * 8;
+  if (is_signed)
+    return static_cast<uint64_t>(static_cast<int64_t>(value << shift) >> shift);
+  return (value << shift) >> shift;
+}
+
+// Reads the NUL-terminated string at |address|, up to |max_length|
+// characters.
+bool ReadString(AgentExpression::Context* context,
+                uint64_t address,
+                size_t max_length,
+                std::string* out_string) {
+  // Read in small aligned chunks: they never cross into a page that may not
+  // be mapped, and short strings don't cost much.
+  constexpr size_t kChunkSize = 64;
+  out_string->clear();
+  while (out_string->size() < max_length) {
+    char chunk[kChunkSize];
+    size_t length = std::min(kChunkSize - address % kChunkSize,
+                             max_length - out_string->size());
+    if (!context->ReadMemory(address, chunk, length))
+      return false;
+    const char* nul = static_cast<const char*>(memchr(chunk, '\0', length));
+    if (nul) {
+      out_string->append(chunk, nul - chunk);
+      return true;
+    }
+    out_string->append(chunk, length);
+    address += length;
+  }
+  return true;
+}
+
+// Formats |args| according to |format|, the way gdb's "printf" does.
+// Supported are the integer, character, pointer and string conversions with
+// flags, a width and a precision. Length modifiers give the size of integer
+// arguments ("int" by default). The contents of strings are read through
+// |context|.
+bool FormatPrintf(AgentExpression::Context* context,
+                  const char* format,
+                  const uint64_t* args,
+                  size_t num_args,
+                  std::string* out_text) {
+  size_t next_arg = 0;
+  const char* p = format;
+  while (*p) {
+    if (*p != '%') {
+      out_text->push_back(*p++);
+      continue;
+    }
+    if (p[1] == '%') {
+      out_text->push_back('%');
+      p += 2;
+      continue;
+    }
+
+    // Flags, width and precision are passed on as is.
+    const char* spec_start = p++;
+    while (*p && strchr("-+ #0", *p))
+      ++p;
+    while (isdigit(*p))
+      ++p;
+    size_t precision = 0;
+    if (*p == '.') {
+      ++p;
+      while (isdigit(*p))
+        precision = precision * 10 + (*p++ - '0');
+    }
+    std::string spec(spec_start, p);
+
+    size_t size = sizeof(int);
+    if (*p == 'h') {
+      size = sizeof(short);
+      if (*++p == 'h') {
+        size = sizeof(char);
+        ++p;
+      }
+    } else if (*p == 'l') {
+      size = sizeof(long);
+      if (*++p == 'l') {
+        size = sizeof(long long);
+        ++p;
+      }
+    } else if (*p == 'z' || *p == 'j' || *p == 't') {
+      size = sizeof(uint64_t);
+      ++p;
+    }
+
+    char conversion = *p;
+    if (!conversion || !strchr("diuxXocps", conversion)) {
+      FTL_LOG(ERROR) << "Unsupported printf conversion in: " << format;
+      return false;
+    }
+    ++p;
+    if (next_arg == num_args) {
+      FTL_LOG(ERROR) << "Too few printf arguments for: " << format;
+      return false;
+    }
+    uint64_t arg = args[next_arg++];
+
+    switch (conversion) {
+      case 'd':
+      case 'i':
+        spec += "lld";
+        *out_text += ftl::StringPrintf(
+            spec.c_str(),
+            static_cast<long long>(TruncateValue(arg, size, true)));
+        break;
+      case 'u':
+      case 'x':
+      case 'X':
+      case 'o':
+        spec += "ll";
+        spec.push_back(conversion);
+        *out_text += ftl::StringPrintf(
+            spec.c_str(),
+            static_cast<unsigned long long>(TruncateValue(arg, size, false)));
+        break;
+      case 'c':
+        spec += "c";
+        *out_text += ftl::StringPrintf(spec.c_str(),
+                                       static_cast<int>(arg & 0xff));
+        break;
+      case 'p':
+        spec += "llx";
+        *out_text += "0x";
+        *out_text += ftl::StringPrintf(spec.c_str(),
+                                       static_cast<unsigned long long>(arg));
+        break;
+      case 's': {
+        std::string string;
+        if (!ReadString(context, arg,
+                        precision ? precision : kMaxPrintfStringLength,
+                        &string)) {
+          FTL_LOG(ERROR) << "Unreadable printf string argument";
+          return false;
+        }
+        spec += "s";
+        *out_text += ftl::StringPrintf(spec.c_str(), string.c_str());
+        break;
+      }
+    }
+  }
+
+  return true;
+}
+
+}  // namespace
+
+constexpr size_t AgentExpression::kMaxStackDepth;
+constexpr size_t AgentExpression::kMaxSteps;
+
+AgentExpression::AgentExpression(std::vector<uint8_t> bytecode)
+    : bytecode_(std::move(bytecode)) {}
+
+// static
+std::unique_ptr<AgentExpression> AgentExpression::Decode(
+    const ftl::StringView& text,
+    size_t* out_size) {
+  FTL_DCHECK(out_size);
+
+  size_t comma = text.find(',');
+  if (comma == ftl::StringView::npos) {
+    FTL_LOG(ERROR) << "Malformed agent expression: " << text;
+    return nullptr;
+  }
+
+  size_t length;
+  if (!ftl::StringToNumberWithError<size_t>(text.substr(0, comma), &length,
+                                            ftl::Base::k16) ||
+      length == 0 || length > (text.size() - comma - 1) / 2) {
+    FTL_LOG(ERROR) << "Malformed agent expression length: " << text;
+    return nullptr;
+  }
+
+  std::vector<uint8_t> bytecode =
+      DecodeByteArrayString(text.substr(comma + 1, length * 2));
+  if (bytecode.size() != length) {
+    FTL_LOG(ERROR) << "Malformed agent expression bytecode: " << text;
+    return nullptr;
+  }
+
+  *out_size = comma + 1 + length * 2;
+  return std::unique_ptr<AgentExpression>(
+      new AgentExpression(std::move(bytecode)));
+}
+
+bool AgentExpression::Evaluate(Context* context, uint64_t* out_value) const {
+  FTL_DCHECK(context);
+  FTL_DCHECK(out_value);
+
+  uint64_t stack[kMaxStackDepth];
+  size_t depth = 0;
+  size_t pc = 0;
+  const size_t size = bytecode_.size();
+
+  auto error = [&pc](const char* what) {
+    FTL_LOG(ERROR) << ftl::StringPrintf(
+        "Agent expression failed at offset %zu: %s", pc, what);
+    return false;
+  };
+
+  // Fetches the |num_bytes| big-endian immediate operand following the
+  // opcode.
+  auto fetch = [this, &pc, size](size_t num_bytes, uint64_t* out_operand) {
+    if (size - pc < num_bytes)
+      return false;
+    uint64_t operand = 0;
+    for (size_t i = 0; i < num_bytes; ++i)
+      operand = (operand << 8) | bytecode_[pc++];
+    *out_operand = operand;
+    return true;
+  };
+
+  for (size_t step = 0; step < kMaxSteps; ++step) {
+    if (pc >= size)
+      return error("ran off the end");
+
+    uint8_t op = bytecode_[pc++];
+    uint64_t operand;
+    switch (op) {
+      case kOpAdd:
+      case kOpSub:
+      case kOpMul:
+      case kOpDivSigned:
+      case kOpDivUnsigned:
+      case kOpRemSigned:
+      case kOpRemUnsigned:
+      case kOpLsh:
+      case kOpRshSigned:
+      case kOpRshUnsigned:
+      case kOpBitAnd:
+      case kOpBitOr:
+      case kOpBitXor:
+      case kOpEqual:
+      case kOpLessSigned:
+      case kOpLessUnsigned:
+        if (depth < 2)
+          return error("stack underflow");
+        --depth;
+        if (!ApplyBinaryOp(op, stack[depth - 1], stack[depth],
+                           &stack[depth - 1]))
+          return error("division by zero");
+        break;
+
+      case kOpLogNot:
+        if (depth < 1)
+          return error("stack underflow");
+        stack[depth - 1] = !stack[depth - 1];
+        break;
+
+      case kOpBitNot:
+        if (depth < 1)
+          return error("stack underflow");
+        stack[depth - 1] = ~stack[depth - 1];
+        break;
+
+      case kOpExt:
+      case kOpZeroExt:
+        if (!fetch(1, &operand) || operand == 0 || operand > 64)
+          return error("bad extension width");
+        if (depth < 1)
+          return error("stack underflow");
+        if (operand < 64) {
+          uint64_t shift = 64 - operand;
+          if (op == kOpExt) {
+            stack[depth - 1] = static_cast<uint64_t>(
+                static_cast<int64_t>(stack[depth - 1] << shift) >> shift);
+          } else {
+            stack[depth - 1] &= (uint64_t{1} << operand) - 1;
+          }
+        }
+        break;
+
+      case kOpRef8:
+      case kOpRef16:
+      case kOpRef32:
+      case kOpRef64: {
+        if (depth < 1)
+          return error("stack underflow");
+        // The values are zero-extended; gdb follows up with an "ext" for
+        // signed types.
+        size_t length = size_t{1} << (op - kOpRef8);
+        uint8_t bytes[sizeof(uint64_t)] = {};
+        if (!context->ReadMemory(stack[depth - 1], bytes, length))
+          return error("unreadable memory");
+        uint64_t value = 0;
+        // The inferior's byte order is ours.
+        switch (length) {
+          case 1:
+            value = bytes[0];
+            break;
+          case 2: {
+            uint16_t value16;
+            memcpy(&value16, bytes, sizeof(value16));
+            value = value16;
+            break;
+          }
+          case 4: {
+            uint32_t value32;
+            memcpy(&value32, bytes, sizeof(value32));
+            value = value32;
+            break;
+          }
+          default:
+            memcpy(&value, bytes, sizeof(value));
+            break;
+        }
+        stack[depth - 1] = value;
+        break;
+      }
+
+      case kOpIfGoto:
+      case kOpGoto:
+        // The target is an offset from the start of the expression.
+        if (!fetch(2, &operand))
+          return error("truncated instruction");
+        if (op == kOpIfGoto) {
+          if (depth < 1)
+            return error("stack underflow");
+          if (!stack[--depth])
+            break;
+        }
+        pc = operand;
+        break;
+
+      case kOpConst8:
+      case kOpConst16:
+      case kOpConst32:
+      case kOpConst64:
+        if (!fetch(size_t{1} << (op - kOpConst8), &operand))
+          return error("truncated instruction");
+        if (depth == kMaxStackDepth)
+          return error("stack overflow");
+        stack[depth++] = operand;
+        break;
+
+      case kOpReg: {
+        if (!fetch(2, &operand))
+          return error("truncated instruction");
+        if (depth == kMaxStackDepth)
+          return error("stack overflow");
+        uint64_t value;
+        if (!context->GetRegister(static_cast<int>(operand), &value))
+          return error("unavailable register");
+        stack[depth++] = value;
+        break;
+      }
+
+      case kOpEnd:
+        // Commands such as printf may leave nothing on the stack.
+        *out_value = depth ? stack[depth - 1] : 0;
+        return true;
+
+      case kOpDup:
+        if (depth < 1)
+          return error("stack underflow");
+        if (depth == kMaxStackDepth)
+          return error("stack overflow");
+        stack[depth] = stack[depth - 1];
+        ++depth;
+        break;
+
+      case kOpPop:
+        if (depth < 1)
+          return error("stack underflow");
+        --depth;
+        break;
+
+      case kOpSwap:
+        if (depth < 2)
+          return error("stack underflow");
+        std::swap(stack[depth - 1], stack[depth - 2]);
+        break;
+
+      case kOpPick:
+        // Pushes a copy of the value |operand| items below the top.
+        if (!fetch(1, &operand))
+          return error("truncated instruction");
+        if (depth <= operand)
+          return error("stack underflow");
+        if (depth == kMaxStackDepth)
+          return error("stack overflow");
+        stack[depth] = stack[depth - 1 - operand];
+        ++depth;
+        break;
+
+      case kOpRot: {
+        // a b c => c a b
+        if (depth < 3)
+          return error("stack underflow");
+        uint64_t c = stack[depth - 1];
+        stack[depth - 1] = stack[depth - 2];
+        stack[depth - 2] = stack[depth - 3];
+        stack[depth - 3] = c;
+        break;
+      }
+
+      case kOpTrace:
+      case kOpTraceNz: {
+        // addr size => (the memory is recorded in the trace frame)
+        if (depth < 2)
+          return error("stack underflow");
+        uint64_t address = stack[depth - 2];
+        uint64_t length = stack[depth - 1];
+        depth -= 2;
+        if (op == kOpTraceNz) {
+          // Up to and including the first NUL.
+          std::string string;
+          if (!ReadString(context, address, length, &string))
+            return error("unreadable memory");
+          length = std::min<uint64_t>(length, string.size() + 1);
+        }
+        if (!context->CollectMemory(address, length))
+          return error("unable to collect memory");
+        break;
+      }
+
+      case kOpTraceQuick:
+      case kOpTrace16:
+        // addr => addr
+        if (!fetch(op == kOpTraceQuick ? 1 : 2, &operand))
+          return error("truncated instruction");
+        if (depth < 1)
+          return error("stack underflow");
+        if (!context->CollectMemory(stack[depth - 1], operand))
+          return error("unable to collect memory");
+        break;
+
+      case kOpPrintf: {
+        // printf NARGS LEN FORMAT: the function and channel are on top of
+        // the stack (and are ignored), followed by the arguments, first
+        // argument on top. FORMAT is LEN bytes including the terminating
+        // NUL.
+        uint64_t num_args;
+        if (!fetch(1, &num_args) || !fetch(2, &operand) || operand == 0 ||
+            size - pc < operand || bytecode_[pc + operand - 1] != '\0')
+          return error("bad printf format");
+        const char* format = reinterpret_cast<const char*>(&bytecode_[pc]);
+        pc += operand;
+        if (depth < num_args + 2)
+          return error("stack underflow");
+        depth -= 2;
+        uint64_t args[kMaxStackDepth];
+        for (size_t i = 0; i < num_args; ++i)
+          args[i] = stack[--depth];
+        std::string text;
+        if (!FormatPrintf(context, format, args, num_args, &text))
+          return error("printf failed");
+        context->WriteOutput(text);
+        break;
+      }
+
+      default:
+        --pc;
+        return error(
+            ftl::StringPrintf("unsupported opcode 0x%02x", op).c_str());
+    }
+  }
+
+  return error("too many steps");
+}
+
+}  // namespace util
+}  // namespace debugserver
@@ -0,0 +1,83 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "lib/ftl/macros.h"
+#include "lib/ftl/strings/string_view.h"
+
+namespace debugserver {
+namespace util {
+
+// A GDB agent expression: the bytecode gdb compiles breakpoint conditions
+// and the like into so that they can be evaluated in the stub, without a
+// round trip to the debugger for every hit. See "Agent Expressions" in the gdb
+// manual for the instruction set.
+//
+// Evaluation is on a stack of 64-bit values. Floating point and trace state
+// variables aren't supported; expressions that use them (or floating point
+// printf conversions) fail to evaluate.
+class AgentExpression final {
+ public:
+  // Access to the state of the stopped thread an expression is evaluated in.
+  class Context {
+   public:
+    virtual ~Context() = default;
+
+    // Returns the value of gdb register number |regno| in |*out_value|.
+    virtual bool GetRegister(int regno, uint64_t* out_value) = 0;
+
+    // Reads |length| bytes of the inferior's memory at |address|.
+    virtual bool ReadMemory(uint64_t address,
+                            void* out_buffer,
+                            size_t length) = 0;
+
+    // Receives the output of the printf instruction, as used by gdb's
+    // dprintf when dprintf-style is "agent".
+    virtual void WriteOutput(const ftl::StringView& text) = 0;
+
+    // Records |length| bytes of memory at |address| in the trace frame being
+    // collected, as the trace instructions of tracepoint actions do.
+    // Outside of tracepoints there's no frame and this does nothing.
+    virtual bool CollectMemory(uint64_t address, size_t length) = 0;
+  };
+
+  // The most values that may be on the stack at once.
+  static constexpr size_t kMaxStackDepth = 128;
+
+  // The most instructions an evaluation may execute. This bounds the time a
+  // thread is held up by an expression that loops.
+  static constexpr size_t kMaxSteps = 100000;
+
+  explicit AgentExpression(std::vector<uint8_t> bytecode);
+
+  // Decodes an expression at the start of |text| in the form gdb sends them
+  // in packets: "LEN,BYTES", with LEN the size of the bytecode and BYTES the
+  // bytecode itself, both in hex. On success the number of characters of
+  // |text| that were used is returned in |*out_size|.
+  // Returns nullptr if |text| is malformed.
+  static std::unique_ptr<AgentExpression> Decode(const ftl::StringView& text,
+                                                 size_t* out_size);
+
+  // Runs the expression and returns the value it leaves on top of the stack
+  // (or zero if the stack is empty) in |*out_value|. Returns false if the
+  // expression is invalid or fails, e.g., because it reads unreadable memory
+  // or divides by zero.
+  bool Evaluate(Context* context, uint64_t* out_value) const;
+
+  const std::vector<uint8_t>& bytecode() const { return bytecode_; }
+
+ private:
+  std::vector<uint8_t> bytecode_;
+
+  FTL_DISALLOW_COPY_AND_ASSIGN(AgentExpression);
+};
+
+}  // namespace util
+}  // namespace debugserver
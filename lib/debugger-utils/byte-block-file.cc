@@ -54,6 +54,39 @@ bool FileByteBlock::Read(uintptr_t address, void* out_buffer,
   return true;
 }
 
+bool FileByteBlock::ReadV(const ReadRange* ranges, size_t num_ranges) const {
+  // Nearby ranges (e.g., an ELF header and the program headers that follow
+  // it) are read together, saving both the seek and the read.
+  constexpr size_t kMaxGap = 4096;
+  constexpr size_t kMaxReadSize = 64 * 1024;
+  return ReadVCombined(ranges, num_ranges, kMaxGap, kMaxReadSize,
+                       [this](uintptr_t address, void* out_buffer,
+                              size_t length) {
+                         return PRead(address, out_buffer, length);
+                       });
+}
+
+bool FileByteBlock::PRead(uintptr_t address, void* out_buffer,
+                          size_t length) const {
+  FTL_DCHECK(out_buffer);
+
+  ssize_t bytes_read = pread(fd_, out_buffer, length, address);
+  if (bytes_read < 0) {
+    FTL_LOG(ERROR) <<
+      ftl::StringPrintf("Failed to read file at offset: 0x%" PRIxPTR, address)
+                   << ", " << util::ErrnoString(errno);
+    return false;
+  }
+
+  if (length != static_cast<size_t>(bytes_read)) {
+    FTL_LOG(ERROR) << ftl::StringPrintf("Short read, got %zd bytes, expected %zu",
+                                        bytes_read, length);
+    return false;
+  }
+
+  return true;
+}
+
 bool FileByteBlock::Write(uintptr_t address, const void* buffer,
                           size_t length) const {
   FTL_DCHECK(buffer);
@@ -22,8 +22,12 @@ class FileByteBlock final : public util::ByteBlock {
     const override;
   bool Write(uintptr_t address, const void* buffer, size_t length)
     const override;
+  bool ReadV(const ReadRange* ranges, size_t num_ranges) const override;
 
  private:
+  // Same as Read() but doesn't move the file offset.
+  bool PRead(uintptr_t address, void* out_buffer, size_t length) const;
+
   int fd_;
 
   FTL_DISALLOW_COPY_AND_ASSIGN(FileByteBlock);
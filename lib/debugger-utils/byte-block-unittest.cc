@@ -0,0 +1,144 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "byte-block.h"
+
+#include <utility>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace debugserver {
+namespace util {
+namespace {
+
+// Memory at [kBase, kBase + kSize) holding the low byte of each address,
+// except for an unreadable hole at [kHole, kHole + kHoleSize).
+class TestByteBlock final : public ByteBlock {
+ public:
+  static constexpr uintptr_t kBase = 0x1000;
+  static constexpr size_t kSize = 0x1000;
+  static constexpr uintptr_t kHole = 0x1800;
+  static constexpr size_t kHoleSize = 0x10;
+
+  explicit TestByteBlock(bool combine) : combine_(combine) {}
+
+  bool Read(uintptr_t address, void* out_buffer, size_t length)
+      const override {
+    reads.push_back(std::make_pair(address, length));
+    if (address < kBase || address + length > kBase + kSize)
+      return false;
+    if (address < kHole + kHoleSize && address + length > kHole)
+      return false;
+    uint8_t* out = static_cast<uint8_t*>(out_buffer);
+    for (size_t i = 0; i < length; ++i)
+      out[i] = static_cast<uint8_t>(address + i);
+    return true;
+  }
+
+  bool Write(uintptr_t address, const void* buffer, size_t length)
+      const override {
+    return false;
+  }
+
+  bool ReadV(const ReadRange* ranges, size_t num_ranges) const override {
+    if (!combine_)
+      return ByteBlock::ReadV(ranges, num_ranges);
+    return ReadVCombined(ranges, num_ranges, 0x100, 0x400,
+                         [this](uintptr_t address, void* out_buffer,
+                                size_t length) {
+                           return Read(address, out_buffer, length);
+                         });
+  }
+
+  mutable std::vector<std::pair<uintptr_t, size_t>> reads;
+
+ private:
+  bool combine_;
+};
+
+constexpr uintptr_t TestByteBlock::kBase;
+constexpr size_t TestByteBlock::kSize;
+constexpr uintptr_t TestByteBlock::kHole;
+constexpr size_t TestByteBlock::kHoleSize;
+
+void ExpectContents(uintptr_t address, const uint8_t* buffer, size_t length) {
+  for (size_t i = 0; i < length; ++i)
+    EXPECT_EQ(static_cast<uint8_t>(address + i), buffer[i]) << address + i;
+}
+
+TEST(ByteBlockTest, DefaultReadV) {
+  TestByteBlock block(false);
+  uint8_t a[4], b[8];
+  const ByteBlock::ReadRange ranges[] = {
+      {0x1100, a, sizeof(a)}, {0x1010, b, sizeof(b)},
+  };
+  EXPECT_TRUE(block.ReadV(ranges, 2));
+  EXPECT_EQ(2u, block.reads.size());
+  ExpectContents(0x1100, a, sizeof(a));
+  ExpectContents(0x1010, b, sizeof(b));
+}
+
+TEST(ByteBlockTest, ReadVCombined) {
+  TestByteBlock block(true);
+  uint8_t a[4], b[8], c[16], d[2];
+  const ByteBlock::ReadRange ranges[] = {
+      // Out of order, within |max_gap| of each other.
+      {0x1100, a, sizeof(a)},
+      {0x1010, b, sizeof(b)},
+      // Overlapping |a|.
+      {0x1102, c, sizeof(c)},
+      // Too far away.
+      {0x1f00, d, sizeof(d)},
+  };
+  EXPECT_TRUE(block.ReadV(ranges, 4));
+  ASSERT_EQ(2u, block.reads.size());
+  EXPECT_EQ(0x1010u, block.reads[0].first);
+  EXPECT_EQ(0x1112u - 0x1010u, block.reads[0].second);
+  EXPECT_EQ(0x1f00u, block.reads[1].first);
+  ExpectContents(0x1100, a, sizeof(a));
+  ExpectContents(0x1010, b, sizeof(b));
+  ExpectContents(0x1102, c, sizeof(c));
+  ExpectContents(0x1f00, d, sizeof(d));
+}
+
+TEST(ByteBlockTest, ReadVCombinedLimits) {
+  TestByteBlock block(true);
+  uint8_t a[0x300], b[0x300];
+  const ByteBlock::ReadRange ranges[] = {
+      {0x1000, a, sizeof(a)}, {0x1300, b, sizeof(b)},
+  };
+  // Together they exceed |max_read_size|.
+  EXPECT_TRUE(block.ReadV(ranges, 2));
+  EXPECT_EQ(2u, block.reads.size());
+  ExpectContents(0x1000, a, sizeof(a));
+  ExpectContents(0x1300, b, sizeof(b));
+}
+
+TEST(ByteBlockTest, ReadVCombinedHole) {
+  TestByteBlock block(true);
+  uint8_t a[4], b[4];
+  const ByteBlock::ReadRange ranges[] = {
+      {TestByteBlock::kHole - 4, a, sizeof(a)},
+      {TestByteBlock::kHole + TestByteBlock::kHoleSize, b, sizeof(b)},
+  };
+  // The combined read fails because of the hole; the ranges on their own
+  // are fine.
+  EXPECT_TRUE(block.ReadV(ranges, 2));
+  EXPECT_EQ(3u, block.reads.size());
+  ExpectContents(TestByteBlock::kHole - 4, a, sizeof(a));
+  ExpectContents(TestByteBlock::kHole + TestByteBlock::kHoleSize, b,
+                 sizeof(b));
+
+  uint8_t c[4];
+  const ByteBlock::ReadRange bad_ranges[] = {
+      {TestByteBlock::kHole - 4, a, sizeof(a)},
+      {TestByteBlock::kHole, c, sizeof(c)},
+  };
+  EXPECT_FALSE(block.ReadV(bad_ranges, 2));
+}
+
+}  // namespace
+}  // namespace util
+}  // namespace debugserver
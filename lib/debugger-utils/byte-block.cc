@@ -0,0 +1,90 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "byte-block.h"
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "lib/ftl/logging.h"
+
+namespace debugserver {
+namespace util {
+
+bool ByteBlock::ReadV(const ReadRange* ranges, size_t num_ranges) const {
+  FTL_DCHECK(ranges || num_ranges == 0);
+
+  for (size_t i = 0; i < num_ranges; ++i) {
+    if (!Read(ranges[i].address, ranges[i].out_buffer, ranges[i].length))
+      return false;
+  }
+  return true;
+}
+
+// static
+bool ByteBlock::ReadVCombined(const ReadRange* ranges,
+                              size_t num_ranges,
+                              size_t max_gap,
+                              size_t max_read_size,
+                              const ReadFunction& read) {
+  FTL_DCHECK(ranges || num_ranges == 0);
+
+  std::vector<const ReadRange*> sorted;
+  sorted.reserve(num_ranges);
+  for (size_t i = 0; i < num_ranges; ++i) {
+    if (ranges[i].length > 0)
+      sorted.push_back(&ranges[i]);
+  }
+  std::sort(sorted.begin(), sorted.end(),
+            [](const ReadRange* a, const ReadRange* b) {
+              return a->address < b->address;
+            });
+
+  size_t i = 0;
+  while (i < sorted.size()) {
+    // Gather the ranges that can be read together with |sorted[i]|.
+    // |end| is exclusive.
+    uintptr_t start = sorted[i]->address;
+    uintptr_t end = start + sorted[i]->length;
+    size_t j = i + 1;
+    for (; j < sorted.size(); ++j) {
+      const ReadRange* range = sorted[j];
+      uintptr_t range_end = range->address + range->length;
+      if (range->address > end && range->address - end > max_gap)
+        break;
+      if (std::max(end, range_end) - start > max_read_size)
+        break;
+      end = std::max(end, range_end);
+    }
+
+    if (j == i + 1) {
+      if (!read(sorted[i]->address, sorted[i]->out_buffer, sorted[i]->length))
+        return false;
+    } else {
+      std::unique_ptr<uint8_t[]> buffer(new uint8_t[end - start]);
+      if (read(start, buffer.get(), end - start)) {
+        for (size_t k = i; k < j; ++k) {
+          memcpy(sorted[k]->out_buffer,
+                 buffer.get() + (sorted[k]->address - start),
+                 sorted[k]->length);
+        }
+      } else {
+        for (size_t k = i; k < j; ++k) {
+          if (!read(sorted[k]->address, sorted[k]->out_buffer,
+                    sorted[k]->length))
+            return false;
+        }
+      }
+    }
+
+    i = j;
+  }
+
+  return true;
+}
+
+}  // namespace util
+}  // namespace debugserver
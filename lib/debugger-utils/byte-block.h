@@ -6,6 +6,7 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <functional>
 
 #include "lib/ftl/macros.h"
 
@@ -27,6 +28,20 @@ class ByteBlock {
                     void* out_buffer,
                     size_t length) const = 0;
 
+  // One range of a ReadV() request.
+  struct ReadRange {
+    uintptr_t address;
+    void* out_buffer;
+    size_t length;
+  };
+
+  // Reads each of the |num_ranges| ranges in |ranges|, in no particular
+  // order. Implementations combine them into as few reads of the underlying
+  // object as they can. The default implementation calls Read() for each.
+  // Returns true if every range was read. If false is returned the contents
+  // of the output buffers are unspecified.
+  virtual bool ReadV(const ReadRange* ranges, size_t num_ranges) const;
+
   // Writes the block of memory of length |length| bytes from |buffer| to the
   // memory address |address| of this process.
   // Returns true on success or false on failure.
@@ -37,6 +52,19 @@ class ByteBlock {
  protected:
   ByteBlock() = default;
 
+  // A helper for implementing ReadV() when the underlying object can only
+  // read one contiguous range at a time, via |read|. Ranges separated by at
+  // most |max_gap| bytes are read together, up to |max_read_size| bytes at
+  // a time. If a combined read fails (e.g., because the gap isn't readable)
+  // its ranges are read individually.
+  using ReadFunction =
+      std::function<bool(uintptr_t address, void* out_buffer, size_t length)>;
+  static bool ReadVCombined(const ReadRange* ranges,
+                            size_t num_ranges,
+                            size_t max_gap,
+                            size_t max_read_size,
+                            const ReadFunction& read);
+
  private:
   FTL_DISALLOW_COPY_AND_ASSIGN(ByteBlock);
 };
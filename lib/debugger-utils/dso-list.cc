@@ -2,17 +2,21 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
-// TODO: Taken from crashlogger. Revisit.
-
 #include <fcntl.h>
 #include <link.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <cinttypes>
+#include <cstddef>
+#include <string>
+
 #include <magenta/types.h>
 #include <magenta/syscalls.h>
 
+#include "lib/ftl/arraysize.h"
 #include "lib/ftl/logging.h"
 #include "lib/ftl/strings/string_printf.h"
 
@@ -25,166 +29,266 @@ namespace util {
 const char kDebugDirectory[] = "/boot/debug";
 const char kDebugSuffix[] = ".debug";
 
-static dsoinfo_t* dsolist_add(dsoinfo_t** list,
-                              const char* name,
-                              uintptr_t base) {
-  if (!strcmp(name, "libc.so")) {
-    name = "libmusl.so";
-  }
-  size_t len = strlen(name);
-  size_t alloc_bytes = sizeof(dsoinfo_t) + len + 1;
-  auto dso = reinterpret_cast<dsoinfo_t*>(calloc(1, alloc_bytes));
-  if (dso == nullptr) {
-    FTL_LOG(FATAL) << "OOM allocating " << alloc_bytes << " bytes";
-    exit(1);
-  }
-  memcpy(dso->name, name, len + 1);
-  memset(dso->buildid, 'x', sizeof(dso->buildid) - 1);
-  dso->base = base;
-  dso->debug_file_tried = false;
-  dso->debug_file_status = ERR_BAD_STATE;
-  while (*list != nullptr) {
-    if ((*list)->base < dso->base) {
-      dso->next = *list;
-      *list = dso;
-      return dso;
-    }
-    list = &((*list)->next);
-  }
-  *list = dso;
-  dso->next = nullptr;
+constexpr size_t kPageSize = 4096;
+
+// Names are kept in full, up to this size including the terminating NUL.
+constexpr size_t kMaxNameSize = 4096;
+
+// How much of a name to read speculatively along with the ELF header.
+constexpr size_t kNameChunkSize = 64;
+
+namespace {
+
+// Returns a new entry for |name| at |base|, with no ELF information yet.
+DsoInfo MakeDsoInfo(const char* name, mx_vaddr_t base) {
+  DsoInfo dso;
+  memset(&dso, 0, sizeof(dso));
+  dso.name = name;
+  memset(dso.buildid, 'x', sizeof(dso.buildid) - 1);
+  dso.base = base;
+  dso.debug_file_tried = false;
+  dso.debug_file_status = ERR_BAD_STATE;
   return dso;
 }
 
-dsoinfo_t* dso_fetch_list(std::shared_ptr<ByteBlock> bb, mx_vaddr_t lmap_addr,
-                          const char* name) {
-  dsoinfo_t* dsolist = nullptr;
+}  // namespace
+
+void* DsoList::Arena::Allocate(size_t size) {
+  constexpr size_t kAlignment = alignof(std::max_align_t);
+  size = (size + kAlignment - 1) & ~(kAlignment - 1);
+
+  if (size > remaining_) {
+    // Oversized requests get a block of their own.
+    size_t block_size = std::max(size, kBlockSize);
+    blocks_.emplace_back(new char[block_size]);
+    next_ = blocks_.back().get();
+    remaining_ = block_size;
+  }
+
+  void* result = next_;
+  next_ += size;
+  remaining_ -= size;
+  return result;
+}
+
+const char* DsoList::Arena::CopyString(const char* str) {
+  size_t size = strlen(str) + 1;
+  char* result = static_cast<char*>(Allocate(size));
+  memcpy(result, str, size);
+  return result;
+}
+
+// static
+std::unique_ptr<DsoList> DsoList::Fetch(std::shared_ptr<ByteBlock> bb,
+                                        mx_vaddr_t lmap_addr,
+                                        const char* name) {
+  std::unique_ptr<DsoList> list(new DsoList());
+  list->Update(bb, lmap_addr, name);
+  if (list->dsos_.empty())
+    return nullptr;
+  return list;
+}
+
+bool DsoList::Update(const std::shared_ptr<ByteBlock>& bb,
+                     mx_vaddr_t lmap_addr,
+                     const char* name) {
+  std::vector<DsoInfo> dsos;
+  size_t num_kept = 0;
   // The first dso we see is the main executable.
   bool is_main_exec = true;
+  uint32_t lmap_index = 0;
 
   while (lmap_addr != 0) {
-    char dsoname[64];
     struct link_map lmap;
 
     // If there's a failure here, say because the internal data structures got
-    // corrupted, just bail and return what we've collected so far.
+    // corrupted, there's no following the chain any further: just bail and
+    // return what we've collected so far.
 
     if (!bb->Read(lmap_addr, &lmap, sizeof(lmap)))
       break;
-    if (!ReadString(*bb, reinterpret_cast<mx_vaddr_t>(lmap.l_name), dsoname,
-                    sizeof(dsoname)))
-      break;
-
-    const char* file_name = dsoname[0] ? dsoname : name;
-    dsoinfo_t* dso = dsolist_add(&dsolist, file_name, lmap.l_addr);
-
-    std::unique_ptr<elf::Reader> elf_reader;
-    elf::Error rc = elf::Reader::Create(file_name, bb, 0, dso->base,
-                                        &elf_reader);
-    if (rc != elf::Error::OK) {
-      FTL_LOG(ERROR) << "Unable to read ELF file: " << elf::ErrorName(rc);
-      break;
-    }
 
-    auto hdr = elf_reader->header();
-    rc = elf_reader->ReadSegmentHeaders();
-    if (rc != elf::Error::OK) {
-      FTL_LOG(ERROR) << "Error reading ELF segment headers: "
-                     << elf::ErrorName(rc);
+    // A module that can't be read is left out, the ones after it can still
+    // be found.
+    const DsoInfo* known = Find(lmap_addr, lmap.l_addr);
+    if (known) {
+      dsos.push_back(*known);
+      dsos.back().lmap_index = lmap_index;
+      ++num_kept;
+    } else if (ReadDso(bb, lmap_addr, lmap, name, is_main_exec, &dsos)) {
+      dsos.back().lmap_index = lmap_index;
     } else {
-      size_t num_segments = elf_reader->GetNumSegments();
-      uint32_t num_loadable_phdrs = 0;
-      for (size_t i = 0; i < num_segments; ++i) {
-        const elf::SegmentHeader& phdr = elf_reader->GetSegmentHeader(i);
-        if (phdr.p_type == PT_LOAD)
-          ++num_loadable_phdrs;
-      }
-      // malloc may, or may not, return NULL for a zero byte request.
-      // Remove the ambiguity for consumers and always use NULL if there no
-      // loadable phdrs.
-      elf::SegmentHeader* loadable_phdrs = NULL;
-      if (num_loadable_phdrs > 0) {
-        loadable_phdrs =
-          reinterpret_cast<elf::SegmentHeader*>(malloc(num_loadable_phdrs *
-                                                       hdr.e_phentsize));
-      }
-      if (loadable_phdrs || num_loadable_phdrs == 0) {
-        size_t j = 0;
-        for (size_t i = 0; i < num_segments; ++i) {
-          const elf::SegmentHeader& phdr = elf_reader->GetSegmentHeader(i);
-          if (phdr.p_type == PT_LOAD)
-            loadable_phdrs[j++] = phdr;
-        }
-        FTL_DCHECK(j == num_loadable_phdrs);
-        dso->num_loadable_phdrs = num_loadable_phdrs;
-        dso->loadable_phdrs = loadable_phdrs;
-      } else {
-        FTL_LOG(ERROR) << "OOM reading phdrs";
-      }
-    }
-
-    rc = elf_reader->ReadBuildId(dso->buildid, sizeof(dso->buildid));
-    if (rc != elf::Error::OK) {
-      // This isn't fatal so don't flag as an error.
-      FTL_VLOG(1) << "Unable to read build id: " << elf::ErrorName(rc);
+      FTL_LOG(ERROR) << ftl::StringPrintf(
+          "Skipping dso with link_map entry at 0x%" PRIxPTR, lmap_addr);
     }
 
-    dso->is_main_exec = is_main_exec;
-    dso->entry = dso->base + hdr.e_entry;
-    dso->phdr = dso->base + hdr.e_phoff;
-    dso->phentsize = hdr.e_phentsize;
-    dso->phnum = hdr.e_phnum;
-
     is_main_exec = false;
+    ++lmap_index;
     lmap_addr = reinterpret_cast<mx_vaddr_t>(lmap.l_next);
   }
 
-  return dsolist;
+  std::sort(dsos.begin(), dsos.end(),
+            [](const DsoInfo& a, const DsoInfo& b) { return a.base < b.base; });
+
+  // Storage in |arena_| for modules that have gone away isn't reclaimed,
+  // but it's small and unloading is rare.
+  bool changed = num_kept != dsos_.size() || dsos.size() != dsos_.size();
+  dsos_ = std::move(dsos);
+  dsos_.shrink_to_fit();
+  return changed;
 }
 
-void dso_free_list(dsoinfo_t* list) {
-  while (list != nullptr) {
-    dsoinfo_t* next = list->next;
-    free(list->loadable_phdrs);
-    free(list->debug_file);
-    free(list);
-    list = next;
+const DsoInfo* DsoList::Find(mx_vaddr_t lmap, mx_vaddr_t base) const {
+  auto iter = std::lower_bound(
+      dsos_.begin(), dsos_.end(), base,
+      [](const DsoInfo& dso, mx_vaddr_t base) { return dso.base < base; });
+  for (; iter != dsos_.end() && iter->base == base; ++iter) {
+    if (iter->lmap == lmap)
+      return &*iter;
   }
+
+  return nullptr;
 }
 
-dsoinfo_t* dso_lookup(dsoinfo_t* dso_list, mx_vaddr_t pc) {
-  for (auto dso = dso_list; dso != nullptr; dso = dso->next) {
-    if (pc >= dso->base)
-      return dso;
+bool DsoList::ReadDso(const std::shared_ptr<ByteBlock>& bb,
+                      mx_vaddr_t lmap_addr,
+                      const struct link_map& lmap,
+                      const char* name,
+                      bool is_main_exec,
+                      std::vector<DsoInfo>* dsos) {
+  char dsoname[kMaxNameSize];
+
+  // Fetch the ELF header together with the name, or as much of it as can
+  // be read without crossing into the next page. The rest of the name, if
+  // any, is read separately.
+  auto name_vaddr = reinterpret_cast<mx_vaddr_t>(lmap.l_name);
+  size_t name_chunk = std::min(kNameChunkSize,
+                               kPageSize - (name_vaddr & (kPageSize - 1)));
+  elf::Header hdr;
+  const ByteBlock::ReadRange ranges[] = {
+      {name_vaddr, dsoname, name_chunk},
+      {lmap.l_addr, &hdr, sizeof(hdr)},
+  };
+  if (!bb->ReadV(ranges, arraysize(ranges)))
+    return false;
+  if (!memchr(dsoname, '\0', name_chunk)) {
+    if (!ReadString(*bb, name_vaddr + name_chunk, dsoname + name_chunk,
+                    sizeof(dsoname) - name_chunk))
+      return false;
   }
 
-  return nullptr;
+  // |dsoname| is kept as is for lmap_name, |file_name| is what we know the
+  // module by.
+  const char* file_name = dsoname[0] ? dsoname : name;
+  if (!strcmp(file_name, "libc.so"))
+    file_name = "libmusl.so";
+  // The entry is only added to |dsos| once it's complete.
+  DsoInfo dso = MakeDsoInfo(nullptr, lmap.l_addr);
+  dso.lmap = lmap_addr;
+  dso.dynamic = reinterpret_cast<mx_vaddr_t>(lmap.l_ld);
+
+  std::unique_ptr<elf::Reader> elf_reader;
+  elf::Error rc = elf::Reader::Create(file_name, bb, 0, dso.base, hdr,
+                                      &elf_reader);
+  if (rc != elf::Error::OK) {
+    FTL_LOG(ERROR) << "Unable to read ELF file: " << elf::ErrorName(rc);
+    return false;
+  }
+
+  rc = elf_reader->ReadSegmentHeaders();
+  if (rc != elf::Error::OK) {
+    FTL_LOG(ERROR) << "Error reading ELF segment headers: "
+                   << elf::ErrorName(rc);
+  } else {
+    size_t num_segments = elf_reader->GetNumSegments();
+    uint32_t num_loadable_phdrs = 0;
+    for (size_t i = 0; i < num_segments; ++i) {
+      const elf::SegmentHeader& phdr = elf_reader->GetSegmentHeader(i);
+      if (phdr.p_type == PT_LOAD)
+        ++num_loadable_phdrs;
+    }
+    // Always use nullptr if there are no loadable phdrs.
+    elf::SegmentHeader* loadable_phdrs = nullptr;
+    if (num_loadable_phdrs > 0) {
+      loadable_phdrs = static_cast<elf::SegmentHeader*>(
+          arena_.Allocate(num_loadable_phdrs * sizeof(elf::SegmentHeader)));
+    }
+    size_t j = 0;
+    for (size_t i = 0; i < num_segments; ++i) {
+      const elf::SegmentHeader& phdr = elf_reader->GetSegmentHeader(i);
+      if (phdr.p_type == PT_LOAD)
+        loadable_phdrs[j++] = phdr;
+    }
+    FTL_DCHECK(j == num_loadable_phdrs);
+    dso.num_loadable_phdrs = num_loadable_phdrs;
+    dso.loadable_phdrs = loadable_phdrs;
+  }
+
+  rc = elf_reader->ReadBuildId(dso.buildid, sizeof(dso.buildid));
+  if (rc != elf::Error::OK) {
+    // This isn't fatal so don't flag as an error.
+    FTL_VLOG(1) << "Unable to read build id: " << elf::ErrorName(rc);
+  }
+
+  dso.is_main_exec = is_main_exec;
+  dso.entry = dso.base + hdr.e_entry;
+  dso.phdr = dso.base + hdr.e_phoff;
+  dso.phentsize = hdr.e_phentsize;
+  dso.phnum = hdr.e_phnum;
+  dso.name = arena_.CopyString(file_name);
+  dso.lmap_name = arena_.CopyString(dsoname);
+  dsos->push_back(dso);
+  return true;
 }
 
-dsoinfo_t* dso_get_main_exec(dsoinfo_t* dso_list) {
-  for (auto dso = dso_list; dso != nullptr; dso = dso->next) {
-    if (dso->is_main_exec)
-      return dso;
+DsoInfo* DsoList::Lookup(mx_vaddr_t pc) {
+  // Find the first module loaded above |pc|; the one before it is ours.
+  auto iter = std::upper_bound(
+      dsos_.begin(), dsos_.end(), pc,
+      [](mx_vaddr_t pc, const DsoInfo& dso) { return pc < dso.base; });
+  if (iter == dsos_.begin())
+    return nullptr;
+  return &*(iter - 1);
+}
+
+std::vector<const DsoInfo*> DsoList::GetLinkMapOrder() const {
+  std::vector<const DsoInfo*> result;
+  result.reserve(dsos_.size());
+  for (const auto& dso : dsos_)
+    result.push_back(&dso);
+  std::sort(result.begin(), result.end(),
+            [](const DsoInfo* a, const DsoInfo* b) {
+              return a->lmap_index < b->lmap_index;
+            });
+  return result;
+}
+
+const DsoInfo* DsoList::GetMainExec() const {
+  for (const auto& dso : dsos_) {
+    if (dso.is_main_exec)
+      return &dso;
   }
 
   return nullptr;
 }
 
-void dso_print_list(FILE* out, const dsoinfo_t* dso_list) {
-  for (auto dso = dso_list; dso != nullptr; dso = dso->next) {
-    fprintf(out,"dso: id=%s base=%p name=%s\n",
-            dso->buildid, (void*) dso->base, dso->name);
+void DsoList::Print(FILE* out) const {
+  for (const auto& dso : dsos_) {
+    fprintf(out, "dso: id=%s base=%p name=%s\n",
+            dso.buildid, (void*) dso.base, dso.name);
   }
 }
 
-void dso_vlog_list(const dsoinfo_t* dso_list) {
-  for (auto dso = dso_list; dso != nullptr; dso = dso->next) {
-    FTL_VLOG(2) << ftl::StringPrintf("dso: id=%s base=%p name=%s", dso->buildid,
-                                     (void*)dso->base, dso->name);
+void DsoList::VLog() const {
+  for (const auto& dso : dsos_) {
+    FTL_VLOG(2) << ftl::StringPrintf("dso: id=%s base=%p name=%s", dso.buildid,
+                                     (void*)dso.base, dso.name);
   }
 }
 
-mx_status_t dso_find_debug_file(dsoinfo_t* dso, const char** out_debug_file) {
+mx_status_t DsoList::FindDebugFile(DsoInfo* dso, const char** out_debug_file) {
+  FTL_DCHECK(dso >= dsos_.data() && dso < dsos_.data() + dsos_.size());
+
   // Have we already tried?
   // Yeah, if we OOM it's possible it'll succeed next time, but
   // it's not worth the extra complexity to avoid printing the debugging
@@ -204,26 +308,20 @@ mx_status_t dso_find_debug_file(dsoinfo_t* dso, const char** out_debug_file) {
 
   dso->debug_file_tried = true;
 
-  char* path;
-  if (asprintf(&path, "%s/%s%s", kDebugDirectory, dso->buildid, kDebugSuffix) <
-      0) {
-    FTL_VLOG(1) << "OOM building debug file path for dso " << dso->name;
-    dso->debug_file_status = ERR_NO_MEMORY;
-    return dso->debug_file_status;
-  }
+  std::string path = ftl::StringPrintf("%s/%s%s", kDebugDirectory,
+                                       dso->buildid, kDebugSuffix);
 
   FTL_VLOG(1) << "looking for debug file " << path;
 
-  int fd = open(path, O_RDONLY);
+  int fd = open(path.c_str(), O_RDONLY);
   if (fd < 0) {
     FTL_VLOG(1) << "debug file for dso " << dso->name << " not found: " << path;
-    free(path);
     dso->debug_file_status = ERR_NOT_FOUND;
   } else {
     FTL_VLOG(1) << "found debug file for dso " << dso->name << ": " << path;
     close(fd);
-    dso->debug_file = path;
-    *out_debug_file = path;
+    dso->debug_file = arena_.CopyString(path.c_str());
+    *out_debug_file = dso->debug_file;
     dso->debug_file_status = NO_ERROR;
   }
 
@@ -2,56 +2,155 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
-// TODO(dje): This code is copied from crashlogger. Modest changes
-// have been done. Further changes left for later.
-// [C++-ification, Google code style, etc. etc. etc.]
-
 #pragma once
 
+#include <link.h>
+
 #include <cstdio>
 #include <memory>
+#include <vector>
 
 #include <magenta/types.h>
 
+#include "lib/ftl/macros.h"
+
 #include "byte-block.h"
 #include "elf-reader.h"
 
 namespace debugserver {
 namespace util {
 
-typedef struct dsoinfo {
-  struct dsoinfo* next;
+// Information about one loaded module ("dso"), including the main
+// executable. Strings and arrays are owned by the DsoList.
+struct DsoInfo {
+  // The address of the dynamic linker's link_map entry for the module.
+  mx_vaddr_t lmap;
+  // The position of that entry in the link_map chain.
+  uint32_t lmap_index;
   mx_vaddr_t base;
+  // The address of the module's dynamic section (link_map.l_ld).
+  mx_vaddr_t dynamic;
   mx_vaddr_t entry;
   mx_vaddr_t phdr;
-  // Note: This is NULL if num_loadable_phdrs == 0.
-  elf::SegmentHeader* loadable_phdrs;
+  // Note: This is nullptr if num_loadable_phdrs == 0.
+  const elf::SegmentHeader* loadable_phdrs;
   uint32_t num_loadable_phdrs;
   uint32_t phentsize, phnum;
   char buildid[elf::Reader::kMaxBuildIdSize * 2 + 1];
   bool is_main_exec;
   bool debug_file_tried;
   mx_status_t debug_file_status;
-  char* debug_file;
-  char name[];
-} dsoinfo_t;
+  const char* debug_file;
+  // The name of the module's file. libc.so is known as libmusl.so.
+  const char* name;
+  // The name exactly as the dynamic linker has it (link_map.l_name), which
+  // is empty for the main executable.
+  const char* lmap_name;
+};
+
+// The set of modules loaded in a process, sorted by load address.
+//
+// The entries live in one array so that lookups are a binary search and
+// iteration doesn't chase pointers. Names and program headers are carved out
+// of a few large blocks that are freed together with the list.
+class DsoList final {
+ public:
+  // Builds the list by walking the dynamic linker's link_map chain starting
+  // at |lmap_addr| in |bb|. |name| is used for the entry without a name,
+  // i.e., the main executable.
+  // If a link_map entry can't be read (say because the dynamic linker's data
+  // structures got corrupted) the modules collected so far are returned.
+  // Modules whose ELF headers can't be read are left out.
+  // Returns nullptr if none were found.
+  static std::unique_ptr<DsoList> Fetch(std::shared_ptr<ByteBlock> bb,
+                                        mx_vaddr_t lmap_addr,
+                                        const char* name);
+
+  // Brings the list up to date with the link_map chain at |lmap_addr|, e.g.,
+  // after the dynamic linker has loaded or unloaded modules.
+  // Modules already in the list are kept as is (only their link_map entry is
+  // read), new ones are read in, and ones no longer in the chain are dropped.
+  // As with Fetch() modules that can't be read are left out, and the walk
+  // stops at a link_map entry that can't be read.
+  // Returns true if the set of modules changed.
+  // This invalidates pointers to entries returned by Lookup(), etc.
+  bool Update(const std::shared_ptr<ByteBlock>& bb,
+              mx_vaddr_t lmap_addr,
+              const char* name);
+
+  size_t size() const { return dsos_.size(); }
+
+  // Iteration is in increasing order of load address.
+  using const_iterator = std::vector<DsoInfo>::const_iterator;
+  const_iterator begin() const { return dsos_.begin(); }
+  const_iterator end() const { return dsos_.end(); }
+
+  // Returns the module with the highest load address at or below |pc|,
+  // or nullptr if there is none.
+  // The result is not const for the sake of FindDebugFile().
+  DsoInfo* Lookup(mx_vaddr_t pc);
+
+  // Returns the modules in the order of the link_map chain, i.e., the order
+  // the dynamic linker loaded them in.
+  std::vector<const DsoInfo*> GetLinkMapOrder() const;
+
+  // Returns the entry for the main executable, or nullptr if there isn't one
+  // (which can happen if the inferior's data structures have been clobbered).
+  const DsoInfo* GetMainExec() const;
+
+  // Looks for the separate debug info file for |dso|, which must belong to
+  // this list. The result is remembered, so the lookup is only done once.
+  // On success the path of the file is returned in |*out_debug_file|.
+  mx_status_t FindDebugFile(DsoInfo* dso, const char** out_debug_file);
+
+  void Print(FILE* out) const;
+
+  // Logs the list at verbosity level 2.
+  void VLog() const;
+
+ private:
+  // A simple bump allocator for the data referenced by the entries.
+  class Arena final {
+   public:
+    Arena() = default;
+
+    // Returns |size| bytes of storage suitably aligned for any type.
+    void* Allocate(size_t size);
+
+    // Returns a copy of |str| allocated in the arena.
+    const char* CopyString(const char* str);
+
+   private:
+    static constexpr size_t kBlockSize = 4096;
 
-extern dsoinfo_t* dso_fetch_list(std::shared_ptr<ByteBlock> bb,
-                                 mx_vaddr_t lmap,
-                                 const char* name);
+    std::vector<std::unique_ptr<char[]>> blocks_;
+    char* next_ = nullptr;
+    size_t remaining_ = 0;
 
-extern void dso_free_list(dsoinfo_t*);
+    FTL_DISALLOW_COPY_AND_ASSIGN(Arena);
+  };
 
-extern dsoinfo_t* dso_lookup(dsoinfo_t* dso_list, mx_vaddr_t pc);
+  DsoList() = default;
 
-extern dsoinfo_t* dso_get_main_exec(dsoinfo_t* dso_list);
+  // Returns the entry for the module with link_map entry |lmap| and load
+  // address |base|, or nullptr if there is none.
+  const DsoInfo* Find(mx_vaddr_t lmap, mx_vaddr_t base) const;
 
-extern void dso_print_list(FILE* out, const dsoinfo_t* dso_list);
+  // Reads the module described by |lmap| at |lmap_addr| and appends it to
+  // |dsos|. Returns false, without adding anything, if the module's name or
+  // ELF header couldn't be read.
+  bool ReadDso(const std::shared_ptr<ByteBlock>& bb,
+               mx_vaddr_t lmap_addr,
+               const struct link_map& lmap,
+               const char* name,
+               bool is_main_exec,
+               std::vector<DsoInfo>* dsos);
 
-extern void dso_vlog_list(const dsoinfo_t* dso_list);
+  std::vector<DsoInfo> dsos_;
+  Arena arena_;
 
-extern mx_status_t dso_find_debug_file(dsoinfo_t* dso,
-                                       const char** out_debug_file);
+  FTL_DISALLOW_COPY_AND_ASSIGN(DsoList);
+};
 
 }  // namespace util
 }  // namespace debugserver
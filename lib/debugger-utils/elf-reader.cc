@@ -8,6 +8,8 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <string>
+#include <vector>
 
 #include "lib/ftl/logging.h"
 #include "lib/ftl/strings/string_number_conversions.h"
@@ -32,16 +34,22 @@ Error Reader::Create(const std::string& file_name,
                      std::shared_ptr<util::ByteBlock> byte_block,
                      uint32_t options, uint64_t base,
                      std::unique_ptr<Reader>* out) {
-  FTL_DCHECK(options == 0);
-  Reader* er = new Reader(file_name, byte_block, base);
-  if (!ReadHeader(*byte_block, base, &er->header_)) {
-    delete er;
+  Header header;
+  if (!ReadHeader(*byte_block, base, &header))
     return Error::IO;
-  }
-  if (!VerifyHeader(&er->header_)) {
-    delete er;
+  return Create(file_name, byte_block, options, base, header, out);
+}
+
+Error Reader::Create(const std::string& file_name,
+                     std::shared_ptr<util::ByteBlock> byte_block,
+                     uint32_t options, uint64_t base,
+                     const Header& header,
+                     std::unique_ptr<Reader>* out) {
+  FTL_DCHECK(options == 0);
+  if (!VerifyHeader(&header))
     return Error::BADELF;
-  }
+  Reader* er = new Reader(file_name, byte_block, base);
+  er->header_ = header;
   *out = std::unique_ptr<Reader>(er);
   return Error::OK;
 }
@@ -162,52 +170,57 @@ Error Reader::GetSectionContents(
 }
 
 Error Reader::ReadBuildId(char* buf, size_t buf_size) {
-  uint64_t vaddr = base_;
-
   FTL_DCHECK(buf_size >= kMaxBuildIdSize * 2 + 1);
 
   Error rc = ReadSegmentHeaders();
   if (rc != Error::OK)
     return rc;
 
+  // Fetch all the note segments at once, then search them in place.
+  // Note segments are small; anything larger than this is bogus.
+  constexpr uint64_t kMaxNoteSegmentSize = 64 * 1024;
   size_t num_segments = GetNumSegments();
-
+  std::vector<std::vector<uint8_t>> notes;
+  std::vector<util::ByteBlock::ReadRange> ranges;
   for (size_t i = 0; i < num_segments; ++i) {
     const auto& phdr = GetSegmentHeader(i);
-    if (phdr.p_type != PT_NOTE)
+    if (phdr.p_type != PT_NOTE || phdr.p_filesz == 0)
       continue;
+    if (phdr.p_filesz > kMaxNoteSegmentSize) {
+      FTL_VLOG(1) << "Ignoring note segment of " << phdr.p_filesz << " bytes";
+      continue;
+    }
+    notes.emplace_back(phdr.p_filesz);
+    ranges.push_back({base_ + phdr.p_offset, notes.back().data(),
+                      notes.back().size()});
+  }
+  if (!byte_block_->ReadV(ranges.data(), ranges.size()))
+    return Error::IO;
 
-    struct {
+  for (const auto& note : notes) {
+    size_t offset = 0;
+    while (offset < note.size() &&
+           note.size() - offset > sizeof(Elf32_Nhdr) + sizeof("GNU")) {
       Elf32_Nhdr hdr;
-      char name[sizeof("GNU")];
-    } note;
-    uint64_t size = phdr.p_filesz;
-    uint64_t offset = phdr.p_offset;
-    while (size > sizeof(note)) {
-      if (!byte_block_->Read(vaddr + offset, &note, sizeof(note)))
-        return Error::IO;
-      size_t header_size = sizeof(Elf32_Nhdr) + ((note.hdr.n_namesz + 3) & -4);
-      size_t payload_size = (note.hdr.n_descsz + 3) & -4;
-      offset += header_size;
-      size -= header_size;
-      uint64_t payload_vaddr = vaddr + offset;
-      offset += payload_size;
-      size -= payload_size;
-      if (note.hdr.n_type != NT_GNU_BUILD_ID ||
-          note.hdr.n_namesz != sizeof("GNU") ||
-          memcmp(note.name, "GNU", sizeof("GNU")) != 0) {
+      memcpy(&hdr, note.data() + offset, sizeof(hdr));
+      size_t header_size = sizeof(Elf32_Nhdr) + ((hdr.n_namesz + 3) & -4);
+      size_t payload_size = (hdr.n_descsz + 3) & -4;
+      if (header_size + hdr.n_descsz > note.size() - offset)
+        break;
+      const uint8_t* name = note.data() + offset + sizeof(Elf32_Nhdr);
+      const uint8_t* payload = note.data() + offset + header_size;
+      offset += header_size + payload_size;
+      if (hdr.n_type != NT_GNU_BUILD_ID ||
+          hdr.n_namesz != sizeof("GNU") ||
+          memcmp(name, "GNU", sizeof("GNU")) != 0) {
         continue;
       }
-      if (note.hdr.n_descsz > kMaxBuildIdSize) {
+      if (hdr.n_descsz > kMaxBuildIdSize) {
         // TODO(dje): Revisit.
-        snprintf(buf, buf_size, "build_id_too_large_%u", note.hdr.n_descsz);
+        snprintf(buf, buf_size, "build_id_too_large_%u", hdr.n_descsz);
       } else {
-        uint8_t buildid[kMaxBuildIdSize];
-        if (!byte_block_->Read(payload_vaddr, buildid, note.hdr.n_descsz))
-          return Error::IO;
-        for (uint32_t i = 0; i < note.hdr.n_descsz; ++i) {
-          snprintf(&buf[i * 2], 3, "%02x", buildid[i]);
-        }
+        std::string hex = util::EncodeByteArrayString(payload, hdr.n_descsz);
+        memcpy(buf, hex.c_str(), hex.size() + 1);
       }
       return Error::OK;
     }
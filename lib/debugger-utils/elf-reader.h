@@ -98,6 +98,15 @@ class Reader {
                       uint32_t options,
                       uint64_t base,
                       std::unique_ptr<Reader>* out);
+
+  // Same as Create() except that the caller has already read the ELF header,
+  // e.g., together with other data, into |header|.
+  static Error Create(const std::string& file_name,
+                      std::shared_ptr<util::ByteBlock> byte_block,
+                      uint32_t options,
+                      uint64_t base,
+                      const Header& header,
+                      std::unique_ptr<Reader>* out);
   ~Reader();
 
   const std::string& file_name() const { return file_name_; }
@@ -0,0 +1,122 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "hex-kernels.h"
+
+#include <algorithm>
+#include <cctype>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "util.h"
+
+namespace debugserver {
+namespace util {
+namespace {
+
+// Sizes chosen to cover the empty case, the scalar tails, and one and more
+// full vectors of each width.
+const size_t kSizes[] = {0, 1, 7, 15, 16, 17, 31, 32, 33, 63, 64, 100, 1000};
+
+// Returns |size| bytes covering every byte value.
+std::vector<uint8_t> MakeBytes(size_t size) {
+  std::vector<uint8_t> bytes(size);
+  for (size_t i = 0; i < size; ++i)
+    bytes[i] = static_cast<uint8_t>(i * 37 + 11);
+  return bytes;
+}
+
+// The reference implementation is the one byte at a time API.
+std::string ReferenceEncode(const std::vector<uint8_t>& bytes) {
+  std::string result;
+  for (uint8_t byte : bytes) {
+    char hex[2];
+    EncodeByteString(byte, hex);
+    result.append(hex, sizeof(hex));
+  }
+  return result;
+}
+
+TEST(HexKernelsTest, Encode) {
+  for (const HexKernels* kernels : GetAllHexKernels()) {
+    SCOPED_TRACE(kernels->name);
+    for (size_t size : kSizes) {
+      std::vector<uint8_t> bytes = MakeBytes(size);
+      std::string hex(size * 2, '?');
+      kernels->encode(bytes.data(), size, &hex[0]);
+      EXPECT_EQ(ReferenceEncode(bytes), hex) << "size " << size;
+    }
+  }
+}
+
+TEST(HexKernelsTest, Decode) {
+  for (const HexKernels* kernels : GetAllHexKernels()) {
+    SCOPED_TRACE(kernels->name);
+    for (size_t size : kSizes) {
+      std::vector<uint8_t> bytes = MakeBytes(size);
+      std::string hex = ReferenceEncode(bytes);
+      std::vector<uint8_t> result(size);
+      EXPECT_TRUE(kernels->decode(hex.data(), size, result.data()));
+      EXPECT_EQ(bytes, result) << "size " << size;
+
+      // Uppercase digits are accepted too.
+      for (char& c : hex)
+        c = toupper(c);
+      std::fill(result.begin(), result.end(), 0);
+      EXPECT_TRUE(kernels->decode(hex.data(), size, result.data()));
+      EXPECT_EQ(bytes, result) << "size " << size;
+    }
+  }
+}
+
+TEST(HexKernelsTest, DecodeInvalid) {
+  const size_t kSize = 100;
+  std::string hex = ReferenceEncode(MakeBytes(kSize));
+  std::vector<uint8_t> result(kSize);
+
+  // Every character that isn't a hex digit must be caught, at every offset
+  // within a vector.
+  for (const HexKernels* kernels : GetAllHexKernels()) {
+    SCOPED_TRACE(kernels->name);
+    for (int c = 0; c < 256; ++c) {
+      char ch = static_cast<char>(c);
+      if (isxdigit(c))
+        continue;
+      for (size_t pos = 0; pos < 64; ++pos) {
+        std::string bad = hex;
+        bad[pos * 3 % bad.size()] = ch;
+        EXPECT_FALSE(kernels->decode(bad.data(), kSize, result.data()))
+            << "char " << c << " at " << pos * 3 % bad.size();
+      }
+    }
+  }
+}
+
+TEST(HexKernelsTest, Checksum) {
+  for (const HexKernels* kernels : GetAllHexKernels()) {
+    SCOPED_TRACE(kernels->name);
+    for (size_t size : kSizes) {
+      std::vector<uint8_t> bytes = MakeBytes(size);
+      uint8_t expected = 0;
+      for (uint8_t byte : bytes)
+        expected += byte;
+      EXPECT_EQ(expected,
+                kernels->checksum(reinterpret_cast<const char*>(bytes.data()),
+                                  size))
+          << "size " << size;
+    }
+  }
+}
+
+TEST(HexKernelsTest, ComputeChecksum) {
+  EXPECT_EQ(0, ComputeChecksum(""));
+  EXPECT_EQ(0x44, ComputeChecksum("foo"));
+  EXPECT_EQ(0x00, ComputeChecksum(std::string(256, '\xff')));
+}
+
+}  // namespace
+}  // namespace util
+}  // namespace debugserver
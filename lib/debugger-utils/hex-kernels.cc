@@ -0,0 +1,345 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "hex-kernels.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#include "lib/ftl/logging.h"
+
+#if defined(__x86_64__)
+#include "x86-cpuid.h"
+#endif
+
+namespace debugserver {
+namespace util {
+
+namespace {
+
+constexpr char kHexDigits[] = "0123456789abcdef";
+
+// Returns the value of hex digit |c|, or -1 if it isn't one.
+inline int HexDigitValue(char c) {
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+void EncodeScalar(const uint8_t* bytes, size_t num_bytes, char* out_hex) {
+  for (size_t i = 0; i < num_bytes; ++i) {
+    out_hex[2 * i] = kHexDigits[bytes[i] >> 4];
+    out_hex[2 * i + 1] = kHexDigits[bytes[i] & 0xf];
+  }
+}
+
+bool DecodeScalar(const char* hex, size_t num_bytes, uint8_t* out_bytes) {
+  for (size_t i = 0; i < num_bytes; ++i) {
+    int msb = HexDigitValue(hex[2 * i]);
+    int lsb = HexDigitValue(hex[2 * i + 1]);
+    if (msb < 0 || lsb < 0)
+      return false;
+    out_bytes[i] = static_cast<uint8_t>((msb << 4) | lsb);
+  }
+  return true;
+}
+
+uint8_t ChecksumScalar(const char* data, size_t size) {
+  uint8_t checksum = 0;
+  for (size_t i = 0; i < size; ++i)
+    checksum += static_cast<uint8_t>(data[i]);
+  return checksum;
+}
+
+const HexKernels kScalarKernels = {
+    "scalar", EncodeScalar, DecodeScalar, ChecksumScalar,
+};
+
+#if defined(__x86_64__)
+
+// SSE2 is part of the x86-64 baseline, so these need no runtime check.
+
+// Converts each nibble (0-15) in |nibbles| to its hex digit.
+inline __m128i NibblesToHexSse2(__m128i nibbles) {
+  // '0' + n, plus 'a' - '0' - 10 if n > 9.
+  __m128i letters = _mm_and_si128(_mm_cmpgt_epi8(nibbles, _mm_set1_epi8(9)),
+                                  _mm_set1_epi8('a' - '0' - 10));
+  return _mm_add_epi8(_mm_add_epi8(nibbles, _mm_set1_epi8('0')), letters);
+}
+
+// Converts each hex digit in |chars| to its value, and clears the
+// corresponding byte of |*valid| if it isn't a hex digit.
+inline __m128i HexToNibblesSse2(__m128i chars, __m128i* valid) {
+  // Unsigned x <= max is computed as min(x, max) == x.
+  __m128i digit = _mm_sub_epi8(chars, _mm_set1_epi8('0'));
+  __m128i is_digit =
+      _mm_cmpeq_epi8(_mm_min_epu8(digit, _mm_set1_epi8(9)), digit);
+  // Folding to lowercase doesn't turn a digit into a letter or vice versa.
+  __m128i letter = _mm_sub_epi8(_mm_or_si128(chars, _mm_set1_epi8(0x20)),
+                                _mm_set1_epi8('a'));
+  __m128i is_letter =
+      _mm_cmpeq_epi8(_mm_min_epu8(letter, _mm_set1_epi8(5)), letter);
+  *valid = _mm_and_si128(*valid, _mm_or_si128(is_digit, is_letter));
+  return _mm_or_si128(
+      _mm_and_si128(is_digit, digit),
+      _mm_and_si128(is_letter, _mm_add_epi8(letter, _mm_set1_epi8(10))));
+}
+
+// Combines the pairs of nibbles (msb first) in |nibbles| into bytes, one per
+// 16-bit lane.
+inline __m128i PackNibblesSse2(__m128i nibbles) {
+  return _mm_and_si128(
+      _mm_or_si128(_mm_slli_epi16(nibbles, 4), _mm_srli_epi16(nibbles, 8)),
+      _mm_set1_epi16(0xff));
+}
+
+void EncodeSse2(const uint8_t* bytes, size_t num_bytes, char* out_hex) {
+  const __m128i kLowNibble = _mm_set1_epi8(0xf);
+  size_t i = 0;
+  for (; i + 16 <= num_bytes; i += 16) {
+    __m128i v =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes + i));
+    __m128i msb = NibblesToHexSse2(_mm_and_si128(_mm_srli_epi16(v, 4),
+                                                 kLowNibble));
+    __m128i lsb = NibblesToHexSse2(_mm_and_si128(v, kLowNibble));
+    __m128i* out = reinterpret_cast<__m128i*>(out_hex + 2 * i);
+    _mm_storeu_si128(out, _mm_unpacklo_epi8(msb, lsb));
+    _mm_storeu_si128(out + 1, _mm_unpackhi_epi8(msb, lsb));
+  }
+  EncodeScalar(bytes + i, num_bytes - i, out_hex + 2 * i);
+}
+
+bool DecodeSse2(const char* hex, size_t num_bytes, uint8_t* out_bytes) {
+  size_t i = 0;
+  for (; i + 16 <= num_bytes; i += 16) {
+    const __m128i* in = reinterpret_cast<const __m128i*>(hex + 2 * i);
+    __m128i valid = _mm_set1_epi8(-1);
+    __m128i lo = HexToNibblesSse2(_mm_loadu_si128(in), &valid);
+    __m128i hi = HexToNibblesSse2(_mm_loadu_si128(in + 1), &valid);
+    if (_mm_movemask_epi8(valid) != 0xffff)
+      return false;
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out_bytes + i),
+                     _mm_packus_epi16(PackNibblesSse2(lo),
+                                      PackNibblesSse2(hi)));
+  }
+  return DecodeScalar(hex + 2 * i, num_bytes - i, out_bytes + i);
+}
+
+uint8_t ChecksumSse2(const char* data, size_t size) {
+  // Bytewise addition is already modulo 256; the lanes are summed at the end.
+  __m128i sum = _mm_setzero_si128();
+  size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    sum = _mm_add_epi8(
+        sum, _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i)));
+  }
+  __m128i halves = _mm_sad_epu8(sum, _mm_setzero_si128());
+  uint8_t checksum = static_cast<uint8_t>(
+      _mm_cvtsi128_si32(halves) + _mm_extract_epi16(halves, 4));
+  return checksum + ChecksumScalar(data + i, size - i);
+}
+
+const HexKernels kSse2Kernels = {
+    "sse2", EncodeSse2, DecodeSse2, ChecksumSse2,
+};
+
+// The AVX2 versions are the SSE2 ones widened to 256 bits. The unpack and
+// pack instructions work within each 128-bit half, so their results are
+// reordered before being stored.
+
+#define AVX2_FUNCTION __attribute__((target("avx2")))
+
+AVX2_FUNCTION inline __m256i NibblesToHexAvx2(__m256i nibbles) {
+  __m256i letters =
+      _mm256_and_si256(_mm256_cmpgt_epi8(nibbles, _mm256_set1_epi8(9)),
+                       _mm256_set1_epi8('a' - '0' - 10));
+  return _mm256_add_epi8(_mm256_add_epi8(nibbles, _mm256_set1_epi8('0')),
+                         letters);
+}
+
+AVX2_FUNCTION inline __m256i HexToNibblesAvx2(__m256i chars, __m256i* valid) {
+  __m256i digit = _mm256_sub_epi8(chars, _mm256_set1_epi8('0'));
+  __m256i is_digit =
+      _mm256_cmpeq_epi8(_mm256_min_epu8(digit, _mm256_set1_epi8(9)), digit);
+  __m256i letter = _mm256_sub_epi8(
+      _mm256_or_si256(chars, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('a'));
+  __m256i is_letter =
+      _mm256_cmpeq_epi8(_mm256_min_epu8(letter, _mm256_set1_epi8(5)), letter);
+  *valid = _mm256_and_si256(*valid, _mm256_or_si256(is_digit, is_letter));
+  return _mm256_or_si256(
+      _mm256_and_si256(is_digit, digit),
+      _mm256_and_si256(is_letter,
+                       _mm256_add_epi8(letter, _mm256_set1_epi8(10))));
+}
+
+AVX2_FUNCTION inline __m256i PackNibblesAvx2(__m256i nibbles) {
+  return _mm256_and_si256(_mm256_or_si256(_mm256_slli_epi16(nibbles, 4),
+                                          _mm256_srli_epi16(nibbles, 8)),
+                          _mm256_set1_epi16(0xff));
+}
+
+AVX2_FUNCTION void EncodeAvx2(const uint8_t* bytes,
+                              size_t num_bytes,
+                              char* out_hex) {
+  const __m256i kLowNibble = _mm256_set1_epi8(0xf);
+  size_t i = 0;
+  for (; i + 32 <= num_bytes; i += 32) {
+    __m256i v =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(bytes + i));
+    __m256i msb = NibblesToHexAvx2(
+        _mm256_and_si256(_mm256_srli_epi16(v, 4), kLowNibble));
+    __m256i lsb = NibblesToHexAvx2(_mm256_and_si256(v, kLowNibble));
+    // |lo| holds bytes 0-7 and 16-23, |hi| bytes 8-15 and 24-31.
+    __m256i lo = _mm256_unpacklo_epi8(msb, lsb);
+    __m256i hi = _mm256_unpackhi_epi8(msb, lsb);
+    __m256i* out = reinterpret_cast<__m256i*>(out_hex + 2 * i);
+    _mm256_storeu_si256(out, _mm256_permute2x128_si256(lo, hi, 0x20));
+    _mm256_storeu_si256(out + 1, _mm256_permute2x128_si256(lo, hi, 0x31));
+  }
+  EncodeSse2(bytes + i, num_bytes - i, out_hex + 2 * i);
+}
+
+AVX2_FUNCTION bool DecodeAvx2(const char* hex,
+                              size_t num_bytes,
+                              uint8_t* out_bytes) {
+  size_t i = 0;
+  for (; i + 32 <= num_bytes; i += 32) {
+    const __m256i* in = reinterpret_cast<const __m256i*>(hex + 2 * i);
+    __m256i valid = _mm256_set1_epi8(-1);
+    __m256i lo = HexToNibblesAvx2(_mm256_loadu_si256(in), &valid);
+    __m256i hi = HexToNibblesAvx2(_mm256_loadu_si256(in + 1), &valid);
+    if (_mm256_movemask_epi8(valid) != -1)
+      return false;
+    // The pack interleaves 8-byte groups of |lo| and |hi|; put them back in
+    // order.
+    __m256i packed =
+        _mm256_packus_epi16(PackNibblesAvx2(lo), PackNibblesAvx2(hi));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out_bytes + i),
+                        _mm256_permute4x64_epi64(packed, 0xd8));
+  }
+  return DecodeSse2(hex + 2 * i, num_bytes - i, out_bytes + i);
+}
+
+AVX2_FUNCTION uint8_t ChecksumAvx2(const char* data, size_t size) {
+  __m256i sum = _mm256_setzero_si256();
+  size_t i = 0;
+  for (; i + 32 <= size; i += 32) {
+    sum = _mm256_add_epi8(
+        sum, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i)));
+  }
+  __m128i sum128 = _mm_add_epi8(_mm256_castsi256_si128(sum),
+                                _mm256_extracti128_si256(sum, 1));
+  __m128i halves = _mm_sad_epu8(sum128, _mm_setzero_si128());
+  uint8_t checksum = static_cast<uint8_t>(
+      _mm_cvtsi128_si32(halves) + _mm_extract_epi16(halves, 4));
+  return checksum + ChecksumSse2(data + i, size - i);
+}
+
+#undef AVX2_FUNCTION
+
+const HexKernels kAvx2Kernels = {
+    "avx2", EncodeAvx2, DecodeAvx2, ChecksumAvx2,
+};
+
+// Besides the cpu supporting AVX2, the OS must save the ymm registers.
+bool HaveAvx2() {
+  if (!arch::x86::x86_feature_test(X86_FEATURE_AVX2) ||
+      !arch::x86::x86_feature_test(X86_FEATURE_OSXSAVE))
+    return false;
+  uint32_t xcr0_lo, xcr0_hi;
+  __asm__("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+  // XMM and YMM state.
+  return (xcr0_lo & 0x6) == 0x6;
+}
+
+#elif defined(__aarch64__)
+
+// NEON is part of the ARMv8 baseline, so these need no runtime check.
+
+inline uint8x16_t HexToNibblesNeon(uint8x16_t chars, uint8x16_t* valid) {
+  uint8x16_t digit = vsubq_u8(chars, vdupq_n_u8('0'));
+  uint8x16_t is_digit = vcleq_u8(digit, vdupq_n_u8(9));
+  uint8x16_t letter =
+      vsubq_u8(vorrq_u8(chars, vdupq_n_u8(0x20)), vdupq_n_u8('a'));
+  uint8x16_t is_letter = vcleq_u8(letter, vdupq_n_u8(5));
+  *valid = vandq_u8(*valid, vorrq_u8(is_digit, is_letter));
+  return vorrq_u8(vandq_u8(is_digit, digit),
+                  vandq_u8(is_letter, vaddq_u8(letter, vdupq_n_u8(10))));
+}
+
+void EncodeNeon(const uint8_t* bytes, size_t num_bytes, char* out_hex) {
+  const uint8x16_t kDigits =
+      vld1q_u8(reinterpret_cast<const uint8_t*>(kHexDigits));
+  size_t i = 0;
+  for (; i + 16 <= num_bytes; i += 16) {
+    uint8x16_t v = vld1q_u8(bytes + i);
+    uint8x16x2_t hex;
+    hex.val[0] = vqtbl1q_u8(kDigits, vshrq_n_u8(v, 4));
+    hex.val[1] = vqtbl1q_u8(kDigits, vandq_u8(v, vdupq_n_u8(0xf)));
+    // Stores the two vectors interleaved.
+    vst2q_u8(reinterpret_cast<uint8_t*>(out_hex + 2 * i), hex);
+  }
+  EncodeScalar(bytes + i, num_bytes - i, out_hex + 2 * i);
+}
+
+bool DecodeNeon(const char* hex, size_t num_bytes, uint8_t* out_bytes) {
+  size_t i = 0;
+  for (; i + 16 <= num_bytes; i += 16) {
+    // Loads even and odd characters into separate vectors.
+    uint8x16x2_t chars =
+        vld2q_u8(reinterpret_cast<const uint8_t*>(hex + 2 * i));
+    uint8x16_t valid = vdupq_n_u8(0xff);
+    uint8x16_t msb = HexToNibblesNeon(chars.val[0], &valid);
+    uint8x16_t lsb = HexToNibblesNeon(chars.val[1], &valid);
+    if (vminvq_u8(valid) != 0xff)
+      return false;
+    vst1q_u8(out_bytes + i, vorrq_u8(vshlq_n_u8(msb, 4), lsb));
+  }
+  return DecodeScalar(hex + 2 * i, num_bytes - i, out_bytes + i);
+}
+
+uint8_t ChecksumNeon(const char* data, size_t size) {
+  // Bytewise addition is already modulo 256; the lanes are summed at the end.
+  uint8x16_t sum = vdupq_n_u8(0);
+  size_t i = 0;
+  for (; i + 16 <= size; i += 16)
+    sum = vaddq_u8(sum, vld1q_u8(reinterpret_cast<const uint8_t*>(data + i)));
+  return vaddvq_u8(sum) + ChecksumScalar(data + i, size - i);
+}
+
+const HexKernels kNeonKernels = {
+    "neon", EncodeNeon, DecodeNeon, ChecksumNeon,
+};
+
+#endif
+
+}  // namespace
+
+const HexKernels& GetHexKernels() {
+  // The cpu doesn't change, so this only needs computing once.
+  static const HexKernels* kernels = GetAllHexKernels().back();
+  return *kernels;
+}
+
+std::vector<const HexKernels*> GetAllHexKernels() {
+  std::vector<const HexKernels*> result{&kScalarKernels};
+#if defined(__x86_64__)
+  result.push_back(&kSse2Kernels);
+  if (HaveAvx2())
+    result.push_back(&kAvx2Kernels);
+#elif defined(__aarch64__)
+  result.push_back(&kNeonKernels);
+#endif
+  return result;
+}
+
+}  // namespace util
+}  // namespace debugserver
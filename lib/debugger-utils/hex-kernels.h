@@ -0,0 +1,43 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace debugserver {
+namespace util {
+
+// The inner loops of the hex codec and of packet checksumming. Memory and
+// register transfers are sent as hex, so these run over every byte of the
+// larger replies. There is a portable scalar implementation and, where the
+// architecture has them, vectorized ones; the best one supported by the
+// current cpu is picked at runtime.
+struct HexKernels {
+  // Name of the implementation, e.g., "scalar", "sse2".
+  const char* name;
+
+  // Writes |num_bytes| * 2 lowercase hex digits for |bytes| to |out_hex|.
+  void (*encode)(const uint8_t* bytes, size_t num_bytes, char* out_hex);
+
+  // Decodes the |num_bytes| * 2 hex digits (either case) in |hex| into
+  // |out_bytes|. Returns false if |hex| contains a non-hex-digit character,
+  // in which case the contents of |out_bytes| are unspecified.
+  bool (*decode)(const char* hex, size_t num_bytes, uint8_t* out_bytes);
+
+  // Returns the sum of the |size| bytes in |data|, modulo 256.
+  uint8_t (*checksum)(const char* data, size_t size);
+};
+
+// Returns the fastest kernels supported by the current cpu.
+const HexKernels& GetHexKernels();
+
+// Returns every set of kernels supported by the current cpu, the scalar
+// version first. This exists for testing.
+std::vector<const HexKernels*> GetAllHexKernels();
+
+}  // namespace util
+}  // namespace debugserver
@@ -0,0 +1,92 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "trace-buffer.h"
+
+#include "gtest/gtest.h"
+
+namespace debugserver {
+namespace util {
+namespace {
+
+// Returns a frame for tracepoint |tracepoint| that collected |size| bytes of
+// memory at |address|, each holding the low byte of its address.
+TraceFrame MakeFrame(uint32_t tracepoint, uint64_t address, size_t size) {
+  TraceFrame frame;
+  frame.tracepoint = tracepoint;
+  TraceFrame::Block block;
+  block.address = address;
+  for (size_t i = 0; i < size; ++i)
+    block.bytes.push_back(static_cast<uint8_t>(address + i));
+  frame.memory.push_back(std::move(block));
+  return frame;
+}
+
+TEST(TraceBufferTest, ReadMemory) {
+  TraceFrame frame = MakeFrame(1, 0x1000, 8);
+  frame.memory.push_back(MakeFrame(1, 0x1008, 8).memory[0]);
+  frame.memory.push_back(MakeFrame(1, 0x1004, 2).memory[0]);
+
+  uint8_t bytes[16];
+  EXPECT_TRUE(frame.ReadMemory(0x1006, bytes, 4));
+  EXPECT_EQ(0x06, bytes[0]);
+  EXPECT_EQ(0x09, bytes[3]);
+  EXPECT_TRUE(frame.ReadMemory(0x1000, bytes, sizeof(bytes)));
+  EXPECT_EQ(0x0f, bytes[15]);
+
+  EXPECT_FALSE(frame.ReadMemory(0x0fff, bytes, 2));
+  EXPECT_FALSE(frame.ReadMemory(0x100f, bytes, 2));
+  EXPECT_FALSE(TraceFrame().ReadMemory(0x1000, bytes, 1));
+}
+
+TEST(TraceBufferTest, Linear) {
+  TraceBuffer buffer;
+  const size_t frame_size = MakeFrame(0, 0, 100).Size();
+  buffer.set_size(frame_size * 3);
+
+  for (uint32_t i = 0; i < 3; ++i)
+    EXPECT_TRUE(buffer.Add(MakeFrame(i, 0, 100)));
+  EXPECT_FALSE(buffer.Add(MakeFrame(3, 0, 100)));
+  EXPECT_EQ(3u, buffer.num_frames());
+  EXPECT_EQ(3u, buffer.frames_created());
+  EXPECT_EQ(frame_size * 3, buffer.bytes_used());
+  EXPECT_EQ(0u, buffer.frame(0).tracepoint);
+
+  // Shrinking the buffer drops the oldest frames.
+  buffer.set_size(frame_size * 2);
+  EXPECT_EQ(2u, buffer.num_frames());
+  EXPECT_EQ(1u, buffer.frame(0).tracepoint);
+
+  buffer.Clear();
+  EXPECT_EQ(0u, buffer.num_frames());
+  EXPECT_EQ(0u, buffer.frames_created());
+  EXPECT_EQ(0u, buffer.bytes_used());
+}
+
+TEST(TraceBufferTest, Circular) {
+  TraceBuffer buffer;
+  const size_t frame_size = MakeFrame(0, 0, 100).Size();
+  buffer.set_size(frame_size * 3);
+  buffer.set_circular(true);
+
+  for (uint32_t i = 0; i < 5; ++i)
+    EXPECT_TRUE(buffer.Add(MakeFrame(i, 0, 100)));
+  EXPECT_EQ(3u, buffer.num_frames());
+  EXPECT_EQ(5u, buffer.frames_created());
+  EXPECT_EQ(2u, buffer.frame(0).tracepoint);
+  EXPECT_EQ(4u, buffer.frame(2).tracepoint);
+
+  // A bigger frame pushes out as many as it takes.
+  EXPECT_TRUE(buffer.Add(MakeFrame(5, 0, 200)));
+  EXPECT_EQ(2u, buffer.num_frames());
+  EXPECT_EQ(4u, buffer.frame(0).tracepoint);
+
+  // A frame that can never fit is refused.
+  EXPECT_FALSE(buffer.Add(MakeFrame(6, 0, frame_size * 3)));
+  EXPECT_EQ(2u, buffer.num_frames());
+}
+
+}  // namespace
+}  // namespace util
+}  // namespace debugserver
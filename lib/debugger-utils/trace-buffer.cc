@@ -0,0 +1,102 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "trace-buffer.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "lib/ftl/logging.h"
+
+namespace debugserver {
+namespace util {
+
+namespace {
+
+// Each frame and block is charged a little for bookkeeping, so that frames
+// that collect nothing still fill the buffer eventually.
+constexpr size_t kFrameOverhead = 16;
+constexpr size_t kBlockOverhead = 16;
+
+}  // namespace
+
+constexpr size_t TraceBuffer::kDefaultSize;
+
+size_t TraceFrame::Size() const {
+  size_t size = kFrameOverhead + registers.size() / 2;
+  for (const auto& block : memory)
+    size += kBlockOverhead + block.bytes.size();
+  return size;
+}
+
+bool TraceFrame::ReadMemory(uint64_t address,
+                            void* out_buffer,
+                            size_t length) const {
+  uint8_t* out = static_cast<uint8_t*>(out_buffer);
+  while (length > 0) {
+    // Find a block holding |address|; blocks may overlap or be adjacent.
+    const Block* found = nullptr;
+    for (const auto& block : memory) {
+      if (address >= block.address &&
+          address - block.address < block.bytes.size()) {
+        found = &block;
+        break;
+      }
+    }
+    if (!found)
+      return false;
+
+    size_t offset = address - found->address;
+    size_t count = std::min(length, found->bytes.size() - offset);
+    memcpy(out, found->bytes.data() + offset, count);
+    out += count;
+    address += count;
+    length -= count;
+  }
+  return true;
+}
+
+void TraceBuffer::set_size(size_t size) {
+  size_ = size;
+  while (bytes_used_ > size_) {
+    bytes_used_ -= frames_.front().Size();
+    frames_.pop_front();
+  }
+}
+
+bool TraceBuffer::Add(TraceFrame frame) {
+  size_t frame_size = frame.Size();
+  if (!MakeRoom(frame_size))
+    return false;
+
+  bytes_used_ += frame_size;
+  frames_.push_back(std::move(frame));
+  ++frames_created_;
+  return true;
+}
+
+void TraceBuffer::Clear() {
+  frames_.clear();
+  frames_created_ = 0;
+  bytes_used_ = 0;
+}
+
+bool TraceBuffer::MakeRoom(size_t needed) {
+  if (needed > size_)
+    return false;
+  if (bytes_used_ + needed <= size_)
+    return true;
+  if (!circular_)
+    return false;
+
+  while (bytes_used_ + needed > size_) {
+    FTL_DCHECK(!frames_.empty());
+    bytes_used_ -= frames_.front().Size();
+    frames_.pop_front();
+  }
+  return true;
+}
+
+}  // namespace util
+}  // namespace debugserver
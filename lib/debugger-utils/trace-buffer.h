@@ -0,0 +1,100 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "lib/ftl/macros.h"
+
+namespace debugserver {
+namespace util {
+
+// What a tracepoint collected when it was hit.
+struct TraceFrame {
+  // A block of the inferior's memory.
+  struct Block {
+    uint64_t address;
+    std::vector<uint8_t> bytes;
+  };
+
+  // Returns the number of bytes the frame counts for against the size of a
+  // TraceBuffer.
+  size_t Size() const;
+
+  // Copies |length| bytes at |address| out of the collected memory into
+  // |out_buffer|. Returns false if not all of them were collected.
+  bool ReadMemory(uint64_t address, void* out_buffer, size_t length) const;
+
+  // The number and address of the tracepoint that was hit. The address is
+  // also the pc of the thread that hit it.
+  uint32_t tracepoint = 0;
+  uint64_t address = 0;
+
+  // The general registers in the form of a 'g' packet reply, or empty if
+  // they weren't collected.
+  std::string registers;
+
+  std::vector<Block> memory;
+};
+
+// The trace frames collected since tracing started, oldest first, up to a
+// limit on the memory they take up. Frames are numbered from zero in the
+// order they're kept in.
+//
+// A "circular" buffer makes room for a new frame by discarding the oldest
+// ones. Otherwise a full buffer refuses new frames: tracing has to stop.
+class TraceBuffer final {
+ public:
+  static constexpr size_t kDefaultSize = 5 * 1024 * 1024;
+
+  TraceBuffer() = default;
+
+  // The most bytes the frames may take up. Frames that no longer fit are
+  // discarded, oldest first.
+  size_t size() const { return size_; }
+  void set_size(size_t size);
+
+  bool circular() const { return circular_; }
+  void set_circular(bool circular) { circular_ = circular; }
+
+  // Adds |frame| to the buffer. Returns false if there is no room for it, in
+  // which case it is dropped.
+  bool Add(TraceFrame frame);
+
+  // Discards all frames and resets the statistics.
+  void Clear();
+
+  size_t num_frames() const { return frames_.size(); }
+
+  // Returns frame number |number|, which must be less than num_frames().
+  const TraceFrame& frame(size_t number) const { return frames_[number]; }
+
+  // The number of frames added since the last Clear(), including ones
+  // discarded since.
+  uint64_t frames_created() const { return frames_created_; }
+
+  // The number of bytes the frames currently take up.
+  size_t bytes_used() const { return bytes_used_; }
+
+ private:
+  // Discards the oldest frames until |bytes_used_| + |needed| <= |size_|.
+  // Returns false if that's not possible.
+  bool MakeRoom(size_t needed);
+
+  std::deque<TraceFrame> frames_;
+  size_t size_ = kDefaultSize;
+  bool circular_ = false;
+  uint64_t frames_created_ = 0;
+  size_t bytes_used_ = 0;
+
+  FTL_DISALLOW_COPY_AND_ASSIGN(TraceBuffer);
+};
+
+}  // namespace util
+}  // namespace debugserver
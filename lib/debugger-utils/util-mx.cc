@@ -4,8 +4,10 @@
 
 #include "util.h"
 
+#include <algorithm>
 #include <cctype>
 #include <cinttypes>
+#include <cstring>
 
 #include <magenta/status.h>
 
@@ -49,14 +51,22 @@ std::string ExceptionToString(mx_excp_type_t type,
 }
 
 bool ReadString(const ByteBlock& m, mx_vaddr_t vaddr, char* ptr, size_t max) {
+  FTL_DCHECK(max > 0);
+
+  // Read in chunks that don't cross a page boundary: the string may end just
+  // before an unmapped page.
+  constexpr size_t kPageSize = 4096;
   while (max > 1) {
-    if (!m.Read(vaddr, ptr, 1)) {
+    size_t chunk = std::min(max - 1, kPageSize - (vaddr & (kPageSize - 1)));
+    if (!m.Read(vaddr, ptr, chunk)) {
       *ptr = '\0';
       return false;
     }
-    ptr++;
-    vaddr++;
-    max--;
+    if (memchr(ptr, '\0', chunk))
+      return true;
+    ptr += chunk;
+    vaddr += chunk;
+    max -= chunk;
   }
   *ptr = '\0';
   return true;
@@ -4,10 +4,13 @@
 
 #include "util.h"
 
+#include <cstring>
 #include <string>
 
 #include "gtest/gtest.h"
 
+#include "byte-block.h"
+
 namespace debugserver {
 namespace util {
 namespace {
@@ -162,6 +165,68 @@ TEST(UtilTest, JoinStrings) {
             ftl::StringView(buffer, result_size));
 }
 
+#ifdef __Fuchsia__
+
+// A ByteBlock with memory only at [kBase, kBase + kSize).
+class FakeMemory final : public ByteBlock {
+ public:
+  static constexpr uintptr_t kBase = 0x10000;
+  static constexpr size_t kSize = 0x2000;
+
+  FakeMemory() : data_(kSize, 'x') {}
+
+  bool Read(uintptr_t address, void* out_buffer, size_t length)
+      const override {
+    if (address < kBase || address + length > kBase + kSize)
+      return false;
+    std::memcpy(out_buffer, data_.data() + (address - kBase), length);
+    return true;
+  }
+  bool Write(uintptr_t address, const void* buffer, size_t length)
+      const override {
+    return false;
+  }
+
+  void Put(uintptr_t address, const char* str) {
+    std::memcpy(&data_[address - kBase], str, std::strlen(str) + 1);
+  }
+
+ private:
+  std::string data_;
+};
+
+constexpr uintptr_t FakeMemory::kBase;
+constexpr size_t FakeMemory::kSize;
+
+TEST(UtilTest, ReadString) {
+  FakeMemory memory;
+  char buffer[16];
+
+  // A string ending right before unmapped memory.
+  const uintptr_t kEnd = FakeMemory::kBase + FakeMemory::kSize;
+  memory.Put(kEnd - 6, "hello");
+  EXPECT_TRUE(ReadString(memory, kEnd - 6, buffer, sizeof(buffer)));
+  EXPECT_STREQ("hello", buffer);
+
+  // A string crossing a page boundary.
+  memory.Put(FakeMemory::kBase + 0x1000 - 3, "abcdef");
+  EXPECT_TRUE(ReadString(memory, FakeMemory::kBase + 0x1000 - 3, buffer,
+                         sizeof(buffer)));
+  EXPECT_STREQ("abcdef", buffer);
+
+  // Truncation.
+  EXPECT_TRUE(ReadString(memory, FakeMemory::kBase, buffer, 4));
+  EXPECT_STREQ("xxx", buffer);
+
+  // A string running into unmapped memory.
+  FakeMemory unterminated;
+  EXPECT_FALSE(ReadString(unterminated, kEnd - 4, buffer, sizeof(buffer)));
+  EXPECT_FALSE(ReadString(memory, kEnd, buffer, sizeof(buffer)));
+  EXPECT_STREQ("", buffer);
+}
+
+#endif  // __Fuchsia__
+
 }  // namespace
 }  // namespace util
 }  // namespace debugserver
@@ -12,6 +12,8 @@
 #include "lib/ftl/strings/string_number_conversions.h"
 #include "lib/ftl/strings/string_printf.h"
 
+#include "hex-kernels.h"
+
 namespace debugserver {
 namespace util {
 
@@ -72,10 +74,7 @@ std::string EncodeByteArrayString(const uint8_t* bytes, size_t num_bytes) {
 
   std::string result;
   result.resize(kResultSize);
-  for (size_t i = 0; i < kResultSize; i += 2) {
-    util::EncodeByteString(*bytes, const_cast<char*>(result.data() + i));
-    ++bytes;
-  }
+  GetHexKernels().encode(bytes, num_bytes, &result[0]);
 
   return result;
 }
@@ -98,10 +97,8 @@ std::vector<uint8_t> DecodeByteArrayString(const ftl::StringView& string) {
 
   const size_t kResultSize = string.size() / 2;
   result.resize(kResultSize);
-  for (size_t i = 0; i < kResultSize; ++i) {
-    if (!util::DecodeByteString(string.data() + (i * 2), result.data() + i))
-      return std::vector<uint8_t>{};
-  }
+  if (!GetHexKernels().decode(string.data(), kResultSize, result.data()))
+    return std::vector<uint8_t>{};
 
   return result;
 }
@@ -111,6 +108,10 @@ std::string DecodeString(const ftl::StringView& string) {
   return std::string(charvec.begin(), charvec.end());
 }
 
+uint8_t ComputeChecksum(const ftl::StringView& data) {
+  return GetHexKernels().checksum(data.data(), data.size());
+}
+
 std::string EscapeNonPrintableString(const ftl::StringView& data) {
   std::string result;
   for (char c : data) {
@@ -46,6 +46,10 @@ std::vector<uint8_t> DecodeByteArrayString(const ftl::StringView& string);
 // Same as DecodeByteArrayString but return a string.
 std::string DecodeString(const ftl::StringView& string);
 
+// Returns the sum of the bytes in |data| modulo 256, i.e., the GDB Remote
+// Serial Protocol packet checksum of |data|.
+uint8_t ComputeChecksum(const ftl::StringView& data);
+
 // Escapes binary non-printable (based on the current locale) characters in a
 // printable format to enable pretty-printing of binary data. For example, '0'
 // becomes "\x00".
@@ -99,6 +103,11 @@ const char* ExceptionName(mx_excp_type_t type);
 std::string ExceptionToString(mx_excp_type_t type,
                               const mx_exception_context_t& context);
 
+// Reads the NUL-terminated string at |vaddr| into |ptr|, a buffer of |max|
+// bytes. The result is always NUL-terminated, and truncated if necessary.
+// Memory is read a page at a time, so a string that ends just before an
+// unmapped page can still be read. Returns false if memory could not be read
+// before the end of the string was found.
 bool ReadString(const ByteBlock& m, mx_vaddr_t vaddr, char* ptr, size_t max);
 
 #endif  // __Fuchsia__
@@ -88,6 +88,7 @@ void x86_feature_debug(FILE* out);
 #define X86_FEATURE_TSC_DEADLINE X86_CPUID_BIT(0x1, 2, 24)
 #define X86_FEATURE_AESNI        X86_CPUID_BIT(0x1, 2, 25)
 #define X86_FEATURE_XSAVE        X86_CPUID_BIT(0x1, 2, 26)
+#define X86_FEATURE_OSXSAVE      X86_CPUID_BIT(0x1, 2, 27)
 #define X86_FEATURE_AVX          X86_CPUID_BIT(0x1, 2, 28)
 #define X86_FEATURE_RDRAND       X86_CPUID_BIT(0x1, 2, 30)
 #define X86_FEATURE_FPU          X86_CPUID_BIT(0x1, 3, 0)
@@ -95,6 +95,10 @@ bool IsSingleStepException(const mx_exception_context_t& context) {
   return arch_exception == x86::INT_DEBUG;
 }
 
+uintptr_t GetPageFaultAddress(const mx_exception_context_t& context) {
+  return context.arch.u.x86_64.cr2;
+}
+
 void DumpArch(FILE* out) {
   x86::x86_feature_debug(out);
 }
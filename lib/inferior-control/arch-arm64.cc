@@ -58,6 +58,10 @@ bool IsSingleStepException(const mx_exception_context_t& context) {
   return false;
 }
 
+uintptr_t GetPageFaultAddress(const mx_exception_context_t& context) {
+  return context.arch.u.arm_64.far;
+}
+
 void DumpArch(FILE* out) {
   FTL_NOTIMPLEMENTED();
 }
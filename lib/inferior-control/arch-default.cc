@@ -19,6 +19,11 @@ bool IsSingleStepException(const mx_exception_context_t& context) {
   return false;
 }
 
+uintptr_t GetPageFaultAddress(const mx_exception_context_t& context) {
+  FTL_NOTIMPLEMENTED();
+  return 0;
+}
+
 void DumpArch(FILE* out) {
   FTL_NOTIMPLEMENTED();
 }
@@ -4,6 +4,7 @@
 
 #pragma once
 
+#include <cstdint>
 #include <cstdio>
 
 #include <magenta/syscalls/exception.h>
@@ -46,6 +47,9 @@ GdbSignal ComputeGdbSignal(const mx_exception_context_t& context);
 // Returns true if |context| is a single-stepping exception.
 bool IsSingleStepException(const mx_exception_context_t& context);
 
+// Returns the data address that caused the page fault in |context|.
+uintptr_t GetPageFaultAddress(const mx_exception_context_t& context);
+
 // Dump random bits about the architecuture.
 // TODO(dje): Switch to iostreams maybe later.
 void DumpArch(FILE* out);
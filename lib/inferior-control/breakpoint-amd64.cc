@@ -20,6 +20,15 @@ const uint8_t kInt3 = 0xCC;
 
 }  // namespace
 
+size_t GetDefaultSoftwareBreakpointKind() {
+  return 1;
+}
+
+uintptr_t GetSoftwareBreakpointAddress(uintptr_t pc) {
+  // Int3 is a trap: the reported pc is that of the following instruction.
+  return pc - 1;
+}
+
 bool SoftwareBreakpoint::Insert() {
   // TODO: Handle breakpoints in unloaded solibs.
 
@@ -18,6 +18,15 @@ namespace {
 
 }  // namespace
 
+size_t GetDefaultSoftwareBreakpointKind() {
+  return 4;
+}
+
+uintptr_t GetSoftwareBreakpointAddress(uintptr_t pc) {
+  // brk reports the address of the brk instruction itself.
+  return pc;
+}
+
 bool SoftwareBreakpoint::Insert() {
   FTL_NOTIMPLEMENTED();
   return false;
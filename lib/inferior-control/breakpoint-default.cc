@@ -9,6 +9,14 @@
 namespace debugserver {
 namespace arch {
 
+size_t GetDefaultSoftwareBreakpointKind() {
+  return 0;
+}
+
+uintptr_t GetSoftwareBreakpointAddress(uintptr_t pc) {
+  return pc;
+}
+
 bool SoftwareBreakpoint::Insert() {
   return false;
 }
@@ -5,10 +5,13 @@
 #include "breakpoint.h"
 
 #include <cinttypes>
+#include <utility>
 
 #include "lib/ftl/logging.h"
 #include "lib/ftl/strings/string_printf.h"
 
+#include "process.h"
+
 namespace debugserver {
 namespace arch {
 
@@ -32,44 +35,201 @@ SoftwareBreakpoint::~SoftwareBreakpoint() {
     Remove();
 }
 
+constexpr uint32_t ProcessBreakpointSet::kInternalOwners;
+
 ProcessBreakpointSet::ProcessBreakpointSet(Process* process)
     : process_(process) {
   FTL_DCHECK(process_);
 }
 
-bool ProcessBreakpointSet::InsertSoftwareBreakpoint(uintptr_t address,
-                                                    size_t kind) {
-  if (breakpoints_.find(address) != breakpoints_.end()) {
-    FTL_LOG(ERROR) << ftl::StringPrintf(
-        "Breakpoint already inserted at address: 0x%" PRIxPTR, address);
+bool ProcessBreakpointSet::InsertSoftwareBreakpoint(
+    uintptr_t address,
+    size_t kind,
+    ExpressionList conditions,
+    ExpressionList commands) {
+  // gdb inserts a breakpoint again when its conditions or commands change.
+  auto iter = breakpoints_.find(address);
+  if (iter == breakpoints_.end() || !(iter->second.owners & kOwnerClient) ||
+      iter->second.breakpoint->kind() != kind) {
+    if (!Insert(address, kind, kOwnerClient))
+      return false;
+    iter = breakpoints_.find(address);
+  }
+
+  iter->second.conditions = std::move(conditions);
+  iter->second.commands = std::move(commands);
+  return true;
+}
+
+bool ProcessBreakpointSet::RemoveSoftwareBreakpoint(uintptr_t address) {
+  return Remove(address, kOwnerClient);
+}
+
+bool ProcessBreakpointSet::InsertInternalBreakpoint(uintptr_t address) {
+  return Insert(address, GetDefaultSoftwareBreakpointKind(), kOwnerInternal);
+}
+
+bool ProcessBreakpointSet::RemoveInternalBreakpoint(uintptr_t address) {
+  return Remove(address, kOwnerInternal);
+}
+
+bool ProcessBreakpointSet::InsertTracepointBreakpoint(uintptr_t address) {
+  return Insert(address, GetDefaultSoftwareBreakpointKind(), kOwnerTracepoint);
+}
+
+bool ProcessBreakpointSet::RemoveTracepointBreakpoint(uintptr_t address) {
+  return Remove(address, kOwnerTracepoint);
+}
+
+bool ProcessBreakpointSet::HasClientBreakpoint(uintptr_t address) const {
+  auto iter = breakpoints_.find(address);
+  return iter != breakpoints_.end() && (iter->second.owners & kOwnerClient);
+}
+
+bool ProcessBreakpointSet::HasInternalBreakpoint(uintptr_t address) const {
+  if (!num_internal_)
     return false;
+  auto iter = breakpoints_.find(address);
+  return iter != breakpoints_.end() && (iter->second.owners & kInternalOwners);
+}
+
+bool ProcessBreakpointSet::HasTracepointBreakpoint(uintptr_t address) const {
+  if (!num_internal_)
+    return false;
+  auto iter = breakpoints_.find(address);
+  return iter != breakpoints_.end() &&
+         (iter->second.owners & kOwnerTracepoint);
+}
+
+const ProcessBreakpointSet::ExpressionList*
+ProcessBreakpointSet::GetConditions(uintptr_t address) const {
+  const Entry* entry = FindClientEntry(address);
+  return entry && !entry->conditions.empty() ? &entry->conditions : nullptr;
+}
+
+const ProcessBreakpointSet::ExpressionList*
+ProcessBreakpointSet::GetCommands(uintptr_t address) const {
+  const Entry* entry = FindClientEntry(address);
+  return entry && !entry->commands.empty() ? &entry->commands : nullptr;
+}
+
+void ProcessBreakpointSet::HideInternalBreakpoints(uintptr_t address,
+                                                   void* buffer,
+                                                   size_t length) const {
+  if (!num_internal_)
+    return;
+
+  uint8_t* bytes = static_cast<uint8_t*>(buffer);
+  for (const auto& iter : breakpoints_) {
+    const Entry& entry = iter.second;
+    // Breakpoints the client inserted are the client's business.
+    if (entry.owners & kOwnerClient)
+      continue;
+    const std::vector<uint8_t>& original = entry.breakpoint->original_bytes();
+    for (size_t i = 0; i < original.size(); ++i) {
+      uintptr_t byte_address = iter.first + i;
+      if (byte_address >= address && byte_address - address < length)
+        bytes[byte_address - address] = original[i];
+    }
   }
+}
 
-  std::unique_ptr<ProcessBreakpoint> breakpoint(
-      new SoftwareBreakpoint(address, kind, this));
-  if (!breakpoint->Insert()) {
-    FTL_LOG(ERROR) << "Failed to insert software breakpoint";
+bool ProcessBreakpointSet::SuspendBreakpoint(uintptr_t address) {
+  auto iter = breakpoints_.find(address);
+  if (iter == breakpoints_.end()) {
+    FTL_LOG(ERROR) << ftl::StringPrintf(
+        "No breakpoint inserted at address: 0x%" PRIxPTR, address);
     return false;
   }
 
-  breakpoints_[address] = std::move(breakpoint);
-  return true;
+  return iter->second.breakpoint->Remove();
 }
 
-bool ProcessBreakpointSet::RemoveSoftwareBreakpoint(uintptr_t address) {
+bool ProcessBreakpointSet::UnsuspendBreakpoint(uintptr_t address) {
   auto iter = breakpoints_.find(address);
   if (iter == breakpoints_.end()) {
+    // Removed by its owners in the interim.
+    return true;
+  }
+
+  SoftwareBreakpoint* breakpoint = iter->second.breakpoint.get();
+  return breakpoint->IsInserted() || breakpoint->Insert();
+}
+
+void ProcessBreakpointSet::Clear() {
+  for (auto& iter : breakpoints_)
+    iter.second.breakpoint->Abandon();
+  breakpoints_.clear();
+  num_internal_ = 0;
+}
+
+const ProcessBreakpointSet::Entry* ProcessBreakpointSet::FindClientEntry(
+    uintptr_t address) const {
+  auto iter = breakpoints_.find(address);
+  if (iter == breakpoints_.end() || !(iter->second.owners & kOwnerClient))
+    return nullptr;
+  return &iter->second;
+}
+
+bool ProcessBreakpointSet::Insert(uintptr_t address, size_t kind,
+                                  Owner owner) {
+  auto iter = breakpoints_.find(address);
+  if (iter != breakpoints_.end()) {
+    Entry& entry = iter->second;
+    if ((entry.owners & owner) || entry.breakpoint->kind() != kind) {
+      FTL_LOG(ERROR) << ftl::StringPrintf(
+          "Breakpoint already inserted at address: 0x%" PRIxPTR, address);
+      return false;
+    }
+    entry.owners |= owner;
+  } else {
+    std::unique_ptr<SoftwareBreakpoint> breakpoint(
+        new SoftwareBreakpoint(address, kind, this));
+    if (!breakpoint->Insert()) {
+      FTL_LOG(ERROR) << "Failed to insert software breakpoint";
+      return false;
+    }
+
+    Entry& entry = breakpoints_[address];
+    entry.breakpoint = std::move(breakpoint);
+    entry.owners = owner;
+  }
+
+  if (owner & kInternalOwners)
+    ++num_internal_;
+  return true;
+}
+
+bool ProcessBreakpointSet::Remove(uintptr_t address, Owner owner) {
+  auto iter = breakpoints_.find(address);
+  if (iter == breakpoints_.end() || !(iter->second.owners & owner)) {
     FTL_LOG(ERROR) << ftl::StringPrintf(
         "No breakpoint inserted at address: 0x%" PRIxPTR, address);
     return false;
   }
 
-  if (!iter->second->Remove()) {
-    FTL_LOG(ERROR) << "Failed to remove breakpoint";
-    return false;
+  Entry& entry = iter->second;
+  if (entry.owners == owner) {
+    // A breakpoint that is suspended for a step-over has nothing to remove,
+    // and neither does one in a process that's gone.
+    if (!process_->IsLive()) {
+      entry.breakpoint->Abandon();
+    } else if (entry.breakpoint->IsInserted() &&
+               !entry.breakpoint->Remove()) {
+      FTL_LOG(ERROR) << "Failed to remove breakpoint";
+      return false;
+    }
+    breakpoints_.erase(iter);
+  } else {
+    entry.owners &= ~owner;
+    if (owner == kOwnerClient) {
+      entry.conditions.clear();
+      entry.commands.clear();
+    }
   }
 
-  breakpoints_.erase(iter);
+  if (owner & kInternalOwners)
+    --num_internal_;
   return true;
 }
 
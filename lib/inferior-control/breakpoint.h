@@ -10,6 +10,8 @@
 
 #include "lib/ftl/macros.h"
 
+#include "debugger-utils/agent-expression.h"
+
 namespace debugserver {
 
 class Process;
@@ -77,6 +79,14 @@ class SoftwareBreakpoint final : public ProcessBreakpoint {
   bool Remove() override;
   bool IsInserted() const override;
 
+  // The contents of memory that the breakpoint instruction replaced.
+  // Empty if the breakpoint isn't inserted.
+  const std::vector<uint8_t>& original_bytes() const { return original_bytes_; }
+
+  // Treats the breakpoint as removed without restoring the original bytes,
+  // for when there is no process to restore them in.
+  void Abandon() { original_bytes_.clear(); }
+
  private:
   SoftwareBreakpoint() = default;
 
@@ -90,6 +100,11 @@ class SoftwareBreakpoint final : public ProcessBreakpoint {
 
 // Represents a collection of breakpoints managed by a process and defines
 // operations for adding and removing them.
+// Besides the breakpoints requested by the client, debugserver can insert
+// "internal" breakpoints of its own (e.g., to track the dynamic linker).
+// A client and an internal breakpoint can share an address: the breakpoint
+// instruction is only removed once neither wants it.
+// Once the process is gone removing a breakpoint only drops its entry.
 class ProcessBreakpointSet final {
  public:
   explicit ProcessBreakpointSet(Process* process);
@@ -98,22 +113,104 @@ class ProcessBreakpointSet final {
   // Returns a pointer to the process that this object belongs to.
   Process* process() const { return process_; }
 
+  // Agent expressions the client attaches to its breakpoints.
+  using ExpressionList = std::vector<std::unique_ptr<util::AgentExpression>>;
+
   // Inserts a software breakpoint at the specified memory address with the
   // given kind. |kind| is an architecture dependent parameter that specifies
   // how many bytes the software breakpoint spans. Returns true on success or
   // false on failure.
-  bool InsertSoftwareBreakpoint(uintptr_t address, size_t kind);
+  // If |conditions| isn't empty the breakpoint only applies when one of them
+  // holds. If |commands| isn't empty they are run when the breakpoint
+  // applies, and the thread then carries on without stopping (this is how
+  // gdb's dprintf works). Inserting a breakpoint that the client already has
+  // replaces its conditions and commands.
+  bool InsertSoftwareBreakpoint(uintptr_t address,
+                                size_t kind,
+                                ExpressionList conditions,
+                                ExpressionList commands);
 
   // Removes the software breakpoint that was previously inserted at the given
   // address. Returns false if there is an error of a breakpoint was not
   // previously inserted at the given address. Returns true on success.
   bool RemoveSoftwareBreakpoint(uintptr_t address);
 
+  // Inserts and removes internal breakpoints. These are software breakpoints
+  // of the architecture's default kind.
+  bool InsertInternalBreakpoint(uintptr_t address);
+  bool RemoveInternalBreakpoint(uintptr_t address);
+
+  // Inserts and removes the breakpoints of tracepoints. Like internal
+  // breakpoints these are hidden from the client and threads are stepped
+  // over them when resumed.
+  bool InsertTracepointBreakpoint(uintptr_t address);
+  bool RemoveTracepointBreakpoint(uintptr_t address);
+
+  // Returns true if there is a client, respectively internal (including
+  // tracepoint), respectively tracepoint, breakpoint at |address|.
+  bool HasClientBreakpoint(uintptr_t address) const;
+  bool HasInternalBreakpoint(uintptr_t address) const;
+  bool HasTracepointBreakpoint(uintptr_t address) const;
+
+  // Returns the conditions, respectively commands, of the client breakpoint
+  // at |address|, or nullptr if there is no such breakpoint or it has none.
+  const ExpressionList* GetConditions(uintptr_t address) const;
+  const ExpressionList* GetCommands(uintptr_t address) const;
+
+  // Returns true if there are any internal breakpoints.
+  bool HasInternalBreakpoints() const { return num_internal_ != 0; }
+
+  // Replaces the breakpoint instructions of internal breakpoints within
+  // |address|, |length| in |buffer|, which holds the contents of that memory,
+  // with what they replaced. The client doesn't know about these and
+  // shouldn't see them.
+  void HideInternalBreakpoints(uintptr_t address,
+                               void* buffer,
+                               size_t length) const;
+
+  // Temporarily restores the original instruction at |address|, e.g. so that
+  // a thread can step over it, and puts the breakpoint back. Both owners'
+  // claims on the breakpoint are kept.
+  bool SuspendBreakpoint(uintptr_t address);
+  bool UnsuspendBreakpoint(uintptr_t address);
+
+  // Drops all software breakpoints without touching the inferior's memory,
+  // for when the process is gone or detached from.
+  void Clear();
+
  private:
+  // Who wants the breakpoint at a given address.
+  enum Owner : uint32_t {
+    kOwnerClient = 1u << 0,
+    kOwnerInternal = 1u << 1,
+    kOwnerTracepoint = 1u << 2,
+  };
+
+  // The owners whose breakpoints the client doesn't know about.
+  static constexpr uint32_t kInternalOwners = kOwnerInternal | kOwnerTracepoint;
+
+  struct Entry {
+    std::unique_ptr<SoftwareBreakpoint> breakpoint;
+    // Bitmask of Owner values.
+    uint32_t owners = 0;
+    // The client's conditions and commands, if any.
+    ExpressionList conditions;
+    ExpressionList commands;
+  };
+
+  // Returns the entry of the client breakpoint at |address|, or nullptr.
+  const Entry* FindClientEntry(uintptr_t address) const;
+
+  bool Insert(uintptr_t address, size_t kind, Owner owner);
+  bool Remove(uintptr_t address, Owner owner);
+
   Process* process_;  // weak
 
   // All currently inserted breakpoints.
-  std::unordered_map<uintptr_t, std::unique_ptr<Breakpoint>> breakpoints_;
+  std::unordered_map<uintptr_t, Entry> breakpoints_;
+
+  // The number of claims on entries in |breakpoints_| by kInternalOwners.
+  size_t num_internal_ = 0;
 
   FTL_DISALLOW_COPY_AND_ASSIGN(ProcessBreakpointSet);
 };
@@ -174,6 +271,14 @@ class ThreadBreakpointSet final {
   // Returns true if a single-step breakpoint is inserted.
   bool SingleStepBreakpointInserted();
 
+  // Records that the thread's current stop is due to a write to watched
+  // memory at |address|, respectively that it isn't.
+  void SetWatchpointHit(uintptr_t address) { watchpoint_hit_ = address; }
+  void ClearWatchpointHit() { watchpoint_hit_ = 0; }
+
+  // Returns the address recorded by SetWatchpointHit(), or zero.
+  uintptr_t watchpoint_hit() const { return watchpoint_hit_; }
+
  private:
   Thread* thread_;  // weak
 
@@ -183,8 +288,18 @@ class ThreadBreakpointSet final {
   // There can be only one singlestep breakpoint.
   std::unique_ptr<ThreadBreakpoint> single_step_breakpoint_;
 
+  uintptr_t watchpoint_hit_ = 0;
+
   FTL_DISALLOW_COPY_AND_ASSIGN(ThreadBreakpointSet);
 };
 
+// Returns the kind of software breakpoint debugserver uses for its own
+// breakpoints.
+size_t GetDefaultSoftwareBreakpointKind();
+
+// Returns the address of the software breakpoint instruction that was hit,
+// given the pc reported in the resulting exception.
+uintptr_t GetSoftwareBreakpointAddress(uintptr_t pc);
+
 }  // namespace arch
 }  // namespace debugserver
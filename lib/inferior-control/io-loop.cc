@@ -4,16 +4,60 @@
 
 #include "io-loop.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <cstring>
+
 #include "lib/ftl/logging.h"
-#include "lib/mtl/handles/object_info.h"
-#include "lib/mtl/tasks/message_loop.h"
-#include "lib/mtl/threading/create_thread.h"
 
 #include "debugger-utils/util.h"
 
 namespace debugserver {
+namespace {
+
+// The maximum number of iovecs we pass to a single writev call.
+constexpr size_t kMaxIovecs = 64;
+
+// Appends the part of |bytes| past the first |*skip| bytes to |iov|, if
+// non-empty, and reduces |*skip| by the number of bytes skipped.
+void AppendIovec(const ftl::StringView& bytes,
+                 size_t* skip,
+                 struct iovec* iov,
+                 size_t* iovcnt) {
+  if (*skip >= bytes.size()) {
+    *skip -= bytes.size();
+    return;
+  }
+  iov[*iovcnt].iov_base = const_cast<char*>(bytes.data()) + *skip;
+  iov[*iovcnt].iov_len = bytes.size() - *skip;
+  ++*iovcnt;
+  *skip = 0;
+}
+
+}  // namespace
+
+IOLoop::WriteBuffer::WriteBuffer(std::shared_ptr<const std::string> body)
+    : body_(std::move(body)) {}
+
+void IOLoop::WriteBuffer::SetHeader(const ftl::StringView& bytes) {
+  FTL_DCHECK(bytes.size() <= kMaxInlineSize);
+  memcpy(header_.data(), bytes.data(), bytes.size());
+  header_size_ = bytes.size();
+}
+
+void IOLoop::WriteBuffer::SetTrailer(const ftl::StringView& bytes) {
+  FTL_DCHECK(bytes.size() <= kMaxInlineSize);
+  memcpy(trailer_.data(), bytes.data(), bytes.size());
+  trailer_size_ = bytes.size();
+}
+
+size_t IOLoop::WriteBuffer::size() const {
+  return header_size_ + body().size() + trailer_size_;
+}
 
 IOLoop::IOLoop(int fd, Delegate* delegate)
     : quit_called_(false), fd_(fd), delegate_(delegate), is_running_(false) {
@@ -21,81 +65,222 @@ IOLoop::IOLoop(int fd, Delegate* delegate)
   FTL_DCHECK(delegate_);
   FTL_DCHECK(mtl::MessageLoop::GetCurrent());
 
-  origin_task_runner_ = mtl::MessageLoop::GetCurrent()->task_runner();
+  message_loop_ = mtl::MessageLoop::GetCurrent();
 }
 
 IOLoop::~IOLoop() {
   Quit();
 }
 
-void IOLoop::Run() {
+bool IOLoop::Run() {
   FTL_DCHECK(!is_running_);
 
+  int flags = fcntl(fd_, F_GETFL);
+  if (flags < 0 || fcntl(fd_, F_SETFL, flags | O_NONBLOCK) < 0) {
+    FTL_LOG(ERROR) << "Failed to make socket non-blocking" << ", "
+                   << util::ErrnoString(errno);
+    return false;
+  }
+
+  io_ = __mxio_fd_to_io(fd_);
+  if (!io_) {
+    FTL_LOG(ERROR) << "Failed to obtain mxio object for socket";
+    return false;
+  }
+
   is_running_ = true;
-  read_thread_ = mtl::CreateThread(&read_task_runner_, "i/o loop read task");
-  write_thread_ = mtl::CreateThread(&write_task_runner_, "i/o loop write task");
+  WaitForEvents();
 
-  StartReadLoop();
+  return true;
 }
 
 void IOLoop::Quit() {
-  FTL_DCHECK(is_running_);
+  if (!is_running_)
+    return;
 
   FTL_LOG(INFO) << "Quitting socket I/O loop";
 
   quit_called_ = true;
+  is_running_ = false;
 
-  auto quit_task = [] {
-    // Tell the thread-local message loop to quit.
-    FTL_DCHECK(mtl::MessageLoop::GetCurrent());
-    mtl::MessageLoop::GetCurrent()->QuitNow();
-  };
-  read_task_runner_->PostTask(quit_task);
-  write_task_runner_->PostTask(quit_task);
+  StopWaiting();
+  __mxio_release(io_);
+  io_ = nullptr;
 
-  if (read_thread_.joinable())
-    read_thread_.join();
-  if (write_thread_.joinable())
-    write_thread_.join();
+  if (!pending_writes_.empty()) {
+    FTL_LOG(WARNING) << "Dropping " << pending_writes_.size()
+                     << " unsent buffer(s)";
+    pending_writes_.clear();
+  }
 
   FTL_LOG(INFO) << "Socket I/O loop exited";
 }
 
-void IOLoop::StartReadLoop() {
-  // Make sure the call is coming from the origin thread.
-  FTL_DCHECK(mtl::MessageLoop::GetCurrent()->task_runner().get() ==
-             origin_task_runner_.get());
+void IOLoop::PostWriteTask(const WriteBuffer& buffer) {
+  FTL_DCHECK(mtl::MessageLoop::GetCurrent() == message_loop_);
+
+  pending_writes_.push_back(buffer);
+  if (flush_posted_)
+    return;
 
-  read_task_runner_->PostTask(std::bind(&IOLoop::OnReadTask, this));
+  // Defer writing until the current task is done, so that everything it sends
+  // goes out in one system call.
+  // TODO(armansito): Pass a refptr/weakptr to |this|?
+  flush_posted_ = true;
+  message_loop_->task_runner()->PostTask([this] { FlushPendingWrites(); });
 }
 
 void IOLoop::PostWriteTask(const ftl::StringView& bytes) {
-  // We copy the data into the closure.
-  // TODO(armansito): Pass a refptr/weaktpr to |this|?
-  write_task_runner_->PostTask([ this, bytes = bytes.ToString() ] {
-    ssize_t bytes_written = write(fd_, bytes.data(), bytes.size());
-
-    // This cast isn't really safe, then again it should be virtually
-    // impossible to send a large enough packet to cause an overflow (at
-    // least with the GDB Remote protocol).
-    if (bytes_written != static_cast<ssize_t>(bytes.size())) {
+  PostWriteTask(
+      WriteBuffer(std::make_shared<const std::string>(bytes.ToString())));
+}
+
+void IOLoop::FlushPendingWrites() {
+  flush_posted_ = false;
+  if (quit_called_)
+    return;
+
+  // If we're waiting for the socket to become writable then there's no point
+  // in trying now. The new buffers will be written along with the others.
+  if (wait_events_ & MXIO_EVT_WRITABLE)
+    return;
+
+  if (!WritePendingBuffers()) {
+    ReportError();
+    return;
+  }
+
+  WaitForEvents();
+}
+
+bool IOLoop::WritePendingBuffers() {
+  struct iovec iov[kMaxIovecs];
+
+  while (!pending_writes_.empty()) {
+    size_t iovcnt = 0;
+    size_t skip = write_offset_;
+    for (const auto& buffer : pending_writes_) {
+      if (iovcnt + 3 > kMaxIovecs)
+        break;
+      AppendIovec(buffer.header(), &skip, iov, &iovcnt);
+      AppendIovec(buffer.body(), &skip, iov, &iovcnt);
+      AppendIovec(buffer.trailer(), &skip, iov, &iovcnt);
+    }
+
+    ssize_t bytes_written = writev(fd_, iov, iovcnt);
+    if (bytes_written < 0) {
+      if (errno == EINTR)
+        continue;
+      // The socket is full, wait for it to become writable again.
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return true;
       FTL_LOG(ERROR) << "Failed to send bytes" << ", "
                      << util::ErrnoString(errno);
+      return false;
+    }
+    if (bytes_written == 0)
+      return true;
+
+    // Drop the buffers that have been completely written.
+    write_offset_ += bytes_written;
+    while (!pending_writes_.empty() &&
+           write_offset_ >= pending_writes_.front().size()) {
+      const WriteBuffer& buffer = pending_writes_.front();
+      FTL_VLOG(2) << "<- " << util::EscapeNonPrintableString(buffer.header())
+                  << util::EscapeNonPrintableString(buffer.body())
+                  << util::EscapeNonPrintableString(buffer.trailer());
+      write_offset_ -= buffer.size();
+      pending_writes_.pop_front();
+    }
+  }
+
+  return true;
+}
+
+void IOLoop::WaitForEvents() {
+  if (quit_called_)
+    return;
+
+  uint32_t events = MXIO_EVT_READABLE;
+  if (!pending_writes_.empty())
+    events |= MXIO_EVT_WRITABLE;
+
+  // Handlers stay registered until removed, so if we're already waiting for
+  // the right events there's nothing to do.
+  if (handler_key_ && events == wait_events_)
+    return;
+
+  StopWaiting();
+
+  mx_signals_t signals = 0;
+  wait_handle_ = MX_HANDLE_INVALID;
+  __mxio_wait_begin(io_, events, &wait_handle_, &signals);
+  if (wait_handle_ == MX_HANDLE_INVALID) {
+    FTL_LOG(ERROR) << "Failed to obtain handle to wait on socket";
+    ReportError();
+    return;
+  }
+
+  wait_events_ = events;
+  handler_key_ = message_loop_->AddHandler(this, wait_handle_, signals);
+}
+
+void IOLoop::StopWaiting() {
+  if (!handler_key_)
+    return;
+  message_loop_->RemoveHandler(handler_key_);
+  handler_key_ = 0;
+  wait_events_ = 0;
+}
+
+void IOLoop::OnHandleReady(mx_handle_t handle,
+                           mx_signals_t pending,
+                           uint64_t count) {
+  FTL_DCHECK(handle == wait_handle_);
+
+  uint32_t events = 0;
+  __mxio_wait_end(io_, pending, &events);
+
+  // Let the subclass read before checking for errors: a peer that sends
+  // some bytes and then closes the connection raises both at once.
+  if (events & (MXIO_EVT_READABLE | MXIO_EVT_ERROR)) {
+    if (!OnReadable())
+      return;
+  }
+
+  if (events & MXIO_EVT_WRITABLE) {
+    if (!WritePendingBuffers()) {
       ReportError();
       return;
     }
-    FTL_VLOG(2) << "<- " << util::EscapeNonPrintableString(bytes);
-  });
+  }
+
+  WaitForEvents();
+}
+
+void IOLoop::OnHandleError(mx_handle_t handle, mx_status_t error) {
+  FTL_LOG(ERROR) << "Error waiting on socket" << ", "
+                 << util::MxErrorString(error);
+  // The message loop has already removed the handler.
+  handler_key_ = 0;
+  wait_events_ = 0;
+  ReportError();
 }
 
 void IOLoop::ReportError() {
-  // TODO(armansito): Pass a refptr/weakptr to |this|?
-  origin_task_runner_->PostTask([this] { delegate_->OnIOError(); });
+  if (quit_called_)
+    return;
+  quit_called_ = true;
+  StopWaiting();
+  delegate_->OnIOError();
 }
 
 void IOLoop::ReportDisconnected() {
-  // TODO(armansito): Pass a refptr/weakptr to |this|?
-  origin_task_runner_->PostTask([this] { delegate_->OnDisconnected(); });
+  if (quit_called_)
+    return;
+  quit_called_ = true;
+  StopWaiting();
+  delegate_->OnDisconnected();
 }
 
 }  // namespace debugserver
@@ -4,39 +4,43 @@
 
 #pragma once
 
-#include <atomic>
 #include <array>
-#include <thread>
+#include <deque>
+#include <memory>
+#include <string>
+
+#include <mxio/io.h>
 
 #include "lib/ftl/macros.h"
 #include "lib/ftl/memory/ref_ptr.h"
 #include "lib/ftl/strings/string_view.h"
 #include "lib/ftl/tasks/task_runner.h"
+#include "lib/mtl/tasks/message_loop.h"
+#include "lib/mtl/tasks/message_loop_handler.h"
 
 namespace debugserver {
 
-// Maintains dedicated threads for reads and writes on a given socket file
-// descriptor and allows read and write tasks to be scheduled from a single
-// origin thread.
-//
-// This class is thread-safe as long as all the public methods are accessed from
-// the thread that initialized this instance.
+// Performs non-blocking reads and writes on a given socket file descriptor,
+// driven by the MessageLoop of the thread that created it. The kernel handle
+// and signals backing the descriptor are obtained from mxio and registered
+// with the message loop, so there are no I/O threads: reads are done when the
+// socket becomes readable and the delegate is called right away, and writes
+// are done directly, falling back to waiting for the socket to become
+// writable when it can't take everything at once.
 //
-// TODO(armansito): This is a temporary solution until there is a
-// mxio_get_handle (or equivalent) interface to get a mx_handle_t from socket
-// fd to use with mtl::MessageLoop::AddHandler. That way we can avoid blocking
-// reads and writes while also using a single thread. Then again this works fine
-// too.
-class IOLoop {
+// This class is not thread-safe. All methods must be called on the thread
+// that created this instance.
+class IOLoop : public mtl::MessageLoopHandler {
  public:
-  // Delegate class for receiving asynchronous events for the result of
-  // read/write operations. All operations will be posted on the MessageLoop of
-  // the thread on which the IOLoop object was created.
+  // Delegate class for receiving events for the result of read/write
+  // operations. All methods are called on the thread on which the IOLoop
+  // object was created.
   class Delegate {
    public:
     virtual ~Delegate() = default;
 
-    // Called when new bytes have been read from the socket.
+    // Called when new bytes have been read from the socket. |bytes_read| is
+    // only valid for the duration of the call.
     virtual void OnBytesRead(const ftl::StringView& bytes_read) = 0;
 
     // Called when the remote end closes the TCP connection.
@@ -46,41 +50,80 @@ class IOLoop {
     virtual void OnIOError() = 0;
   };
 
+  // A unit of outgoing data: |header|, followed by |body|, followed by
+  // |trailer|. The body is reference counted and immutable, so it is shared
+  // rather than copied when queued for writing, and a buffer can
+  // be kept around and posted again (e.g., to retransmit a packet) cheaply.
+  // The header and trailer are small and are stored inline, which lets
+  // protocol framing be added around a body without copying it.
+  class WriteBuffer final {
+   public:
+    // The maximum size of the header and of the trailer.
+    constexpr static size_t kMaxInlineSize = 4;
+
+    WriteBuffer() = default;
+    explicit WriteBuffer(std::shared_ptr<const std::string> body);
+
+    // Sets the bytes written before and after the body. |bytes| must be no
+    // larger than kMaxInlineSize.
+    void SetHeader(const ftl::StringView& bytes);
+    void SetTrailer(const ftl::StringView& bytes);
+
+    ftl::StringView header() const {
+      return ftl::StringView(header_.data(), header_size_);
+    }
+    ftl::StringView body() const {
+      return body_ ? ftl::StringView(*body_) : ftl::StringView();
+    }
+    ftl::StringView trailer() const {
+      return ftl::StringView(trailer_.data(), trailer_size_);
+    }
+
+    // Returns the total number of bytes in this buffer.
+    size_t size() const;
+
+   private:
+    std::array<char, kMaxInlineSize> header_;
+    size_t header_size_ = 0;
+    std::shared_ptr<const std::string> body_;
+    std::array<char, kMaxInlineSize> trailer_;
+    size_t trailer_size_ = 0;
+  };
+
   // Does not take ownership of any of the parameters. Care should be taken to
   // make sure that |delegate| and |fd| outlive this object.
   IOLoop(int fd, Delegate* delegate);
 
-  // The destructor calls Quit() and thus it may block.
+  // The destructor calls Quit().
   virtual ~IOLoop();
 
-  // Initializes the underlying threads and message loops and runs them.
-  void Run();
+  // Puts the file descriptor in non-blocking mode and starts waiting for
+  // incoming bytes. Returns false if there is an error.
+  bool Run();
 
-  // Quits the underlying message loops and block until the underlying threads
-  // complete their tasks and join. Since the threads do blocking work
-  // (read/write) this may block until either pending read and/or write returns.
+  // Stops waiting for events on the file descriptor. Any buffers that haven't
+  // been written yet are dropped.
   void Quit();
 
-  // Posts an asynchronous task on the message loop to send a packet.
+  // Queues |buffer| to be sent. Buffers queued while handling the same task
+  // (e.g., the acks and replies for all the packets received in a single
+  // read) are sent together with a single writev call once that task
+  // completes.
+  void PostWriteTask(const WriteBuffer& buffer);
+
+  // Same as above, but copies |bytes| into a new buffer first.
   void PostWriteTask(const ftl::StringView& bytes);
 
  protected:
   bool quit_called() const { return quit_called_; }
   int fd() const { return fd_; }
   Delegate* delegate() const { return delegate_; }
-  const ftl::RefPtr<ftl::TaskRunner>& origin_task_runner() const {
-    return origin_task_runner_;
-  }
-  const ftl::RefPtr<ftl::TaskRunner>& read_task_runner() const {
-    return read_task_runner_;
-  }
-  const ftl::RefPtr<ftl::TaskRunner>& write_task_runner() const {
-    return write_task_runner_;
-  }
-
-  // Helper method for StartReadTask, only called from the read thread.
-  // Process one read request.
-  virtual void OnReadTask() = 0;
+
+  // Called when the file descriptor is readable. Implementations should read
+  // until no more bytes are available (i.e. read() fails with EAGAIN) and
+  // pass them on to the delegate. Returns false if we should stop waiting for
+  // bytes, i.e. after calling ReportError() or ReportDisconnected().
+  virtual bool OnReadable() = 0;
 
   // Notifies the delegate that there has been an I/O error.
   void ReportError();
@@ -89,13 +132,29 @@ class IOLoop {
  private:
   IOLoop() = default;
 
-  // Posts an asynchronous task on to listen for an incoming packet. This
-  // initiates a loop that always reads for incoming packets. Called from Run().
-  void StartReadLoop();
+  // (Re-)registers with the message loop to wait for the file descriptor to
+  // become readable, and writable if there are bytes waiting to be written.
+  void WaitForEvents();
 
-  // True if Quit() was called. This tells the |read_thread| to terminate its
-  // loop as soon as any blocking call to read returns.
-  std::atomic_bool quit_called_;
+  // Unregisters from the message loop, if registered.
+  void StopWaiting();
+
+  // Writes as much of |pending_writes_| as the socket will take without
+  // blocking. Returns false on error.
+  bool WritePendingBuffers();
+
+  // Called at the end of the task in which buffers were queued.
+  void FlushPendingWrites();
+
+  // mtl::MessageLoopHandler overrides.
+  void OnHandleReady(mx_handle_t handle,
+                     mx_signals_t pending,
+                     uint64_t count) override;
+  void OnHandleError(mx_handle_t handle, mx_status_t error) override;
+
+  // True if Quit() was called, or an error or disconnect was reported. Once
+  // set we no longer wait for events.
+  bool quit_called_;
 
   // The socket file descriptor.
   int fd_;
@@ -106,17 +165,27 @@ class IOLoop {
   // True, if Run() has been called.
   bool is_running_;
 
-  // The origin task runner used to post delegate events to the thread that
-  // created this object.
-  ftl::RefPtr<ftl::TaskRunner> origin_task_runner_;
+  // The message loop of the thread that created this object.
+  mtl::MessageLoop* message_loop_;  // weak
+
+  // The mxio object for |fd_|, used to map I/O events to kernel signals.
+  mxio_t* io_ = nullptr;
+
+  // The key for our message loop handler, if we're currently waiting on the
+  // handle in |wait_handle_|.
+  mtl::MessageLoop::HandlerKey handler_key_ = 0;
+  mx_handle_t wait_handle_ = MX_HANDLE_INVALID;
+
+  // The I/O events we are currently waiting for.
+  uint32_t wait_events_ = 0;
 
-  // The task runners for the I/O threads.
-  ftl::RefPtr<ftl::TaskRunner> read_task_runner_;
-  ftl::RefPtr<ftl::TaskRunner> write_task_runner_;
+  // Buffers queued by PostWriteTask() that haven't been written out yet, and
+  // the number of bytes of the first one that have already been written.
+  std::deque<WriteBuffer> pending_writes_;
+  size_t write_offset_ = 0;
 
-  // The I/O threads.
-  std::thread read_thread_;
-  std::thread write_thread_;
+  // True if FlushPendingWrites() has been posted but has not run yet.
+  bool flush_posted_ = false;
 
   FTL_DISALLOW_COPY_AND_ASSIGN(IOLoop);
 };
@@ -0,0 +1,267 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "memory-cache.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+#include "lib/ftl/logging.h"
+#include "lib/ftl/strings/string_printf.h"
+
+#include "process.h"
+
+namespace debugserver {
+
+constexpr size_t MemoryCache::kPageSize;
+constexpr size_t MemoryCache::kMaxPages;
+constexpr size_t MemoryCache::kMaxReadaheadPages;
+
+MemoryCache::MemoryCache(Process* process,
+                         std::shared_ptr<ProcessMemory> memory)
+    : process_(process), memory_(std::move(memory)) {
+  FTL_DCHECK(process_);
+  FTL_DCHECK(memory_);
+}
+
+bool MemoryCache::Read(uintptr_t address,
+                       void* out_buffer,
+                       size_t length) const {
+  FTL_DCHECK(out_buffer);
+
+  if (!CheckCoherent() || !IsCacheable(address, length)) {
+    ++stats_.reads;
+    return memory_->Read(address, out_buffer, length);
+  }
+
+  if (address != next_sequential_address_)
+    readahead_pages_ = 1;
+  next_sequential_address_ = address + length;
+
+  if (IsCached(address, length)) {
+    ++stats_.hits;
+  } else {
+    ++stats_.misses;
+  }
+  return ReadThroughCache(address, out_buffer, length);
+}
+
+bool MemoryCache::ReadV(const ReadRange* ranges, size_t num_ranges) const {
+  if (!CheckCoherent())
+    return memory_->ReadV(ranges, num_ranges);
+
+  // Collect every missing page first so that neighbouring ones, even from
+  // different ranges, are read together.
+  std::vector<uintptr_t> missing;
+  for (size_t i = 0; i < num_ranges; ++i) {
+    const ReadRange& range = ranges[i];
+    if (!IsCacheable(range.address, range.length))
+      continue;
+    if (IsCached(range.address, range.length)) {
+      ++stats_.hits;
+      continue;
+    }
+    ++stats_.misses;
+    uintptr_t last_page_address =
+        (range.address + (range.length - 1)) & ~(kPageSize - 1);
+    for (uintptr_t page_address = range.address & ~(kPageSize - 1);;
+         page_address += kPageSize) {
+      if (!pages_.count(page_address))
+        missing.push_back(page_address);
+      if (page_address == last_page_address)
+        break;
+    }
+  }
+
+  std::sort(missing.begin(), missing.end());
+  missing.erase(std::unique(missing.begin(), missing.end()), missing.end());
+  for (size_t i = 0; i < missing.size();) {
+    size_t num_pages = 1;
+    while (i + num_pages < missing.size() &&
+           missing[i + num_pages] == missing[i] + num_pages * kPageSize)
+      ++num_pages;
+    // Failures are dealt with below, range by range.
+    FillPages(missing[i], num_pages);
+    i += num_pages;
+  }
+
+  for (size_t i = 0; i < num_ranges; ++i) {
+    const ReadRange& range = ranges[i];
+    bool ok;
+    if (IsCacheable(range.address, range.length)) {
+      ok = ReadThroughCache(range.address, range.out_buffer, range.length);
+    } else {
+      ++stats_.reads;
+      ok = memory_->Read(range.address, range.out_buffer, range.length);
+    }
+    if (!ok)
+      return false;
+  }
+
+  return true;
+}
+
+bool MemoryCache::Write(uintptr_t address,
+                        const void* buffer,
+                        size_t length) const {
+  FTL_DCHECK(buffer);
+
+  bool written = memory_->Write(address, buffer, length);
+  if (length == 0 || pages_.empty())
+    return written;
+
+  // Keep cached copies in sync. If the write failed we don't know what the
+  // memory contains now, so drop them.
+  uintptr_t end = address + std::min<uintptr_t>(
+      length - 1, std::numeric_limits<uintptr_t>::max() - address);
+  const uint8_t* in = static_cast<const uint8_t*>(buffer);
+  for (uintptr_t page_address = address & ~(kPageSize - 1);;
+       page_address += kPageSize) {
+    auto iter = pages_.find(page_address);
+    if (iter != pages_.end()) {
+      if (written) {
+        uintptr_t start = std::max(address, page_address);
+        size_t count =
+            std::min(end, page_address + (kPageSize - 1)) - start + 1;
+        memcpy(iter->second->data() + (start - page_address),
+               in + (start - address), count);
+      } else {
+        pages_.erase(iter);
+      }
+    }
+    if (page_address == (end & ~(kPageSize - 1)))
+      break;
+  }
+
+  return written;
+}
+
+void MemoryCache::Invalidate() {
+  pages_.clear();
+  next_sequential_address_ = 0;
+  readahead_pages_ = 1;
+}
+
+void MemoryCache::set_enabled(bool enabled) {
+  enabled_ = enabled;
+  Invalidate();
+}
+
+bool MemoryCache::CheckCoherent() const {
+  if (!enabled_)
+    return false;
+  if (process_->AllThreadsStopped())
+    return true;
+
+  // Invalidate() isn't const, but the cache is mutable for Read()'s sake.
+  if (!pages_.empty()) {
+    pages_.clear();
+    next_sequential_address_ = 0;
+    readahead_pages_ = 1;
+  }
+  return false;
+}
+
+bool MemoryCache::IsCacheable(uintptr_t address, size_t length) const {
+  // Reads that wrap around the address space are left to fail in the kernel.
+  return enabled_ && length > 0 &&
+         address <= std::numeric_limits<uintptr_t>::max() - (length - 1);
+}
+
+bool MemoryCache::IsCached(uintptr_t address, size_t length) const {
+  uintptr_t last_page_address = (address + (length - 1)) & ~(kPageSize - 1);
+  for (uintptr_t page_address = address & ~(kPageSize - 1);;
+       page_address += kPageSize) {
+    if (!pages_.count(page_address))
+      return false;
+    if (page_address == last_page_address)
+      return true;
+  }
+}
+
+bool MemoryCache::ReadThroughCache(uintptr_t address,
+                                   void* out_buffer,
+                                   size_t length) const {
+  uintptr_t end = address + (length - 1);
+  uintptr_t last_page_address = end & ~(kPageSize - 1);
+  uint8_t* out = static_cast<uint8_t*>(out_buffer);
+  for (uintptr_t page_address = address & ~(kPageSize - 1);;
+       page_address += kPageSize) {
+    const Page* page = GetPage(page_address, last_page_address);
+    if (!page) {
+      // Let the inferior have the final say on what's readable, and report
+      // the error if any.
+      ++stats_.reads;
+      return memory_->Read(address, out_buffer, length);
+    }
+    uintptr_t start = std::max(address, page_address);
+    size_t count = std::min(end, page_address + (kPageSize - 1)) - start + 1;
+    memcpy(out + (start - address), page->data() + (start - page_address),
+           count);
+    if (page_address == last_page_address)
+      break;
+  }
+
+  return true;
+}
+
+const MemoryCache::Page* MemoryCache::GetPage(
+    uintptr_t page_address,
+    uintptr_t last_page_address) const {
+  auto iter = pages_.find(page_address);
+  if (iter != pages_.end())
+    return iter->second.get();
+
+  // Read all the pages still needed by the request in one go, plus any
+  // readahead, but stop short of pages we already have.
+  size_t needed_pages = (last_page_address - page_address) / kPageSize + 1;
+  size_t max_pages = std::max(needed_pages, readahead_pages_);
+  size_t num_pages = 1;
+  while (num_pages < max_pages) {
+    uintptr_t next = page_address + num_pages * kPageSize;
+    if (next == 0 || pages_.count(next))
+      break;
+    ++num_pages;
+  }
+  readahead_pages_ = std::min(readahead_pages_ * 2, kMaxReadaheadPages);
+
+  // Readahead can run off the end of a mapping, in which case just read what
+  // is needed.
+  if (!FillPages(page_address, num_pages)) {
+    size_t min_pages = std::min(num_pages, needed_pages);
+    if (min_pages == num_pages || !FillPages(page_address, min_pages))
+      return nullptr;
+  }
+
+  return pages_[page_address].get();
+}
+
+bool MemoryCache::FillPages(uintptr_t page_address, size_t num_pages) const {
+  FTL_DCHECK(num_pages > 0);
+
+  std::unique_ptr<uint8_t[]> buffer(new uint8_t[num_pages * kPageSize]);
+  ++stats_.reads;
+  if (!memory_->TryRead(page_address, buffer.get(), num_pages * kPageSize))
+    return false;
+
+  FTL_VLOG(3) << ftl::StringPrintf("Caching %zu pages at 0x%" PRIxPTR,
+                                   num_pages, page_address);
+
+  // Crude, but a stop rarely touches this much memory.
+  if (pages_.size() + num_pages > kMaxPages)
+    pages_.clear();
+
+  for (size_t i = 0; i < num_pages; ++i) {
+    std::unique_ptr<Page> page(new Page);
+    memcpy(page->data(), buffer.get() + i * kPageSize, kPageSize);
+    pages_[page_address + i * kPageSize] = std::move(page);
+  }
+
+  return true;
+}
+
+}  // namespace debugserver
@@ -0,0 +1,120 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+
+#include "lib/ftl/macros.h"
+
+#include "debugger-utils/byte-block.h"
+
+#include "memory-process.h"
+
+namespace debugserver {
+
+class Process;
+
+// A read-through cache of inferior memory, kept in pages.
+//
+// While the inferior is stopped its memory doesn't change behind our back,
+// yet the same pages are read over and over: by the debugger, by
+// DsoList::Fetch(), by the ELF reader. The cache holds on to what has been
+// read until Invalidate() is called, which must happen whenever any thread of
+// the inferior may run. Writes go straight through to the inferior and
+// update any cached copy.
+//
+// In non-stop mode other threads keep running while one is stopped, so the
+// cache is only used while every thread of the process is stopped. Otherwise
+// reads go straight to the inferior and drop whatever is cached.
+//
+// When misses are sequential (e.g., gdb walking a large structure with
+// consecutive 'm' packets), successive misses read ahead an increasing number
+// of pages with a single syscall.
+// ReadV() first fetches the pages missing from all of its ranges, reading
+// adjacent ones together.
+class MemoryCache final : public util::ByteBlock {
+ public:
+  struct Stats {
+    // Requests served entirely from the cache.
+    uint64_t hits = 0;
+    // Requests that needed memory from the inferior.
+    uint64_t misses = 0;
+    // Reads issued to the inferior.
+    uint64_t reads = 0;
+  };
+
+  MemoryCache(Process* process, std::shared_ptr<ProcessMemory> memory);
+
+  bool Read(uintptr_t address, void* out_buffer, size_t length)
+    const override;
+  bool Write(uintptr_t address, const void* buffer, size_t length)
+    const override;
+  bool ReadV(const ReadRange* ranges, size_t num_ranges) const override;
+
+  // Discards all cached memory.
+  void Invalidate();
+
+  // When disabled all accesses go straight to the inferior.
+  bool enabled() const { return enabled_; }
+  void set_enabled(bool enabled);
+
+  const Stats& stats() const { return stats_; }
+
+ private:
+  static constexpr size_t kPageSize = 4096;
+
+  // The cache is dropped when it reaches this many pages.
+  static constexpr size_t kMaxPages = 1024;
+
+  // Readahead doubles with each sequential miss, up to this many pages.
+  static constexpr size_t kMaxReadaheadPages = 16;
+
+  using Page = std::array<uint8_t, kPageSize>;
+
+  // Returns true if the cache can be used now, discarding it if not.
+  bool CheckCoherent() const;
+
+  // Returns true if |address|, |length| can go through the cache.
+  bool IsCacheable(uintptr_t address, size_t length) const;
+
+  // Returns true if all of |address|, |length| is in the cache.
+  bool IsCached(uintptr_t address, size_t length) const;
+
+  // Copies |address|, |length| out of the cache, filling it as necessary.
+  bool ReadThroughCache(uintptr_t address, void* out_buffer,
+                        size_t length) const;
+
+  // Returns the cached page at |page_address|, reading it, and possibly some
+  // following pages, from the inferior if necessary. |last_page_address| is
+  // the last page the current request needs. Returns nullptr on failure.
+  const Page* GetPage(uintptr_t page_address,
+                      uintptr_t last_page_address) const;
+
+  // Reads |num_pages| pages starting at |page_address| into the cache.
+  bool FillPages(uintptr_t page_address, size_t num_pages) const;
+
+  Process* process_;  // weak
+
+  std::shared_ptr<ProcessMemory> memory_;
+
+  bool enabled_ = true;
+
+  // The cache is filled by Read(), which ByteBlock declares const.
+  mutable std::unordered_map<uintptr_t, std::unique_ptr<Page>> pages_;
+
+  // The address following the most recent read, and the number of pages to
+  // read on the next miss if the next read starts there.
+  mutable uintptr_t next_sequential_address_ = 0;
+  mutable size_t readahead_pages_ = 1;
+
+  mutable Stats stats_;
+
+  FTL_DISALLOW_COPY_AND_ASSIGN(MemoryCache);
+};
+
+}  // namespace debugserver
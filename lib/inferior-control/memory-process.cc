@@ -21,6 +21,50 @@ ProcessMemory::ProcessMemory(Process* process) : process_(process) {}
 bool ProcessMemory::Read(uintptr_t address,
                          void* out_buffer,
                          size_t length) const {
+  mx_status_t status = RawRead(address, out_buffer, length);
+  if (status != NO_ERROR) {
+    FTL_LOG(ERROR) << ftl::StringPrintf(
+                          "Failed to read memory at addr: %" PRIxPTR ": ",
+                          address)
+                   << util::MxErrorString(status);
+    return false;
+  }
+  return true;
+}
+
+bool ProcessMemory::TryRead(uintptr_t address,
+                            void* out_buffer,
+                            size_t length) const {
+  mx_status_t status = RawRead(address, out_buffer, length);
+  if (status != NO_ERROR) {
+    FTL_VLOG(2) << ftl::StringPrintf(
+                       "Unable to read %zu bytes at addr: %" PRIxPTR ": ",
+                       length, address)
+                << util::MxErrorString(status);
+    return false;
+  }
+  return true;
+}
+
+bool ProcessMemory::ReadV(const ReadRange* ranges, size_t num_ranges) const {
+  // There's no vectored read syscall, so read ranges that are close to each
+  // other in one go: copying a few extra bytes is cheaper than a syscall.
+  constexpr size_t kMaxGap = 4096;
+  constexpr size_t kMaxReadSize = 64 * 1024;
+  if (!ReadVCombined(ranges, num_ranges, kMaxGap, kMaxReadSize,
+                     [this](uintptr_t address, void* out_buffer,
+                            size_t length) {
+                       return TryRead(address, out_buffer, length);
+                     })) {
+    FTL_LOG(ERROR) << "Failed to read " << num_ranges << " memory ranges";
+    return false;
+  }
+  return true;
+}
+
+mx_status_t ProcessMemory::RawRead(uintptr_t address,
+                                   void* out_buffer,
+                                   size_t length) const {
   FTL_DCHECK(out_buffer);
 
   mx_handle_t handle = process_->handle();
@@ -29,13 +73,8 @@ bool ProcessMemory::Read(uintptr_t address,
   size_t bytes_read;
   mx_status_t status =
       mx_process_read_memory(handle, address, out_buffer, length, &bytes_read);
-  if (status != NO_ERROR) {
-    FTL_LOG(ERROR) << ftl::StringPrintf(
-                          "Failed to read memory at addr: %" PRIxPTR ": ",
-                          address)
-                   << util::MxErrorString(status);
-    return false;
-  }
+  if (status != NO_ERROR)
+    return status;
 
   // TODO(dje): The kernel currently doesn't support short reads,
   // despite claims to the contrary.
@@ -43,7 +82,7 @@ bool ProcessMemory::Read(uintptr_t address,
 
   // TODO(dje): Dump the bytes read at sufficiently high logging level (>2).
 
-  return true;
+  return NO_ERROR;
 }
 
 bool ProcessMemory::Write(uintptr_t address,
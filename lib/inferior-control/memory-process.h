@@ -4,6 +4,8 @@
 
 #pragma once
 
+#include <magenta/types.h>
+
 #include "debugger-utils/byte-block.h"
 
 namespace debugserver {
@@ -19,8 +21,17 @@ class ProcessMemory final : public util::ByteBlock {
     const override;
   bool Write(uintptr_t address, const void* buffer, size_t length)
     const override;
+  bool ReadV(const ReadRange* ranges, size_t num_ranges) const override;
+
+  // Same as Read() but failure is expected, e.g., when reading speculatively,
+  // so it isn't logged as an error.
+  bool TryRead(uintptr_t address, void* out_buffer, size_t length) const;
 
  private:
+  // Reads the memory without logging any failure.
+  mx_status_t RawRead(uintptr_t address, void* out_buffer, size_t length)
+    const;
+
   Process* process_;  // weak
 
   FTL_DISALLOW_COPY_AND_ASSIGN(ProcessMemory);
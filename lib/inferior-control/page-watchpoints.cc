@@ -0,0 +1,329 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "page-watchpoints.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <utility>
+
+#include <magenta/syscalls.h>
+
+#include "lib/ftl/logging.h"
+#include "lib/ftl/strings/string_printf.h"
+
+#include "debugger-utils/util.h"
+
+#include "breakpoint.h"
+#include "process.h"
+#include "thread.h"
+
+namespace debugserver {
+
+namespace {
+
+constexpr uintptr_t kPageSize = 4096;
+
+// A fault only gives the first address the faulting write couldn't write
+// to. The write can change at most this many bytes from there (the largest
+// vector store).
+constexpr uintptr_t kMaxAccessSize = 64;
+
+// The number of mappings to make room for beyond those the process has when
+// it's asked, in case it maps more in the meantime.
+constexpr size_t kExtraMappings = 8;
+
+uintptr_t PageOf(uintptr_t address) {
+  return address & ~(kPageSize - 1);
+}
+
+}  // namespace
+
+PageWatchpointSet::PageWatchpointSet(Process* process) : process_(process) {
+  FTL_DCHECK(process_);
+}
+
+bool PageWatchpointSet::Insert(uintptr_t address, size_t length) {
+  if (length == 0 || address + length - 1 < address) {
+    FTL_LOG(ERROR) << ftl::StringPrintf(
+        "Invalid watchpoint range: 0x%" PRIxPTR ", length %zu", address,
+        length);
+    return false;
+  }
+  if (process_->root_vmar() == MX_HANDLE_INVALID) {
+    FTL_LOG(ERROR) << "Page watchpoints need the process's root VMAR";
+    return false;
+  }
+  if (Has(address, length)) {
+    FTL_LOG(ERROR) << ftl::StringPrintf(
+        "Watchpoint already inserted at address: 0x%" PRIxPTR, address);
+    return false;
+  }
+
+  std::vector<mx_info_maps_t> maps;
+  if (!GetMappings(&maps))
+    return false;
+
+  uintptr_t first_page = PageOf(address);
+  uintptr_t last_page = PageOf(address + length - 1);
+  for (uintptr_t page = first_page;; page += kPageSize) {
+    auto iter = pages_.find(page);
+    if (iter == pages_.end()) {
+      uint32_t flags;
+      if (!GetWritablePageFlags(maps, page, &flags)) {
+        UnwatchPages(first_page, page);
+        return false;
+      }
+      iter = pages_.emplace(page, WatchedPage{0, flags}).first;
+      // Pages are unprotected while threads are stepped, they're protected
+      // again afterwards.
+      if (steps_.empty() && !ProtectPage(page, true)) {
+        pages_.erase(iter);
+        UnwatchPages(first_page, page);
+        return false;
+      }
+    }
+    ++iter->second.count;
+    if (page == last_page)
+      break;
+  }
+
+  ranges_.push_back({address, length});
+  return true;
+}
+
+bool PageWatchpointSet::Remove(uintptr_t address, size_t length) {
+  auto iter = std::find_if(ranges_.begin(), ranges_.end(),
+                           [=](const Range& range) {
+                             return range.address == address &&
+                                    range.length == length;
+                           });
+  if (iter == ranges_.end()) {
+    FTL_LOG(ERROR) << ftl::StringPrintf(
+        "No watchpoint inserted at address: 0x%" PRIxPTR, address);
+    return false;
+  }
+  ranges_.erase(iter);
+
+  UnwatchPages(PageOf(address), PageOf(address + length - 1) + kPageSize);
+  return true;
+}
+
+bool PageWatchpointSet::Has(uintptr_t address, size_t length) const {
+  for (const auto& range : ranges_) {
+    if (range.address == address && range.length == length)
+      return true;
+  }
+  return false;
+}
+
+void PageWatchpointSet::Clear() {
+  // There's nothing to unprotect in a process that's gone.
+  if (steps_.empty() && process_->IsLive())
+    ProtectAllPages(false);
+  ranges_.clear();
+  pages_.clear();
+  steps_.clear();
+}
+
+bool PageWatchpointSet::OnPageFault(Thread* thread,
+                                    uintptr_t fault_address,
+                                    bool report) {
+  // Faults on pages we don't watch are the inferior's own.
+  if (pages_.find(PageOf(fault_address)) == pages_.end())
+    return false;
+
+  // Keep the bytes the write may change from the fault address on, as far as
+  // the watched pages go: bytes on other pages can't be watched.
+  Step step{thread->id(), fault_address, {}, report};
+  uintptr_t end = PageOf(fault_address) + kPageSize;
+  while (end - fault_address < kMaxAccessSize && pages_.count(end))
+    end += kPageSize;
+  end = std::min(end, fault_address + kMaxAccessSize);
+  if (IsAnyWatched(fault_address, end)) {
+    step.old_bytes.resize(end - fault_address);
+    if (!process_->ReadMemory(fault_address, step.old_bytes.data(),
+                              step.old_bytes.size())) {
+      FTL_LOG(ERROR) << "Unable to read watched memory, the write by thread "
+                     << thread->GetName() << " won't be reported";
+      step.old_bytes.clear();
+    }
+  }
+
+  // The fault may have been reported after another thread lifted the
+  // protection. Stepping the thread again does no harm.
+  if (steps_.empty())
+    ProtectAllPages(false);
+
+  if (!thread->Step()) {
+    FTL_LOG(ERROR) << "Unable to step thread " << thread->GetName()
+                   << " over write to watched page";
+    if (steps_.empty())
+      ProtectAllPages(true);
+    // Report the fault: the thread can't make progress by itself.
+    return false;
+  }
+
+  steps_.push_back(std::move(step));
+  FTL_VLOG(2) << ftl::StringPrintf(
+      "Thread %s wrote to watched page at 0x%" PRIxPTR,
+      thread->GetName().c_str(), fault_address);
+  return true;
+}
+
+bool PageWatchpointSet::OnStepDone(Thread* thread, bool* out_report) {
+  auto iter = FindStep(thread->id());
+  if (iter == steps_.end())
+    return false;
+
+  Step step = std::move(*iter);
+  steps_.erase(iter);
+  if (steps_.empty())
+    ProtectAllPages(true);
+
+  uintptr_t hit_address = FindHit(step);
+  if (hit_address != 0)
+    thread->breakpoints()->SetWatchpointHit(hit_address);
+  *out_report = step.report || hit_address != 0;
+  return true;
+}
+
+void PageWatchpointSet::CancelStep(Thread* thread) {
+  auto iter = FindStep(thread->id());
+  if (iter == steps_.end())
+    return;
+
+  FTL_VLOG(2) << "Thread " << thread->GetName()
+              << " stopped stepping over write to watched page";
+  steps_.erase(iter);
+  if (steps_.empty())
+    ProtectAllPages(true);
+}
+
+std::vector<PageWatchpointSet::Step>::iterator PageWatchpointSet::FindStep(
+    mx_koid_t thread_id) {
+  return std::find_if(steps_.begin(), steps_.end(), [=](const Step& step) {
+    return step.thread_id == thread_id;
+  });
+}
+
+bool PageWatchpointSet::IsWatched(uintptr_t address) const {
+  return IsAnyWatched(address, address + 1);
+}
+
+bool PageWatchpointSet::IsAnyWatched(uintptr_t start, uintptr_t end) const {
+  for (const auto& range : ranges_) {
+    if (start < range.address + range.length && range.address < end)
+      return true;
+  }
+  return false;
+}
+
+uintptr_t PageWatchpointSet::FindHit(const Step& step) {
+  if (step.old_bytes.empty())
+    return 0;
+
+  std::vector<uint8_t> new_bytes(step.old_bytes.size());
+  if (!process_->ReadMemory(step.address, new_bytes.data(),
+                            new_bytes.size())) {
+    FTL_LOG(ERROR) << "Unable to read watched memory after write";
+    return 0;
+  }
+  for (size_t i = 0; i < new_bytes.size(); ++i) {
+    if (new_bytes[i] != step.old_bytes[i] && IsWatched(step.address + i))
+      return step.address + i;
+  }
+  return 0;
+}
+
+void PageWatchpointSet::UnwatchPages(uintptr_t first_page,
+                                     uintptr_t end_page) {
+  for (uintptr_t page = first_page; page != end_page; page += kPageSize) {
+    auto iter = pages_.find(page);
+    FTL_DCHECK(iter != pages_.end());
+    if (--iter->second.count == 0) {
+      if (steps_.empty())
+        ProtectPage(page, false);
+      pages_.erase(iter);
+    }
+  }
+}
+
+bool PageWatchpointSet::GetMappings(std::vector<mx_info_maps_t>* out_maps) {
+  FTL_DCHECK(out_maps);
+
+  // The mappings can change between the two calls: ask for some room to
+  // spare.
+  size_t num_maps;
+  mx_status_t status =
+      mx_object_get_info(process_->handle(), MX_INFO_PROCESS_MAPS, nullptr, 0,
+                         nullptr, &num_maps);
+  if (status == NO_ERROR) {
+    out_maps->resize(num_maps + kExtraMappings);
+    size_t records_read;
+    status = mx_object_get_info(
+        process_->handle(), MX_INFO_PROCESS_MAPS, out_maps->data(),
+        out_maps->size() * sizeof(mx_info_maps_t), &records_read, nullptr);
+    out_maps->resize(records_read);
+  }
+  if (status != NO_ERROR) {
+    FTL_LOG(ERROR) << "Failed to get process mappings: "
+                   << util::MxErrorString(status);
+    return false;
+  }
+  return true;
+}
+
+bool PageWatchpointSet::GetWritablePageFlags(
+    const std::vector<mx_info_maps_t>& maps,
+    uintptr_t page,
+    uint32_t* out_flags) {
+  FTL_DCHECK(out_flags);
+
+  for (const auto& map : maps) {
+    if (map.type != MX_INFO_MAPS_TYPE_MAPPING || page < map.base ||
+        page - map.base >= map.size)
+      continue;
+    *out_flags = map.u.mapping.mmu_flags &
+                 (MX_VM_FLAG_PERM_READ | MX_VM_FLAG_PERM_WRITE |
+                  MX_VM_FLAG_PERM_EXECUTE);
+    // Writes to memory that isn't writable fault anyway, and executable
+    // pages would have to stay executable while protected.
+    if (!(*out_flags & MX_VM_FLAG_PERM_WRITE) ||
+        (*out_flags & MX_VM_FLAG_PERM_EXECUTE)) {
+      FTL_LOG(ERROR) << ftl::StringPrintf(
+          "Page 0x%" PRIxPTR " isn't read-write data, can't watch it", page);
+      return false;
+    }
+    return true;
+  }
+
+  FTL_LOG(ERROR) << ftl::StringPrintf("Page 0x%" PRIxPTR " isn't mapped",
+                                      page);
+  return false;
+}
+
+bool PageWatchpointSet::ProtectPage(uintptr_t page, bool protect) {
+  auto iter = pages_.find(page);
+  FTL_DCHECK(iter != pages_.end());
+  uint32_t flags = iter->second.flags;
+  if (protect)
+    flags &= ~MX_VM_FLAG_PERM_WRITE;
+  mx_status_t status =
+      mx_vmar_protect(process_->root_vmar(), page, kPageSize, flags);
+  if (status < 0) {
+    FTL_LOG(ERROR) << ftl::StringPrintf(
+        "Unable to change protection of page 0x%" PRIxPTR ": %s", page,
+        util::MxErrorString(status).c_str());
+    return false;
+  }
+  return true;
+}
+
+void PageWatchpointSet::ProtectAllPages(bool protect) {
+  for (const auto& page : pages_)
+    ProtectPage(page.first, protect);
+}
+
+}  // namespace debugserver
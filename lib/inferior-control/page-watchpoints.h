@@ -0,0 +1,144 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <vector>
+
+#include <magenta/syscalls/object.h>
+#include <magenta/types.h>
+
+#include "lib/ftl/macros.h"
+
+namespace debugserver {
+
+class Process;
+class Thread;
+
+// Write watchpoints on ranges of any size, for when the debug registers can't
+// hold them.
+//
+// The pages holding the watched ranges are write-protected. A thread that
+// writes to one of them faults, and is stepped over the write with the
+// protection lifted, which is then restored. Only writes that change a
+// watched range stop the thread, just past the write like a hardware
+// watchpoint would: the bytes the write may have changed are compared before
+// and after the step.
+// N.B. Other running threads can miss the watchpoints while the protection is
+// lifted, and their writes in that time can be taken for the stepped
+// thread's.
+//
+// Only pages of read-write, non-executable mappings can be watched. They get
+// their original protection back once they're no longer watched.
+class PageWatchpointSet final {
+ public:
+  explicit PageWatchpointSet(Process* process);
+
+  // Watches for writes to |length| bytes at |address|. Returns false on
+  // failure, e.g. if the process's address space can't be changed.
+  bool Insert(uintptr_t address, size_t length);
+
+  // Removes a watchpoint that was previously inserted. Returns false if there
+  // is no such watchpoint.
+  bool Remove(uintptr_t address, size_t length);
+
+  // Returns true if there is a watchpoint on |length| bytes at |address|.
+  bool Has(uintptr_t address, size_t length) const;
+
+  // Removes all watchpoints, e.g. before detaching.
+  void Clear();
+
+  // Called when |thread| gets a page fault at |fault_address|. Returns false
+  // if the fault has nothing to do with the watchpoints. Otherwise |thread| is
+  // stepped over the faulting instruction. If |report| is true the thread is
+  // then reported stopped even if it didn't hit a watchpoint, e.g. because
+  // the client was stepping it.
+  bool OnPageFault(Thread* thread, uintptr_t fault_address, bool report);
+
+  // Called when |thread| completes a single step. Returns false if it wasn't
+  // being stepped by OnPageFault(). Otherwise restores the protection, and
+  // sets |*out_report| to whether the thread is to be reported stopped rather
+  // than resumed. A watchpoint hit is recorded in the thread's
+  // ThreadBreakpointSet.
+  bool OnStepDone(Thread* thread, bool* out_report);
+
+  // Called when |thread| exits, or stops for any other reason than
+  // completing a step. If it was being stepped by OnPageFault() the step is
+  // forgotten, and the protection restored.
+  void CancelStep(Thread* thread);
+
+ private:
+  struct Range {
+    uintptr_t address;
+    size_t length;
+  };
+
+  struct WatchedPage {
+    // The number of ranges on the page.
+    size_t count;
+    // The protection of the page when it isn't watched.
+    uint32_t flags;
+  };
+
+  // A thread that is being stepped over a write to a watched page.
+  struct Step {
+    mx_koid_t thread_id;
+    // The bytes at |address| the write may change, as they were before the
+    // step. Empty if none of them are watched.
+    uintptr_t address;
+    std::vector<uint8_t> old_bytes;
+    bool report;
+  };
+
+  // Returns the step of the thread with id |thread_id|, or steps_.end().
+  std::vector<Step>::iterator FindStep(mx_koid_t thread_id);
+
+  // Returns true if |address| is in a watched range.
+  bool IsWatched(uintptr_t address) const;
+
+  // Returns true if any of [|start|, |end|) is in a watched range.
+  bool IsAnyWatched(uintptr_t start, uintptr_t end) const;
+
+  // Returns the first watched byte that |step| changed, or zero if there is
+  // none.
+  uintptr_t FindHit(const Step& step);
+
+  // Drops a range from the pages from |first_page| up to, but not including,
+  // |end_page|. Pages without ranges left get their protection back.
+  void UnwatchPages(uintptr_t first_page, uintptr_t end_page);
+
+  // Gets the process's mappings. Returns false on failure.
+  bool GetMappings(std::vector<mx_info_maps_t>* out_maps);
+
+  // Sets |*out_flags| to the protection of |page| according to |maps|.
+  // Returns false if the page isn't mapped read-write and non-executable.
+  bool GetWritablePageFlags(const std::vector<mx_info_maps_t>& maps,
+                            uintptr_t page,
+                            uint32_t* out_flags);
+
+  // Takes away write access to |page|, which must be in |pages_|, if
+  // |protect| is true. Otherwise restores its original protection.
+  bool ProtectPage(uintptr_t page, bool protect);
+
+  // Protects, respectively unprotects, all the pages in |pages_|.
+  void ProtectAllPages(bool protect);
+
+  Process* process_;  // weak
+
+  std::vector<Range> ranges_;
+
+  // The watched pages.
+  std::map<uintptr_t, WatchedPage> pages_;
+
+  // The threads being stepped. The pages are unprotected while there are
+  // any.
+  std::vector<Step> steps_;
+
+  FTL_DISALLOW_COPY_AND_ASSIGN(PageWatchpointSet);
+};
+
+}  // namespace debugserver
@@ -15,6 +15,7 @@
 #include "lib/ftl/logging.h"
 #include "lib/ftl/strings/string_printf.h"
 
+#include "debugger-utils/agent-expression.h"
 #include "debugger-utils/util.h"
 
 #include "server.h"
@@ -124,6 +125,82 @@ mx_handle_t GetProcessDebugHandle(mx_koid_t pid) {
   return handle;
 }
 
+// The most memory a tracepoint may collect in one block. More than this is
+// almost certainly a mistake, e.g., a garbage length.
+constexpr size_t kMaxTraceBlockSize = 64 * 1024;
+
+// Reads |length| bytes at |address| into a new block of |frame|.
+bool CollectMemoryInFrame(Process* process,
+                          uint64_t address,
+                          size_t length,
+                          util::TraceFrame* frame) {
+  if (length > kMaxTraceBlockSize) {
+    FTL_LOG(ERROR) << "Trace collection of " << length << " bytes is too big";
+    return false;
+  }
+  util::TraceFrame::Block block;
+  block.address = address;
+  block.bytes.resize(length);
+  if (!process->ReadMemory(address, block.bytes.data(), length))
+    return false;
+  process->breakpoints()->HideInternalBreakpoints(address, block.bytes.data(),
+                                                  length);
+  frame->memory.push_back(std::move(block));
+  return true;
+}
+
+// Gives agent expressions access to a thread stopped at a breakpoint.
+class BreakpointExpressionContext final
+    : public util::AgentExpression::Context {
+ public:
+  // |bkpt_addr| is the address of the breakpoint, which is what the pc
+  // appears to be (the debugger takes care of backing up the pc on
+  // architectures where the exception leaves it past the breakpoint).
+  BreakpointExpressionContext(Process* process,
+                              Process::Delegate* delegate,
+                              Thread* thread,
+                              uintptr_t bkpt_addr)
+      : process_(process),
+        delegate_(delegate),
+        thread_(thread),
+        bkpt_addr_(bkpt_addr) {}
+
+  bool GetRegister(int regno, uint64_t* out_value) override {
+    if (regno == arch::GetPCRegisterNumber()) {
+      *out_value = bkpt_addr_;
+      return true;
+    }
+    return thread_->registers()->GetRegister(regno, out_value,
+                                             sizeof(*out_value));
+  }
+
+  bool ReadMemory(uint64_t address,
+                  void* out_buffer,
+                  size_t length) override {
+    return process_->ReadMemory(address, out_buffer, length);
+  }
+
+  void WriteOutput(const ftl::StringView& text) override {
+    delegate_->OnBreakpointOutput(process_, text);
+  }
+
+  bool CollectMemory(uint64_t address, size_t length) override {
+    if (!frame_)
+      return true;
+    return CollectMemoryInFrame(process_, address, length, frame_);
+  }
+
+  // Sets the trace frame that CollectMemory() adds to, if any.
+  void set_frame(util::TraceFrame* frame) { frame_ = frame; }
+
+ private:
+  Process* process_;              // weak
+  Process::Delegate* delegate_;  // weak
+  Thread* thread_;               // weak
+  uintptr_t bkpt_addr_;
+  util::TraceFrame* frame_ = nullptr;  // weak
+};
+
 }  // namespace
 
 // static
@@ -146,8 +223,11 @@ const char* Process::StateName(Process::State state) {
 Process::Process(Server* server, Delegate* delegate)
     : server_(server),
       delegate_(delegate),
-      memory_(std::shared_ptr<util::ByteBlock>(new ProcessMemory(this))),
-      breakpoints_(this) {
+      memory_(std::make_shared<MemoryCache>(
+          this, std::make_shared<ProcessMemory>(this))),
+      breakpoints_(this),
+      tracepoints_(this),
+      page_watchpoints_(this) {
   FTL_DCHECK(server_);
   FTL_DCHECK(delegate_);
 }
@@ -230,6 +310,16 @@ bool Process::Initialize() {
     goto fail;
   }
 
+  // Page watchpoints need the root VMAR to change protections. Not having it
+  // isn't fatal.
+  status = mx_handle_duplicate(launchpad_get_root_vmar_handle(launchpad_),
+                               MX_RIGHT_SAME_RIGHTS, &root_vmar_);
+  if (status != NO_ERROR) {
+    FTL_LOG(WARNING) << "Failed to obtain the root VMAR of the process: "
+                     << util::MxErrorString(status);
+    root_vmar_ = MX_HANDLE_INVALID;
+  }
+
   FTL_LOG(INFO) << "Obtained base load address: "
                 << ftl::StringPrintf("0x%" PRIxPTR, base_address_)
                 << ", entry address: "
@@ -347,6 +437,27 @@ bool Process::Detach() {
     FTL_LOG(ERROR) << "Not attached";
     return false;
   }
+
+  // Don't leave our own breakpoint behind for the inferior to trip over.
+  // There's no memory to restore in a process that's gone: Clear() drops the
+  // breakpoint then.
+  if (ldso_bkpt_addr_ != 0 && state_ != State::kGone)
+    breakpoints_.RemoveInternalBreakpoint(ldso_bkpt_addr_);
+
+  // Nor those of tracepoints. The frames are kept for the client to look at.
+  tracepoints_.Stop(state_ == State::kGone
+                        ? TracepointSet::StopReason::kProcessExited
+                        : TracepointSet::StopReason::kStopped);
+
+  // Nor the protection of watched pages.
+  page_watchpoints_.Clear();
+
+  // Threads stopped in an exception are resumed when we unbind the exception
+  // port. Make sure they resume with any registers we've modified.
+  ForEachLiveThread([](Thread* thread) {
+    thread->registers()->FlushRegisters();
+  });
+
   RawDetach();
   Clear();
   return true;
@@ -425,6 +536,11 @@ bool Process::Kill() {
 
   CloseDebugHandle();
 
+  // Tracing stops with the process. Its breakpoints are only forgotten:
+  // there's no memory left to restore.
+  set_state(State::kGone);
+  tracepoints_.Stop(TracepointSet::StopReason::kProcessExited);
+
   Clear();
   return true;
 }
@@ -460,14 +576,24 @@ void Process::Clear() {
   entry_address_ = 0;
   attached_running_ = false;
 
-  dso_free_list(dsos_);
-  dsos_ = nullptr;
+  dsos_.reset();
   dsos_build_failed_ = false;
+  ldso_bkpt_addr_ = 0;
+
+  // Whatever breakpoints are left can't be removed from memory anymore.
+  breakpoints_.Clear();
+  page_watchpoints_.Clear();
+
+  memory_->Invalidate();
 
   if (launchpad_)
     launchpad_destroy(launchpad_);
   launchpad_ = nullptr;
 
+  if (root_vmar_ != MX_HANDLE_INVALID)
+    mx_handle_close(root_vmar_);
+  root_vmar_ = MX_HANDLE_INVALID;
+
   // The process may just exited or whatever. Force the state to kGone.
   set_state(State::kGone);
 }
@@ -609,38 +735,69 @@ bool Process::ReadMemory(uintptr_t address, void* out_buffer, size_t length) {
   return memory_->Read(address, out_buffer, length);
 }
 
-bool Process::WriteMemory(uintptr_t address, const void* data, size_t length) {
-  return memory_->Write(address, data, length);
+void Process::InvalidateMemoryCache() {
+  memory_->Invalidate();
 }
 
-void Process::TryBuildLoadedDsosList(Thread* thread, bool check_ldso_bkpt) {
-  FTL_DCHECK(dsos_ == nullptr);
+bool Process::AllThreadsStopped() const {
+  if (thread_map_stale_)
+    return false;
 
-  FTL_VLOG(2) << "Building dso list";
+  // Threads found by RefreshAllThreads() are kNew but may well be running.
+  bool any_stopped = false;
+  for (const auto& iter : threads_) {
+    switch (iter.second->state()) {
+      case Thread::State::kStopped:
+      case Thread::State::kExiting:
+        any_stopped = true;
+        break;
+      case Thread::State::kGone:
+        break;
+      default:
+        return false;
+    }
+  }
+  return any_stopped;
+}
+
+bool Process::WriteMemory(uintptr_t address, const void* data, size_t length) {
+  return memory_->Write(address, data, length);
+}
 
+bool Process::ReadRDebug(struct r_debug* debug) {
   uintptr_t debug_addr;
-  mx_handle_t process_handle = thread->process()->handle();
-  mx_status_t status = mx_object_get_property(process_handle,
+  mx_status_t status = mx_object_get_property(handle_,
                                               MX_PROP_PROCESS_DEBUG_ADDR,
                                               &debug_addr, sizeof(debug_addr));
   if (status != NO_ERROR) {
     FTL_LOG(ERROR) << "mx_object_get_property failed, unable to fetch dso list: "
 		   << util::MxErrorString(status);
-    return;
+    return false;
   }
 
-  struct r_debug debug;
-  if (!ReadMemory(debug_addr, &debug, sizeof(debug))) {
+  if (!ReadMemory(debug_addr, debug, sizeof(*debug))) {
     FTL_VLOG(2) << "unable to read _dl_debug_addr";
-    // Don't set dsos_build_failed_ here, it may be too early to try.
-    return;
+    return false;
   }
 
   // Since we could, theoretically, stop in the dynamic linker before we get
   // that far check to see if it has been filled in.
   // TODO(dje): Document our test in dynlink.c.
-  if (debug.r_version == 0) {
+  if (debug->r_version == 0) {
     FTL_VLOG(2) << "debug.r_version is 0";
+    return false;
+  }
+
+  return true;
+}
+
+void Process::TryBuildLoadedDsosList(Thread* thread, bool check_ldso_bkpt) {
+  FTL_DCHECK(dsos_ == nullptr);
+
+  FTL_VLOG(2) << "Building dso list";
+
+  struct r_debug debug;
+  if (!ReadRDebug(&debug)) {
     // Don't set dsos_build_failed_ here, it may be too early to try.
     return;
   }
@@ -650,8 +807,7 @@ void Process::TryBuildLoadedDsosList(Thread* thread, bool check_ldso_bkpt) {
     bool success = thread->registers()->RefreshGeneralRegisters();
     FTL_DCHECK(success);
     mx_vaddr_t pc = thread->registers()->GetPC();
-    // TODO(dje): -1: adjust_pc_after_break
-    if (pc - 1 != debug.r_brk) {
+    if (arch::GetSoftwareBreakpointAddress(pc) != debug.r_brk) {
       FTL_VLOG(2) << "not stopped at dynamic linker debug breakpoint";
       return;
     }
@@ -660,18 +816,256 @@ void Process::TryBuildLoadedDsosList(Thread* thread, bool check_ldso_bkpt) {
   }
 
   auto lmap_vaddr = reinterpret_cast<mx_vaddr_t>(debug.r_map);
-  dsos_ = util::dso_fetch_list(memory_, lmap_vaddr, "app");
+  dsos_ = util::DsoList::Fetch(memory_, lmap_vaddr, "app");
   // We should have fetched at least one since this is not called until the
   // dl_debug_state breakpoint is hit.
   if (dsos_ == nullptr) {
     // Don't keep trying.
-    FTL_VLOG(2) << "dso_fetch_list failed";
+    FTL_VLOG(2) << "DsoList::Fetch failed";
     dsos_build_failed_ = true;
+    return;
+  }
+
+  dsos_->VLog();
+  // This may already be false, but set it any for documentation purposes.
+  dsos_build_failed_ = false;
+
+  // Watch for dsos loaded and unloaded from here on. The client may have a
+  // breakpoint here too, the two coexist.
+  if (breakpoints_.InsertInternalBreakpoint(debug.r_brk)) {
+    ldso_bkpt_addr_ = debug.r_brk;
   } else {
-    util::dso_vlog_list(dsos_);
-    // This may already be false, but set it any for documentation purposes.
-    dsos_build_failed_ = false;
+    FTL_LOG(WARNING) << "Unable to insert dynamic linker breakpoint,"
+                     << " dsos loaded later won't be seen";
+  }
+}
+
+bool Process::UpdateDsosList() {
+  FTL_DCHECK(dsos_);
+
+  struct r_debug debug;
+  if (!ReadRDebug(&debug))
+    return false;
+
+  // The dynamic linker calls r_brk both before and after changing the list,
+  // it can only be read in the latter case.
+  if (debug.r_state != r_debug::RT_CONSISTENT) {
+    FTL_VLOG(2) << "dso list is being modified, state " << debug.r_state;
+    return false;
   }
+
+  auto lmap_vaddr = reinterpret_cast<mx_vaddr_t>(debug.r_map);
+  if (!dsos_->Update(memory_, lmap_vaddr, "app"))
+    return false;
+
+  FTL_VLOG(2) << "dso list updated";
+  dsos_->VLog();
+  return true;
+}
+
+bool Process::HandleLdsoBreakpoint(Thread* thread,
+                                   const mx_exception_context_t& context) {
+  if (ldso_bkpt_addr_ == 0)
+    return false;
+
+  arch::Registers* registers = thread->registers();
+  if (!registers->RefreshGeneralRegisters())
+    return false;
+  mx_vaddr_t pc = registers->GetPC();
+  if (arch::GetSoftwareBreakpointAddress(pc) != ldso_bkpt_addr_)
+    return false;
+
+  bool changed = UpdateDsosList();
+
+  // If the client has its own breakpoint here then the stop is the client's
+  // to deal with, as usual.
+  if (breakpoints_.HasClientBreakpoint(ldso_bkpt_addr_))
+    return false;
+
+  // Thread::Resume() steps over the breakpoint.
+  if (!BackUpPc(thread, ldso_bkpt_addr_))
+    return false;
+
+  if (changed && report_library_events_) {
+    delegate_->OnLibrariesChanged(this, thread, context);
+  } else if (!thread->Resume()) {
+    FTL_LOG(ERROR) << "Unable to resume thread " << thread->GetName()
+                   << " after dynamic linker breakpoint";
+  }
+
+  return true;
+}
+
+bool Process::HandleTracepoint(Thread* thread) {
+  if (!tracepoints_.running())
+    return false;
+
+  arch::Registers* registers = thread->registers();
+  if (!registers->RefreshGeneralRegisters())
+    return false;
+  mx_vaddr_t pc = registers->GetPC();
+  mx_vaddr_t bkpt_addr = arch::GetSoftwareBreakpointAddress(pc);
+  if (!breakpoints_.HasTracepointBreakpoint(bkpt_addr))
+    return false;
+
+  BreakpointExpressionContext expression_context(this, delegate_, thread,
+                                                 bkpt_addr);
+  for (TracepointSet::Tracepoint* tracepoint :
+       tracepoints_.FindEnabledAt(bkpt_addr)) {
+    // A tracepoint at the same address may have filled the buffer.
+    if (!tracepoints_.running())
+      break;
+
+    // As with breakpoints, a condition that fails to evaluate counts as true.
+    uint64_t value;
+    if (tracepoint->condition &&
+        tracepoint->condition->Evaluate(&expression_context, &value) &&
+        value == 0)
+      continue;
+
+    util::TraceFrame frame;
+    frame.tracepoint = tracepoint->number;
+    frame.address = bkpt_addr;
+    expression_context.set_frame(&frame);
+    CollectTraceFrame(thread, bkpt_addr, *tracepoint, &expression_context,
+                      &frame);
+    expression_context.set_frame(nullptr);
+    if (!tracepoints_.AddFrame(std::move(frame)))
+      break;
+
+    ++tracepoint->hit_count;
+    if (tracepoint->pass_count &&
+        tracepoint->hit_count >= tracepoint->pass_count) {
+      tracepoints_.Stop(TracepointSet::StopReason::kPassCount,
+                        tracepoint->number);
+    }
+  }
+
+  // A client breakpoint here, or one with conditions or commands, gets
+  // dealt with as usual.
+  if (breakpoints_.HasClientBreakpoint(bkpt_addr))
+    return false;
+
+  // Thread::Resume() steps over the breakpoint if it's still there.
+  if (!BackUpPc(thread, bkpt_addr))
+    return false;
+  if (!thread->Resume()) {
+    FTL_LOG(ERROR) << "Unable to resume thread " << thread->GetName()
+                   << " after tracepoint";
+  }
+  return true;
+}
+
+void Process::CollectTraceFrame(Thread* thread,
+                                mx_vaddr_t bkpt_addr,
+                                const TracepointSet::Tracepoint& tracepoint,
+                                util::AgentExpression::Context* context,
+                                util::TraceFrame* frame) {
+  arch::Registers* registers = thread->registers();
+  if (tracepoint.collect_registers) {
+    // The frame shows the pc at the tracepoint, whatever the exception left
+    // it at. This only changes our copy of the registers.
+    int pc_regno = arch::GetPCRegisterNumber();
+    mx_vaddr_t pc = registers->GetPC();
+    if (registers->SetRegister(pc_regno, &bkpt_addr, sizeof(bkpt_addr))) {
+      frame->registers = registers->GetGeneralRegistersAsString();
+      registers->SetRegister(pc_regno, &pc, sizeof(pc));
+    }
+  }
+
+  for (const auto& range : tracepoint.memory) {
+    uint64_t address = range.offset;
+    if (range.base_regno >= 0) {
+      uint64_t base;
+      if (!context->GetRegister(range.base_regno, &base)) {
+        FTL_LOG(WARNING) << "Tracepoint " << tracepoint.number
+                         << ": unavailable register " << range.base_regno;
+        continue;
+      }
+      address += base;
+    }
+    if (!context->CollectMemory(address, range.length)) {
+      FTL_LOG(WARNING) << ftl::StringPrintf(
+          "Tracepoint %u: unable to collect 0x%" PRIx64 ",%" PRIu64,
+          tracepoint.number, address, range.length);
+    }
+  }
+
+  for (const auto& expression : tracepoint.expressions) {
+    uint64_t value;
+    if (!expression->Evaluate(context, &value)) {
+      FTL_LOG(WARNING) << "Tracepoint " << tracepoint.number
+                       << ": collection expression failed";
+    }
+  }
+}
+
+bool Process::BackUpPc(Thread* thread, mx_vaddr_t bkpt_addr) {
+  arch::Registers* registers = thread->registers();
+  if (registers->GetPC() == bkpt_addr)
+    return true;
+  if (!registers->SetRegister(arch::GetPCRegisterNumber(), &bkpt_addr,
+                              sizeof(bkpt_addr)) ||
+      !registers->WriteGeneralRegisters()) {
+    FTL_LOG(ERROR) << "Unable to reset pc after breakpoint";
+    return false;
+  }
+  return true;
+}
+
+bool Process::HandleAgentBreakpoint(Thread* thread) {
+  arch::Registers* registers = thread->registers();
+  if (!registers->RefreshGeneralRegisters())
+    return false;
+  mx_vaddr_t pc = registers->GetPC();
+  mx_vaddr_t bkpt_addr = arch::GetSoftwareBreakpointAddress(pc);
+  const arch::ProcessBreakpointSet::ExpressionList* conditions =
+      breakpoints_.GetConditions(bkpt_addr);
+  const arch::ProcessBreakpointSet::ExpressionList* commands =
+      breakpoints_.GetCommands(bkpt_addr);
+  if (!conditions && !commands)
+    return false;
+
+  // The breakpoint applies if any of its conditions holds. One that fails to
+  // evaluate counts as true: better a spurious stop than a missed one.
+  BreakpointExpressionContext expression_context(this, delegate_, thread,
+                                                 bkpt_addr);
+  bool applies = !conditions;
+  if (conditions) {
+    for (const auto& condition : *conditions) {
+      uint64_t value;
+      if (!condition->Evaluate(&expression_context, &value) || value != 0) {
+        applies = true;
+        break;
+      }
+    }
+  }
+
+  if (applies) {
+    if (!commands)
+      return false;
+    // The output, if any, is all the client gets to see of this hit.
+    for (const auto& command : *commands) {
+      uint64_t value;
+      if (!command->Evaluate(&expression_context, &value)) {
+        FTL_LOG(WARNING) << ftl::StringPrintf(
+            "Breakpoint command at 0x%" PRIxPTR " failed", bkpt_addr);
+      }
+    }
+  }
+
+  FTL_VLOG(2) << ftl::StringPrintf(
+      "Not reporting breakpoint at 0x%" PRIxPTR ", resuming thread %s",
+      bkpt_addr, thread->GetName().c_str());
+
+  if (!BackUpPc(thread, bkpt_addr))
+    return false;
+
+  if (!thread->ResumeOverBreakpoint()) {
+    FTL_LOG(ERROR) << "Unable to resume thread " << thread->GetName()
+                   << " after breakpoint";
+  }
+  return true;
 }
 
 void Process::OnException(const mx_excp_type_t type,
@@ -680,6 +1074,9 @@ void Process::OnException(const mx_excp_type_t type,
   if (context.tid != MX_KOID_INVALID)
     thread = FindThreadById(context.tid);
 
+  // Other threads may have been running since we last looked.
+  memory_->Invalidate();
+
   // Finding the load address of the main executable requires a few steps.
   // It's not loaded until the first time we hit the _dl_debug_state
   // breakpoint. For now gdb sets that breakpoint. What we do is watch for
@@ -694,7 +1091,46 @@ void Process::OnException(const mx_excp_type_t type,
   // synthetic exceptions.
   if (MX_EXCP_IS_ARCH(type)) {
     FTL_DCHECK(thread);
+    bool resume_after_step = thread->resume_after_step_;
+    bool client_stepping = thread->state() == Thread::State::kStepping &&
+                           !resume_after_step;
     thread->OnException(type, context);
+    // Writes to pages with watchpoints on them fault. The thread is stepped
+    // over the write and stopped only if it hit a watchpoint. A thread that
+    // stops for anything else than the step doesn't finish it.
+    bool report = false;
+    if (!arch::IsSingleStepException(context))
+      page_watchpoints_.CancelStep(thread);
+    if (type == MX_EXCP_FATAL_PAGE_FAULT &&
+        page_watchpoints_.OnPageFault(
+            thread, arch::GetPageFaultAddress(context), client_stepping))
+      return;
+    if (arch::IsSingleStepException(context) &&
+        page_watchpoints_.OnStepDone(thread, &report)) {
+      if (report) {
+        delegate_->OnArchitecturalException(this, thread, type, context);
+      } else if (!thread->Resume()) {
+        FTL_LOG(ERROR) << "Unable to resume thread " << thread->GetName()
+                       << " after write to watched page";
+      }
+      return;
+    }
+    if (arch::IsSingleStepException(context) && thread->ContinueRangeStep())
+      return;
+    if (resume_after_step && arch::IsSingleStepException(context) &&
+        !thread->breakpoints()->watchpoint_hit()) {
+      // The thread was stepped over an internal breakpoint on its way to
+      // being resumed, carry on. Unless the step hit a watchpoint.
+      if (!thread->Resume()) {
+        FTL_LOG(ERROR) << "Unable to resume thread " << thread->GetName()
+                       << " after stepping over breakpoint";
+      }
+      return;
+    }
+    if (type == MX_EXCP_SW_BREAKPOINT &&
+        (HandleLdsoBreakpoint(thread, context) || HandleTracepoint(thread) ||
+         HandleAgentBreakpoint(thread)))
+      return;
     delegate_->OnArchitecturalException(this, thread, type, context);
     return;
   }
@@ -722,6 +1158,7 @@ void Process::OnException(const mx_excp_type_t type,
       FTL_VLOG(1) << "Received MX_EXCP_THREAD_EXITING exception for thread "
                   << thread->GetName();
       FTL_DCHECK(thread);
+      page_watchpoints_.CancelStep(thread);
       thread->OnException(type, context);
       delegate_->OnThreadExiting(this, thread, type, context);
       break;
@@ -746,12 +1183,12 @@ int Process::ExitCode() {
   }
 }
 
-const util::dsoinfo_t* Process::GetExecDso() {
-  return dso_get_main_exec(dsos_);
+const util::DsoInfo* Process::GetExecDso() {
+  return dsos_ ? dsos_->GetMainExec() : nullptr;
 }
 
-util::dsoinfo_t* Process::LookupDso(mx_vaddr_t pc) const {
-  return util::dso_lookup(dsos_, pc);
+util::DsoInfo* Process::LookupDso(mx_vaddr_t pc) const {
+  return dsos_ ? dsos_->Lookup(pc) : nullptr;
 }
 
 }  // namespace debugserver
@@ -4,6 +4,7 @@
 
 #pragma once
 
+#include <memory>
 #include <string>
 #include <unordered_map>
 
@@ -12,16 +13,21 @@
 #include <magenta/types.h>
 
 #include "lib/ftl/macros.h"
+#include "lib/ftl/strings/string_view.h"
 #include "lib/mtl/tasks/message_loop.h"
 #include "lib/mtl/tasks/message_loop_handler.h"
 
+#include "debugger-utils/agent-expression.h"
 #include "debugger-utils/dso-list.h"
+#include "debugger-utils/trace-buffer.h"
 #include "debugger-utils/util.h"
 
 #include "breakpoint.h"
 #include "exception-port.h"
-#include "memory-process.h"
+#include "memory-cache.h"
+#include "page-watchpoints.h"
 #include "thread.h"
+#include "tracepoints.h"
 
 namespace debugserver {
 
@@ -63,6 +69,19 @@ class Process final {
         Thread* thread,
         const mx_excp_type_t type,
         const mx_exception_context_t& context) = 0;
+
+    // Called when the set of loaded dsos has changed and
+    // report_library_events() is true. |thread| is left stopped in the
+    // dynamic linker.
+    virtual void OnLibrariesChanged(
+        Process* process,
+        Thread* thread,
+        const mx_exception_context_t& context) = 0;
+
+    // Called with the output of breakpoint commands, e.g., gdb's dprintf.
+    // The thread that produced it carries on without stopping.
+    virtual void OnBreakpointOutput(Process* process,
+                                    const ftl::StringView& text) = 0;
   };
 
   explicit Process(Server* server,
@@ -136,6 +155,17 @@ class Process final {
   // Returns a mutable handle to the set of breakpoints managed by this process.
   arch::ProcessBreakpointSet* breakpoints() { return &breakpoints_; }
 
+  // Returns the tracepoints of this process and the frames they collected.
+  TracepointSet* tracepoints() { return &tracepoints_; }
+
+  // Returns the watchpoints implemented by write-protecting pages.
+  PageWatchpointSet* page_watchpoints() { return &page_watchpoints_; }
+
+  // Returns the handle of the root VMAR of the process, or
+  // MX_HANDLE_INVALID if we don't have it (we only do if we launched the
+  // process). This handle is owned by this Process instance.
+  mx_handle_t root_vmar() const { return root_vmar_; }
+
   // Returns the base load address of the dynamic linker.
   mx_vaddr_t base_address() const { return base_address_; }
 
@@ -178,6 +208,18 @@ class Process final {
   // on failure.
   bool WriteMemory(uintptr_t address, const void* data, size_t length);
 
+  // Discards cached inferior memory. This must be called whenever any thread
+  // of the process may run.
+  void InvalidateMemoryCache();
+
+  // Returns true if at least one thread is known and every live one is
+  // stopped, i.e., nothing can change the inferior's memory. A stale thread
+  // map isn't refreshed: the answer is then false.
+  bool AllThreadsStopped() const;
+
+  // Returns the cache that ReadMemory() and WriteMemory() go through.
+  MemoryCache* memory_cache() const { return memory_.get(); }
+
   // Fetch the process's exit code.
   int ExitCode();
 
@@ -188,29 +230,36 @@ class Process final {
   // If |check_ldso_bkpt| is true then verify |thread| is stopped at the
   // dynamic linker breakpoint. If not then skip trying. Otherwise |thread|
   // must be nullptr.
+  // Once the list has been built an internal breakpoint is inserted on the
+  // dynamic linker's r_brk hook, and the list is updated each time it is hit,
+  // which picks up dsos loaded later with dlopen.
   // TODO(dje): Maybe just pass |thread|, later.
-  // TODO(dje): For the rsp server this is only called once, after the main
-  // executable has been loaded. Therefore this list will not contain
-  // subsequently loaded dsos.
   void TryBuildLoadedDsosList(Thread* thread, bool check_ldso_bkpt);
 
   // Return true if dsos, including the main executable, have been loaded
   // into the inferior.
   bool DsosLoaded() { return dsos_ != nullptr; }
 
+  // If true then changes to the set of loaded dsos are reported to the
+  // delegate. Otherwise the dso list is updated and the thread that hit the
+  // dynamic linker breakpoint continues. The default is false.
+  bool report_library_events() const { return report_library_events_; }
+  void set_report_library_events(bool enable) {
+    report_library_events_ = enable;
+  }
+
   // Return list of loaded dsos.
   // Returns nullptr if none loaded yet or loading failed.
-  // TODO(dje): constness wip
-  util::dsoinfo_t* GetDsos() const { return dsos_; }
+  const util::DsoList* GetDsos() const { return dsos_.get(); }
 
   // Return the DSO for |pc| or nullptr if none.
   // TODO(dje): Result is not const for debug file lookup support.
-  util::dsoinfo_t* LookupDso(mx_vaddr_t pc) const;
+  util::DsoInfo* LookupDso(mx_vaddr_t pc) const;
 
   // Return the entry for the main executable from the dsos list.
   // Returns nullptr if not present (could happen if inferior data structure
   // has been clobbered).
-  const util::dsoinfo_t* GetExecDso();
+  const util::DsoInfo* GetExecDso();
 
  private:
   Process() = default;
@@ -234,6 +283,47 @@ class Process final {
   // Called after all other processing of a process exit has been done.
   void Clear();
 
+  // Reads the dynamic linker's r_debug struct into |debug|.
+  // Returns false if it isn't available (yet).
+  bool ReadRDebug(struct r_debug* debug);
+
+  // Brings |dsos_| up to date after the dynamic linker breakpoint has been
+  // hit. Returns true if the set of loaded dsos changed.
+  bool UpdateDsosList();
+
+  // Called when |thread| gets a s/w breakpoint exception. If it's for the
+  // internal breakpoint on the dynamic linker's r_brk hook then update the
+  // dso list and either report the change or resume |thread|. Returns true if
+  // the exception has been dealt with.
+  bool HandleLdsoBreakpoint(Thread* thread,
+                            const mx_exception_context_t& context);
+
+  // Called when |thread| gets a s/w breakpoint exception. If it's for a
+  // tracepoint while tracing is running then a trace frame is collected for
+  // each tracepoint there and, unless the client has a breakpoint there too,
+  // |thread| is resumed. Returns true if the exception has been dealt with.
+  bool HandleTracepoint(Thread* thread);
+
+  // Collects what |tracepoint| asks for into |frame|. |thread| is stopped at
+  // the tracepoint's breakpoint at |bkpt_addr|, and |context| gives
+  // expressions access to it. What can't be collected is skipped.
+  void CollectTraceFrame(Thread* thread,
+                         mx_vaddr_t bkpt_addr,
+                         const TracepointSet::Tracepoint& tracepoint,
+                         util::AgentExpression::Context* context,
+                         util::TraceFrame* frame);
+
+  // Sets the pc of |thread|, which is stopped at the s/w breakpoint at
+  // |bkpt_addr|, to |bkpt_addr| so that the instruction the breakpoint
+  // replaced gets executed when |thread| is resumed.
+  bool BackUpPc(Thread* thread, mx_vaddr_t bkpt_addr);
+
+  // Called when |thread| gets a s/w breakpoint exception. If it's for a
+  // breakpoint with conditions none of which hold, or with commands, then
+  // the commands are run as appropriate and |thread| is resumed.
+  // Returns true if the exception has been dealt with.
+  bool HandleAgentBreakpoint(Thread* thread);
+
   // The server that owns us.
   Server* server_;  // weak
 
@@ -250,6 +340,9 @@ class Process final {
   // The debug-capable handle that we use to invoke mx_debug_* syscalls.
   mx_handle_t handle_ = MX_HANDLE_INVALID;
 
+  // See root_vmar().
+  mx_handle_t root_vmar_ = MX_HANDLE_INVALID;
+
   // The current state of this process.
   State state_ = State::kNew;
 
@@ -269,12 +362,19 @@ class Process final {
   // Otherwise we're launching a program from scratch.
   bool attached_running_ = false;
 
-  // The API to access memory.
-  std::shared_ptr<util::ByteBlock> memory_;
+  // The API to access memory. Reads are cached while the process is stopped.
+  std::shared_ptr<MemoryCache> memory_;
 
   // The collection of breakpoints that belong to this process.
   arch::ProcessBreakpointSet breakpoints_;
 
+  // The tracepoints of this process. Unlike most of our state these survive
+  // the process going away, for the client to look at the frames.
+  TracepointSet tracepoints_;
+
+  // The watchpoints that didn't fit in the debug registers.
+  PageWatchpointSet page_watchpoints_;
+
   // The threads owned by this process. This is map is populated lazily when
   // threads are requested through FindThreadById(). It can also be repopulated
   // from scratch, e.g., when attaching to an already running program.
@@ -286,9 +386,14 @@ class Process final {
 
   // List of dsos loaded.
   // NULL if none have been loaded yet (including main executable).
-  // TODO(dje): Code taking from crashlogger, to be rewritten.
-  // TODO(dje): Doesn't include dsos loaded later.
-  util::dsoinfo_t* dsos_ = nullptr;
+  std::unique_ptr<util::DsoList> dsos_;
+
+  // The address of the internal breakpoint on the dynamic linker's r_brk
+  // hook, or zero if there isn't one.
+  mx_vaddr_t ldso_bkpt_addr_ = 0;
+
+  // See report_library_events().
+  bool report_library_events_ = false;
 
   // If true then building the dso list failed, don't try again.
   bool dsos_build_failed_ = false;
@@ -11,6 +11,7 @@
 #include <magenta/syscalls.h>
 #include <magenta/syscalls/debug.h>
 
+#include "lib/ftl/arraysize.h"
 #include "lib/ftl/logging.h"
 #include "lib/ftl/strings/string_printf.h"
 
@@ -34,6 +35,78 @@ int GetSPRegisterNumber() {
   return static_cast<int>(Amd64Register::RSP);
 }
 
+int GetNumGeneralRegisters() {
+  return static_cast<int>(Amd64Register::NUM_REGISTERS);
+}
+
+namespace {
+
+// The registers of GDB's "org.gnu.gdb.i386.core" feature, in register number
+// order. GDB insists on all of them being described, but only the general
+// registers (the first Amd64Register::NUM_REGISTERS) are accessible. Note
+// that eflags is reported as 64 bits, as it is in "g" packets.
+const TargetRegister kTargetRegisters[] = {
+  {"rax", 64, "int64"},
+  {"rbx", 64, "int64"},
+  {"rcx", 64, "int64"},
+  {"rdx", 64, "int64"},
+  {"rsi", 64, "int64"},
+  {"rdi", 64, "int64"},
+  {"rbp", 64, "data_ptr"},
+  {"rsp", 64, "data_ptr"},
+  {"r8", 64, "int64"},
+  {"r9", 64, "int64"},
+  {"r10", 64, "int64"},
+  {"r11", 64, "int64"},
+  {"r12", 64, "int64"},
+  {"r13", 64, "int64"},
+  {"r14", 64, "int64"},
+  {"r15", 64, "int64"},
+  {"rip", 64, "code_ptr"},
+  {"eflags", 64, "int64"},
+  {"cs", 32, "int32"},
+  {"ss", 32, "int32"},
+  {"ds", 32, "int32"},
+  {"es", 32, "int32"},
+  {"fs", 32, "int32"},
+  {"gs", 32, "int32"},
+  {"st0", 80, "i387_ext"},
+  {"st1", 80, "i387_ext"},
+  {"st2", 80, "i387_ext"},
+  {"st3", 80, "i387_ext"},
+  {"st4", 80, "i387_ext"},
+  {"st5", 80, "i387_ext"},
+  {"st6", 80, "i387_ext"},
+  {"st7", 80, "i387_ext"},
+  {"fctrl", 32, "int"},
+  {"fstat", 32, "int"},
+  {"ftag", 32, "int"},
+  {"fiseg", 32, "int"},
+  {"fioff", 32, "int"},
+  {"foseg", 32, "int"},
+  {"fooff", 32, "int"},
+  {"fop", 32, "int"},
+};
+
+static_assert(arraysize(kTargetRegisters) >=
+                  static_cast<size_t>(Amd64Register::NUM_REGISTERS),
+              "all general registers must be described");
+
+}  // namespace
+
+const std::string& GetTargetDescription() {
+  static const std::string* description = new std::string(
+      BuildTargetDescription("i386:x86-64", "org.gnu.gdb.i386.core",
+                             kTargetRegisters, arraysize(kTargetRegisters)));
+  return *description;
+}
+
+size_t GetTargetRegisterSize(int regno) {
+  if (regno < 0 || regno >= static_cast<int>(arraysize(kTargetRegisters)))
+    return 0;
+  return kTargetRegisters[regno].bitsize / 8;
+}
+
 namespace {
 
 // Includes all registers if |register_number| is -1.
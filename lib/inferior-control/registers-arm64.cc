@@ -35,6 +35,51 @@ int GetSPRegisterNumber() {
   return static_cast<int>(Arm64Register::SP);
 }
 
+int GetNumGeneralRegisters() {
+  return static_cast<int>(Arm64Register::NUM_REGISTERS);
+}
+
+namespace {
+
+// The registers of GDB's "org.gnu.gdb.aarch64.core" feature, in register
+// number order.
+const TargetRegister kTargetRegisters[] = {
+  {"x0", 64, "int"},  {"x1", 64, "int"},  {"x2", 64, "int"},
+  {"x3", 64, "int"},  {"x4", 64, "int"},  {"x5", 64, "int"},
+  {"x6", 64, "int"},  {"x7", 64, "int"},  {"x8", 64, "int"},
+  {"x9", 64, "int"},  {"x10", 64, "int"}, {"x11", 64, "int"},
+  {"x12", 64, "int"}, {"x13", 64, "int"}, {"x14", 64, "int"},
+  {"x15", 64, "int"}, {"x16", 64, "int"}, {"x17", 64, "int"},
+  {"x18", 64, "int"}, {"x19", 64, "int"}, {"x20", 64, "int"},
+  {"x21", 64, "int"}, {"x22", 64, "int"}, {"x23", 64, "int"},
+  {"x24", 64, "int"}, {"x25", 64, "int"}, {"x26", 64, "int"},
+  {"x27", 64, "int"}, {"x28", 64, "int"}, {"x29", 64, "int"},
+  {"x30", 64, "int"},
+  {"sp", 64, "data_ptr"},
+  {"pc", 64, "code_ptr"},
+  // In the GDB RSP cpsr is 32 bits, see RspArm64GeneralRegs below.
+  {"cpsr", 32, "int"},
+};
+
+static_assert(arraysize(kTargetRegisters) ==
+                  static_cast<size_t>(Arm64Register::NUM_REGISTERS),
+              "all general registers must be described");
+
+}  // namespace
+
+const std::string& GetTargetDescription() {
+  static const std::string* description = new std::string(
+      BuildTargetDescription("aarch64", "org.gnu.gdb.aarch64.core",
+                             kTargetRegisters, arraysize(kTargetRegisters)));
+  return *description;
+}
+
+size_t GetTargetRegisterSize(int regno) {
+  if (regno < 0 || regno >= static_cast<int>(arraysize(kTargetRegisters)))
+    return 0;
+  return kTargetRegisters[regno].bitsize / 8;
+}
+
 namespace {
 
 // In the GDB RSP, cpsr is 32 bits, which throws a wrench into the works.
@@ -128,7 +173,16 @@ class RegistersArm64 final : public Registers {
       return false;
     }
     // On arm64 all general register values are 64-bit.
-    // Note that this includes CPSR, whereas in the GDB RSP CPSR is 32 bits.
+    // Note that this includes CPSR, whereas in the GDB RSP CPSR is 32 bits:
+    // accept that size too.
+    if (regno == static_cast<int>(Arm64Register::CPSR) &&
+        value_size == sizeof(uint32_t)) {
+      uint32_t cpsr;
+      std::memcpy(&cpsr, value, sizeof(cpsr));
+      gregs_.cpsr = cpsr;
+      FTL_VLOG(1) << "Set register " << regno << " = " << cpsr;
+      return true;
+    }
     if (value_size != sizeof(uint64_t)) {
       FTL_LOG(ERROR) << "Invalid arm64 register value size: " << value_size;
       return false;
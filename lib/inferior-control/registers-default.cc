@@ -21,6 +21,19 @@ int GetSPRegisterNumber() {
   return -1;
 }
 
+int GetNumGeneralRegisters() {
+  return 0;
+}
+
+const std::string& GetTargetDescription() {
+  static const std::string* description = new std::string();
+  return *description;
+}
+
+size_t GetTargetRegisterSize(int regno) {
+  return 0;
+}
+
 namespace {
 
 class RegistersDefault final : public Registers {
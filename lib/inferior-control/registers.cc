@@ -17,7 +17,29 @@
 namespace debugserver {
 namespace arch {
 
-Registers::Registers(Thread* thread) : thread_(thread) {
+std::string BuildTargetDescription(const char* architecture,
+                                   const char* feature,
+                                   const TargetRegister* regs,
+                                   size_t num_regs) {
+  std::string result =
+      "<?xml version=\"1.0\"?>\n"
+      "<!DOCTYPE target SYSTEM \"gdb-target.dtd\">\n"
+      "<target version=\"1.0\">\n";
+  result += ftl::StringPrintf("  <architecture>%s</architecture>\n",
+                              architecture);
+  result += ftl::StringPrintf("  <feature name=\"%s\">\n", feature);
+  for (size_t i = 0; i < num_regs; ++i) {
+    result += ftl::StringPrintf(
+        "    <reg name=\"%s\" bitsize=\"%d\" type=\"%s\"/>\n",
+        regs[i].name, regs[i].bitsize, regs[i].type);
+  }
+  result += "  </feature>\n";
+  result += "</target>\n";
+  return result;
+}
+
+Registers::Registers(Thread* thread)
+    : thread_(thread), cache_epoch_(thread->stop_epoch()) {
   FTL_DCHECK(thread);
   FTL_DCHECK(thread->handle() != MX_HANDLE_INVALID);
 }
@@ -38,7 +60,54 @@ bool Registers::SetGeneralRegistersFromString(const ftl::StringView& value) {
   return SetRegsetFromString(MX_THREAD_STATE_REGSET0, value);
 }
 
+bool Registers::FlushRegisters() {
+  CheckCacheEpoch();
+
+  bool success = true;
+  for (int regset = 0; dirty_regsets_ != 0; ++regset) {
+    uint32_t mask = 1u << regset;
+    if (!(dirty_regsets_ & mask))
+      continue;
+    dirty_regsets_ &= ~mask;
+
+    const DirtyRegset& dirty = dirty_buffers_[regset];
+    mx_status_t status = mx_thread_write_state(thread()->handle(), regset,
+                                               dirty.buf, dirty.size);
+    if (status < 0) {
+      FTL_LOG(ERROR) << "Failed to write regset " << regset << ": "
+                     << util::MxErrorString(status);
+      success = false;
+      continue;
+    }
+
+    FTL_VLOG(1) << "Regset " << regset << " written";
+  }
+
+  return success;
+}
+
+void Registers::InvalidateCache() {
+  if (dirty_regsets_)
+    FTL_LOG(WARNING) << "Discarding unwritten register values";
+  cached_regsets_ = 0;
+  dirty_regsets_ = 0;
+  cache_epoch_ = thread()->stop_epoch();
+}
+
+void Registers::CheckCacheEpoch() {
+  if (cache_epoch_ != thread()->stop_epoch())
+    InvalidateCache();
+}
+
 bool Registers::RefreshRegsetHelper(int regset, void* buf, size_t buf_size) {
+  FTL_DCHECK(regset >= 0 && regset < kMaxRegsets);
+
+  CheckCacheEpoch();
+  if (cached_regsets_ & (1u << regset)) {
+    FTL_VLOG(2) << "Regset " << regset << " already cached";
+    return true;
+  }
+
   // We report all zeros for the registers if the thread was just created.
   if (thread()->state() == Thread::State::kNew) {
     memset(buf, 0, buf_size);
@@ -56,21 +125,29 @@ bool Registers::RefreshRegsetHelper(int regset, void* buf, size_t buf_size) {
 
   FTL_DCHECK(regset_size == buf_size);
 
+  // Only cache values of stopped threads. Running threads can't be read
+  // (nor written) anyway.
+  if (thread()->state() == Thread::State::kStopped)
+    cached_regsets_ |= 1u << regset;
+
   FTL_VLOG(1) << "Regset " << regset << " refreshed";
   return true;
 }
 
 bool Registers::WriteRegsetHelper(int regset, const void* buf,
                                   size_t buf_size) {
-  mx_status_t status = mx_thread_write_state(thread()->handle(), regset,
-                                             buf, buf_size);
-  if (status < 0) {
-    FTL_LOG(ERROR) << "Failed to write regset " << regset << ": "
-                   << util::MxErrorString(status);
-    return false;
-  }
+  FTL_DCHECK(regset >= 0 && regset < kMaxRegsets);
+
+  CheckCacheEpoch();
+
+  // The cache now holds the values we want the thread to have, whether or
+  // not they were read from the thread first (e.g., "G" replaces them all).
+  cached_regsets_ |= 1u << regset;
+  dirty_regsets_ |= 1u << regset;
+  dirty_buffers_[regset].buf = buf;
+  dirty_buffers_[regset].size = buf_size;
 
-  FTL_VLOG(1) << "Regset " << regset << " written";
+  FTL_VLOG(2) << "Regset " << regset << " marked dirty";
   return true;
 }
 
@@ -4,6 +4,8 @@
 
 #pragma once
 
+#include <array>
+#include <cstdint>
 #include <memory>
 #include <string>
 
@@ -31,10 +33,48 @@ int GetFPRegisterNumber();
 // platform. Returns -1, if this operation is not supported.
 int GetSPRegisterNumber();
 
+// Returns the number of registers, numbered from 0, whose values we can
+// access on the current platform. Returns 0 if this is not supported.
+int GetNumGeneralRegisters();
+
+// Returns the target description for the current platform: an XML document
+// that tells the debugger which registers there are and how they are
+// numbered (served as "target.xml" with qXfer:features:read). The description
+// may include registers beyond GetNumGeneralRegisters() that the debugger
+// requires to be present; their values are reported as unavailable.
+// Returns an empty string if this is not supported.
+const std::string& GetTargetDescription();
+
+// Returns the size in bytes of register |regno| as given by the target
+// description, or 0 if there is no such register.
+size_t GetTargetRegisterSize(int regno);
+
+// A register in a target description.
+struct TargetRegister {
+  const char* name;
+  int bitsize;
+  const char* type;
+};
+
+// Helper for implementing GetTargetDescription(): returns a target
+// description for |architecture| with a single |feature| made up of the
+// |num_regs| registers in |regs|.
+std::string BuildTargetDescription(const char* architecture,
+                                   const char* feature,
+                                   const TargetRegister* regs,
+                                   size_t num_regs);
+
 // Registers represents an architecture-dependent general register set.
 // This is an abstract, opaque interface that returns a register-value
 // representation that complies with the GDB Remote Protocol with
 // architecture-specific implementations.
+//
+// Register values are cached for as long as the thread stays stopped, as
+// tracked by Thread::stop_epoch(): once a regset has been read, refreshing it
+// again before the thread is resumed doesn't make a syscall. Likewise writes
+// are deferred: WriteRegset() only marks the regset as dirty, and all dirty
+// regsets are written back by FlushRegisters(), which the Thread calls right
+// before resuming.
 class Registers {
  public:
   // Factory method for obtaining a Registers instance on the current
@@ -47,14 +87,24 @@ class Registers {
   // architecture is supported.
   virtual bool IsSupported() = 0;
 
-  // Loads and caches register values for |regset|.
+  // Loads and caches register values for |regset|. This is a no-op if the
+  // values are already cached for the current stop.
   // Returns false if there is an error.
   virtual bool RefreshRegset(int regset) = 0;
 
-  // Write the cached register set |regset| values back.
+  // Marks the cached register set |regset| as modified. The values are
+  // written back to the thread by FlushRegisters().
   // Returns false if there is an error.
   virtual bool WriteRegset(int regset) = 0;
 
+  // Writes back all regsets modified with WriteRegset() during the current
+  // stop. This must be called before the thread is resumed.
+  // Returns false if there is an error.
+  bool FlushRegisters();
+
+  // Discards all cached values, including unflushed modifications.
+  void InvalidateCache();
+
   // Wrappers for general regs (regset0).
   bool RefreshGeneralRegisters();
   bool WriteGeneralRegisters();
@@ -139,11 +189,13 @@ class Registers {
 
   Thread* thread() const { return thread_; }
 
-  // Loads and caches register values for |regset|.
+  // Loads and caches register values for |regset| in |buf|, unless they are
+  // already cached.
   // Returns false if there is an error.
   bool RefreshRegsetHelper(int regset, void* buf, size_t buf_size);
 
-  // Write the cached register set |regset| values back.
+  // Marks |regset|, whose cached values are in |buf|, as dirty. |buf| must
+  // remain valid until the next call to FlushRegisters().
   // Returns false if there is an error.
   bool WriteRegsetHelper(int regset, const void* buf, size_t buf_size);
 
@@ -154,8 +206,30 @@ class Registers {
                                  const ftl::StringView& value);
 
  private:
+  // The maximum number of regsets we can cache.
+  constexpr static int kMaxRegsets = 32;
+
+  // Where the values of a dirty regset are cached.
+  struct DirtyRegset {
+    const void* buf = nullptr;
+    size_t size = 0;
+  };
+
+  // Discards the cache if the thread has been resumed since it was filled.
+  void CheckCacheEpoch();
+
   Thread* thread_;  // weak
 
+  // The value of |thread_->stop_epoch()| for which the cache is valid.
+  uint64_t cache_epoch_ = 0;
+
+  // Bitmasks of the regsets that are cached, and that have been modified.
+  uint32_t cached_regsets_ = 0;
+  uint32_t dirty_regsets_ = 0;
+
+  // The cached values of each dirty regset, indexed by regset number.
+  std::array<DirtyRegset, kMaxRegsets> dirty_buffers_;
+
   // Helper function for GetPC,GetSP,GetFP.
   mx_vaddr_t GetIntRegister(int regno);
 
@@ -22,8 +22,8 @@ Server::Server()
       run_status_(true) {}
 
 Server::~Server() {
-  // This will invoke the IOLoop destructor which will clean up and join the I/O
-  // threads.
+  // This will invoke the IOLoop destructor which will stop watching the
+  // socket.
   io_loop_.reset();
 }
 
@@ -80,7 +80,7 @@ class Server : public IOLoop::Delegate, public Process::Delegate {
   // The main loop.
   mtl::MessageLoop message_loop_;
 
-  // The IOLoop used for blocking I/O operations over |client_sock_|.
+  // The IOLoop used for non-blocking I/O operations over |client_sock_|.
   // |message_loop_| and |client_sock_| both MUST outlive |io_loop_|. We take
   // care to clean it up in the destructor.
   std::unique_ptr<IOLoop> io_loop_;
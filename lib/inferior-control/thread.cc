@@ -115,6 +115,27 @@ void Thread::OnException(const mx_excp_type_t type,
 
   State prev_state = state_;
   set_state(State::kStopped);
+  ++stop_epoch_;
+
+  // Put back any breakpoint we stepped over.
+  if (step_over_address_ != 0) {
+    if (!process_->breakpoints()->UnsuspendBreakpoint(step_over_address_)) {
+      FTL_LOG(ERROR) << ftl::StringPrintf(
+          "Unable to reinsert bkpt at 0x%" PRIxPTR, step_over_address_);
+    }
+    step_over_address_ = 0;
+  }
+  resume_after_step_ = false;
+
+  // Only a step continues a range step.
+  if (!MX_EXCP_IS_ARCH(type) || !arch::IsSingleStepException(context)) {
+    step_range_start_ = 0;
+    step_range_end_ = 0;
+  }
+
+  // A watchpoint hit is set again by the step that finds it, if that's what
+  // this is.
+  breakpoints_.ClearWatchpointHit();
 
   // If we were singlestepping turn it off.
   // If the user wants to try the singlestep again it must be re-requested.
@@ -137,11 +158,36 @@ bool Thread::Resume() {
     return false;
   }
 
+  step_range_start_ = 0;
+  step_range_end_ = 0;
+
+  // A thread sitting at an internal breakpoint has to get past it first. The
+  // client doesn't know it's there so we can't leave this to the client.
+  if (state() == State::kStopped &&
+      process()->breakpoints()->HasInternalBreakpoints()) {
+    if (!registers_->RefreshGeneralRegisters()) {
+      FTL_LOG(ERROR) << "Failed refreshing gregs";
+      return false;
+    }
+    if (process()->breakpoints()->HasInternalBreakpoint(registers_->GetPC())) {
+      if (!Step())
+        return false;
+      resume_after_step_ = true;
+      return true;
+    }
+  }
+
   // This is printed here before resuming the task so that this is always
   // printed before any subsequent exception report (which is read by another
   // thread).
   FTL_VLOG(2) << "Thread " << GetName() << " is now running";
 
+  if (!registers_->FlushRegisters()) {
+    FTL_LOG(ERROR) << "Failed to write back registers";
+    return false;
+  }
+
+  process()->InvalidateMemoryCache();
   mx_status_t status = mx_task_resume(handle_, MX_RESUME_EXCEPTION);
   if (status < 0) {
     FTL_LOG(ERROR) << "Failed to resume thread: "
@@ -150,6 +196,7 @@ bool Thread::Resume() {
   }
 
   state_ = State::kRunning;
+  ++stop_epoch_;
   return true;
 }
 
@@ -166,6 +213,7 @@ void Thread::ResumeForExit() {
 
   FTL_VLOG(2) << "Thread " << GetName() << " is exiting";
 
+  process()->InvalidateMemoryCache();
   auto status = mx_task_resume(handle_, MX_RESUME_EXCEPTION);
   if (status < 0) {
     // This might fail if the process has been killed in the interim.
@@ -188,10 +236,65 @@ void Thread::ResumeForExit() {
   }
 
   set_state(State::kGone);
+  ++stop_epoch_;
   Clear();
 }
 
+bool Thread::ResumeOverBreakpoint() {
+  if (!DoStep(true, true))
+    return false;
+  resume_after_step_ = true;
+  return true;
+}
+
 bool Thread::Step() {
+  step_range_start_ = 0;
+  step_range_end_ = 0;
+  return DoStep(false, false);
+}
+
+bool Thread::RangeStep(uintptr_t start, uintptr_t end) {
+  if (!Step())
+    return false;
+  step_range_start_ = start;
+  step_range_end_ = end;
+  return true;
+}
+
+bool Thread::ContinueRangeStep() {
+  uintptr_t start = step_range_start_;
+  uintptr_t end = step_range_end_;
+  step_range_start_ = 0;
+  step_range_end_ = 0;
+  if (start == end)
+    return false;
+
+  // Watchpoint hits are reported.
+  if (breakpoints_.watchpoint_hit())
+    return false;
+
+  if (!registers_->RefreshGeneralRegisters()) {
+    FTL_LOG(ERROR) << "Failed refreshing gregs";
+    return false;
+  }
+  uintptr_t pc = registers_->GetPC();
+  if (pc < start || pc >= end)
+    return false;
+
+  // The client wants to know about its breakpoints before they're hit, as it
+  // would if it were stepping itself.
+  if (process_->breakpoints()->HasClientBreakpoint(pc))
+    return false;
+
+  // If this fails report the stop: the client can take it from here.
+  if (!DoStep(false, true))
+    return false;
+  step_range_start_ = start;
+  step_range_end_ = end;
+  return true;
+}
+
+bool Thread::DoStep(bool step_over_breakpoint, bool internal) {
   if (state() != State::kStopped) {
     FTL_LOG(ERROR) << "Cannot resume a thread while in state: "
                    << StateName(state());
@@ -204,23 +307,52 @@ bool Thread::Step() {
   }
   mx_vaddr_t pc = registers_->GetPC();
 
-  if (!breakpoints_.InsertSingleStepBreakpoint(pc))
+  // Step the original instruction, not an internal breakpoint.
+  arch::ProcessBreakpointSet* process_breakpoints = process()->breakpoints();
+  bool step_over = step_over_breakpoint ||
+                   process_breakpoints->HasInternalBreakpoint(pc);
+  if (step_over && !process_breakpoints->SuspendBreakpoint(pc))
+    return false;
+
+  if (!breakpoints_.InsertSingleStepBreakpoint(pc)) {
+    if (step_over)
+      process_breakpoints->UnsuspendBreakpoint(pc);
+    return false;
+  }
+
+  // This writes back the registers modified by inserting the single-step
+  // breakpoint, along with any others.
+  if (!registers_->FlushRegisters()) {
+    breakpoints_.RemoveSingleStepBreakpoint();
+    if (step_over)
+      process_breakpoints->UnsuspendBreakpoint(pc);
+    FTL_LOG(ERROR) << "Failed to write back registers";
     return false;
+  }
 
   // This is printed here before resuming the task so that this is always
   // printed before any subsequent exception report (which is read by another
   // thread).
-  FTL_LOG(INFO) << "Thread " << GetName() << " is now stepping";
+  if (internal)
+    FTL_VLOG(2) << "Thread " << GetName() << " is now stepping";
+  else
+    FTL_LOG(INFO) << "Thread " << GetName() << " is now stepping";
 
+  process()->InvalidateMemoryCache();
   mx_status_t status = mx_task_resume(handle_, MX_RESUME_EXCEPTION);
   if (status < 0) {
     breakpoints_.RemoveSingleStepBreakpoint();
+    if (step_over)
+      process_breakpoints->UnsuspendBreakpoint(pc);
     FTL_LOG(ERROR) << "Failed to resume thread for step: "
                    << util::MxErrorString(status);
     return false;
   }
 
+  if (step_over)
+    step_over_address_ = pc;
   state_ = State::kStepping;
+  ++stop_epoch_;
   return true;
 }
 
@@ -53,9 +53,17 @@ class Thread final {
   // not be deleted by the caller.
   arch::Registers* registers() const { return registers_.get(); }
 
+  // Returns the breakpoints of this thread, and the watchpoint it last hit.
+  arch::ThreadBreakpointSet* breakpoints() { return &breakpoints_; }
+
   // Returns the current state of this thread.
   State state() const { return state_; }
 
+  // Returns a counter that changes every time this thread stops or is
+  // resumed. State cached about a stopped thread (e.g., register values) is
+  // valid only as long as this doesn't change.
+  uint64_t stop_epoch() const { return stop_epoch_; }
+
   // Returns true if thread is alive. It could be stopped, but it's still
   // alive.
   bool IsLive() const;
@@ -69,12 +77,21 @@ class Thread final {
   // TODO(dje): kNone might be a better value if there is no exception.
   arch::GdbSignal GetGdbSignal() const;
 
+  // Returns the context of the most recent architectural exception, or
+  // nullptr if there hasn't been one.
+  const mx_exception_context_t* exception_context() const {
+    return exception_context_.get();
+  }
+
   // Called when the thread gets an exception.
   void OnException(const mx_excp_type_t type,
                    const mx_exception_context_t& context);
 
-  // Resumes the thread from a "stopped in exception" state. Returns true on
-  // success, false on failure. The thread state on return is kRunning.
+  // Resumes the thread from a "stopped in exception" state, after writing
+  // back any modified registers. Returns true on success, false on failure.
+  // The thread state on return is kRunning, or kStepping if the thread is
+  // stopped at an internal breakpoint: it is first stepped over it, and then
+  // resumed.
   bool Resume();
 
   // Resumes the thread from an MX_EXCP_THREAD_EXITING exception.
@@ -84,8 +101,19 @@ class Thread final {
 
   // Steps the thread from a "stopped in exception" state. Returns true on
   // success, false on failure.
+  // If the thread is stopped at an internal breakpoint then the original
+  // instruction is stepped. The breakpoint is put back when the thread
+  // stops again. N.B. Other running threads can miss the breakpoint while
+  // it is out.
   bool Step();
 
+  // Steps the thread from a "stopped in exception" state, and keeps stepping
+  // it while it stops in [|start|, |end|), without reporting those stops.
+  // Stepping ends early at a breakpoint the client inserted, a watchpoint
+  // or any exception other than a step. Returns true on success, false on
+  // failure.
+  bool RangeStep(uintptr_t start, uintptr_t end);
+
 #ifdef __x86_64__
   // Intel PT buffer access
   int32_t ipt_buffer() const { return ipt_buffer_; }
@@ -102,6 +130,23 @@ class Thread final {
   // Called after all other processing of a thread exit has been done.
   void Clear();
 
+  // Resumes the thread when it is stopped at a breakpoint that isn't to be
+  // reported, e.g., one whose condition doesn't hold. The thread's pc must
+  // be the address of the breakpoint. The instruction the breakpoint
+  // replaced is stepped first, as for internal breakpoints.
+  bool ResumeOverBreakpoint();
+
+  // Implements Step(). The breakpoint at the pc, if any, is stepped over if
+  // |step_over_breakpoint| is true or it is an internal breakpoint. Steps the
+  // client didn't ask for, e.g. those of a range step after the first, are
+  // |internal|: they're only logged verbosely.
+  bool DoStep(bool step_over_breakpoint, bool internal);
+
+  // Called by Process when the thread stops after a single-step. If the
+  // thread is range stepping and hasn't left the range it is stepped again
+  // and true is returned.
+  bool ContinueRangeStep();
+
   // The owning process.
   Process* process_;  // weak
 
@@ -117,6 +162,9 @@ class Thread final {
   // The current state of the this thread.
   State state_;
 
+  // See stop_epoch().
+  uint64_t stop_epoch_ = 0;
+
 #ifdef __x86_64__
   // The Intel Processor Trace buffer descriptor attached to this thread,
   // or -1 if none.
@@ -126,6 +174,18 @@ class Thread final {
   // The collection of breakpoints that belong to this thread.
   arch::ThreadBreakpointSet breakpoints_;
 
+  // The address of the process breakpoint removed while this thread steps
+  // over it, or zero if none.
+  uintptr_t step_over_address_ = 0;
+
+  // If true then the current step is to get past a breakpoint and the thread
+  // is to be resumed once it completes.
+  bool resume_after_step_ = false;
+
+  // The range of addresses being range stepped in, or empty if none.
+  uintptr_t step_range_start_ = 0;
+  uintptr_t step_range_end_ = 0;
+
   // Pointer to the most recent exception context that this Thread received via
   // an architectural exception. Contains nullptr if the thread never received
   // an exception.
@@ -0,0 +1,127 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "tracepoints.h"
+
+#include <algorithm>
+#include <cinttypes>
+
+#include "lib/ftl/logging.h"
+#include "lib/ftl/strings/string_printf.h"
+
+#include "process.h"
+
+namespace debugserver {
+
+TracepointSet::TracepointSet(Process* process) : process_(process) {
+  FTL_DCHECK(process_);
+}
+
+void TracepointSet::Clear() {
+  FTL_DCHECK(!running_);
+  tracepoints_.clear();
+  buffer_.Clear();
+  stop_reason_ = StopReason::kNotRun;
+  stop_tracepoint_ = 0;
+}
+
+TracepointSet::Tracepoint* TracepointSet::Add(uint32_t number,
+                                              uintptr_t address,
+                                              bool enabled,
+                                              uint64_t pass_count) {
+  if (running_) {
+    FTL_LOG(ERROR) << "Tracepoints can't be added while tracing is running";
+    return nullptr;
+  }
+  if (Find(number, address)) {
+    FTL_LOG(ERROR) << ftl::StringPrintf(
+        "Tracepoint %u already defined at 0x%" PRIxPTR, number, address);
+    return nullptr;
+  }
+
+  std::unique_ptr<Tracepoint> tracepoint(new Tracepoint);
+  tracepoint->number = number;
+  tracepoint->address = address;
+  tracepoint->enabled = enabled;
+  tracepoint->pass_count = pass_count;
+  tracepoints_.push_back(std::move(tracepoint));
+  return tracepoints_.back().get();
+}
+
+TracepointSet::Tracepoint* TracepointSet::Find(uint32_t number,
+                                               uintptr_t address) {
+  for (const auto& tracepoint : tracepoints_) {
+    if (tracepoint->number == number && tracepoint->address == address)
+      return tracepoint.get();
+  }
+  return nullptr;
+}
+
+std::vector<TracepointSet::Tracepoint*> TracepointSet::FindEnabledAt(
+    uintptr_t address) {
+  std::vector<Tracepoint*> result;
+  for (const auto& tracepoint : tracepoints_) {
+    if (tracepoint->enabled && tracepoint->address == address)
+      result.push_back(tracepoint.get());
+  }
+  return result;
+}
+
+bool TracepointSet::Start() {
+  if (running_) {
+    FTL_LOG(ERROR) << "Tracing is already running";
+    return false;
+  }
+
+  buffer_.Clear();
+  stop_tracepoint_ = 0;
+  for (const auto& tracepoint : tracepoints_) {
+    tracepoint->hit_count = 0;
+    if (!tracepoint->enabled ||
+        std::find(inserted_.begin(), inserted_.end(), tracepoint->address) !=
+            inserted_.end())
+      continue;
+    if (!process_->breakpoints()->InsertTracepointBreakpoint(
+            tracepoint->address)) {
+      FTL_LOG(ERROR) << ftl::StringPrintf(
+          "Unable to insert tracepoint %u at 0x%" PRIxPTR, tracepoint->number,
+          tracepoint->address);
+      RemoveBreakpoints();
+      return false;
+    }
+    inserted_.push_back(tracepoint->address);
+  }
+
+  running_ = true;
+  return true;
+}
+
+void TracepointSet::Stop(StopReason reason, uint32_t tracepoint) {
+  if (!running_)
+    return;
+
+  FTL_VLOG(1) << "Tracing stopped, " << buffer_.num_frames() << " frames";
+  RemoveBreakpoints();
+  running_ = false;
+  stop_reason_ = reason;
+  stop_tracepoint_ = tracepoint;
+}
+
+bool TracepointSet::AddFrame(util::TraceFrame frame) {
+  FTL_DCHECK(running_);
+  if (!buffer_.Add(std::move(frame))) {
+    Stop(StopReason::kBufferFull);
+    return false;
+  }
+  return true;
+}
+
+void TracepointSet::RemoveBreakpoints() {
+  // In a process that's gone this only drops the breakpoints' entries.
+  for (uintptr_t address : inserted_)
+    process_->breakpoints()->RemoveTracepointBreakpoint(address);
+  inserted_.clear();
+}
+
+}  // namespace debugserver
@@ -0,0 +1,133 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "lib/ftl/macros.h"
+
+#include "debugger-utils/agent-expression.h"
+#include "debugger-utils/trace-buffer.h"
+
+namespace debugserver {
+
+class Process;
+
+// The tracepoints of a process.
+//
+// A tracepoint is a breakpoint that, while tracing is running, records
+// registers and memory in a trace frame each time a thread hits it, and lets
+// the thread carry on. The client defines the tracepoints, starts and stops
+// tracing, and browses the frames afterwards (see "Tracepoints" in the gdb
+// manual). The breakpoints are only inserted while tracing is running.
+class TracepointSet final {
+ public:
+  // Why tracing isn't running.
+  enum class StopReason {
+    // Tracing hasn't been started.
+    kNotRun,
+    // The client stopped it.
+    kStopped,
+    // The trace buffer filled up.
+    kBufferFull,
+    // A tracepoint reached its pass count.
+    kPassCount,
+    // The process went away.
+    kProcessExited,
+  };
+
+  // A block of memory to collect.
+  struct MemoryRange {
+    // The register |offset| is relative to, or -1 if it's an address.
+    int base_regno;
+    uint64_t offset;
+    uint64_t length;
+  };
+
+  struct Tracepoint {
+    // Tracepoints are identified by their number and address: gdb uses the
+    // same number for all locations of a tracepoint.
+    uint32_t number;
+    uintptr_t address;
+    bool enabled;
+    // Tracing stops once the tracepoint has been hit this many times. Zero
+    // means there's no limit.
+    uint64_t pass_count;
+    // The number of hits since tracing was started.
+    uint64_t hit_count = 0;
+    // If present, hits only count when this holds.
+    std::unique_ptr<util::AgentExpression> condition;
+    // What to collect: the general registers, memory ranges, and what the
+    // trace instructions of agent expressions ask for.
+    bool collect_registers = false;
+    std::vector<MemoryRange> memory;
+    std::vector<std::unique_ptr<util::AgentExpression>> expressions;
+  };
+
+  explicit TracepointSet(Process* process);
+
+  // Discards all tracepoints and trace frames. Tracing must not be running.
+  void Clear();
+
+  // Defines tracepoint |number| at |address|. Returns nullptr if it's already
+  // defined or tracing is running.
+  Tracepoint* Add(uint32_t number,
+                  uintptr_t address,
+                  bool enabled,
+                  uint64_t pass_count);
+
+  // Returns tracepoint |number| at |address|, or nullptr if there's none.
+  Tracepoint* Find(uint32_t number, uintptr_t address);
+
+  // Returns the enabled tracepoints at |address|.
+  std::vector<Tracepoint*> FindEnabledAt(uintptr_t address);
+
+  // Discards the frames of the previous run, if any, and inserts the
+  // breakpoints of the enabled tracepoints. Returns false on failure, in
+  // which case tracing isn't running.
+  bool Start();
+
+  // Removes the breakpoints. |tracepoint| is the number of the tracepoint
+  // that reached its pass count if |reason| is kPassCount.
+  void Stop(StopReason reason, uint32_t tracepoint = 0);
+
+  bool running() const { return running_; }
+  StopReason stop_reason() const { return stop_reason_; }
+  uint32_t stop_tracepoint() const { return stop_tracepoint_; }
+
+  // Adds |frame| to the trace buffer. If there is no room tracing is stopped
+  // and false is returned.
+  bool AddFrame(util::TraceFrame frame);
+
+  util::TraceBuffer* buffer() { return &buffer_; }
+
+  const std::vector<std::unique_ptr<Tracepoint>>& tracepoints() const {
+    return tracepoints_;
+  }
+
+ private:
+  // Removes the breakpoints in |inserted_|.
+  void RemoveBreakpoints();
+
+  Process* process_;  // weak
+
+  std::vector<std::unique_ptr<Tracepoint>> tracepoints_;
+
+  // The addresses of the breakpoints inserted while tracing is running, one
+  // per address however many tracepoints share it.
+  std::vector<uintptr_t> inserted_;
+
+  util::TraceBuffer buffer_;
+
+  bool running_ = false;
+  StopReason stop_reason_ = StopReason::kNotRun;
+  uint32_t stop_tracepoint_ = 0;
+
+  FTL_DISALLOW_COPY_AND_ASSIGN(TracepointSet);
+};
+
+}  // namespace debugserver